@@ -6,12 +6,34 @@
 static struct evloop _loop = {};
 static struct ev _tm[3] = {0};
 
+#define MANY_TM_NUM (50000)
+static struct ev _many_tm[MANY_TM_NUM];
+static int _many_fired = 0;
+
+static struct ev _out = {};
+
 static void _process_timeout(struct evloop* loop, struct ev* ev, void* arg)
 {
     dtrace();
     dprint("arg = %p, timeout\n", arg);
 }
 
+static void _process_many_timeout(struct evloop* loop, struct ev* ev, void* arg)
+{
+    _many_fired++;
+    if (_many_fired == MANY_TM_NUM / 2)
+    {
+        dtrace();
+        dprint("%d timers fired", _many_fired);
+    }
+}
+
+static void _process_stdout(struct evloop* loop, struct ev* ev, void* arg)
+{
+    // oneshot, stays quiet until "rearm stdout"
+    dprint("stdout is %s", (ev->revents & EVIO_WRITE) ? "writable" : "not writable");
+}
+
 static void _process_sigint(struct evloop* loop, struct ev* ev, void* arg)
 {
     dtrace();
@@ -65,6 +87,31 @@ static void _process_stdin(struct evloop* loop, struct ev* ev, void* arg)
         evtm_stop(loop, &_tm[2]);
         dtrace();
     }
+    else if (strcmp(buf, "rearm stdout") == 0)
+    {
+        evio_modify(loop, &_out, EVIO_WRITE | EVIO_ONESHOT);
+    }
+    else if (strcmp(buf, "again tm2") == 0)
+    {
+        evtm_again(loop, &_tm[1]);
+        dtrace();
+    }
+    else if (strcmp(buf, "many tm") == 0)
+    {
+        // start all, then stop every other one, only one epoll fd is involved
+        int i;
+        _many_fired = 0;
+        for (i=0; i<MANY_TM_NUM; i++)
+        {
+            evtm_init(&_many_tm[i], 1000 + (i % 2000), 0, _process_many_timeout, NULL);
+            evtm_start(loop, &_many_tm[i]);
+        }
+        for (i=0; i<MANY_TM_NUM; i+=2)
+        {
+            evtm_stop(loop, &_many_tm[i]);
+        }
+        dtrace();
+    }
     else if (strcmp(buf, "ev once") == 0)
     {
         int i;
@@ -87,9 +134,12 @@ int main(int argc, char const *argv[])
 
     evloop_init(&_loop, 1000);
 
-    evio_init(&io, 0, _process_stdin, NULL);
+    evio_init(&io, 0, EVIO_READ, _process_stdin, NULL);
     evio_start(&_loop, &io);
 
+    evio_init(&_out, 1, EVIO_WRITE | EVIO_ONESHOT, _process_stdout, NULL);
+    evio_start(&_loop, &_out);
+
     evsig_init(&sig, SIGINT, _process_sigint, NULL);
     evsig_start(&_loop, &sig);
 
@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "basic.h"
+#include "events.h"
+#include "thread.h"
+
+#define BENCH_PRODUCERS (4)
+#define BENCH_PER_PRODUCER (200000)
+#define BENCH_WORK (200)
+
+static struct evgroup _group;
+static long _done = 0;
+
+static void _work(struct evloop* loop, struct ev* ev, void* arg)
+{
+    // a little cpu per message, so that more loops make a difference
+    unsigned int h = (unsigned int)(intptr_t)arg;
+    int i;
+    for (i=0; i<BENCH_WORK; i++)
+    {
+        h = h * 16777619u ^ i;
+    }
+    if (h == 0) dprint("h = 0");
+
+    __sync_add_and_fetch(&_done, 1);
+}
+
+static void _producer(void* arg)
+{
+    long i;
+    for (i=0; i<BENCH_PER_PRODUCER; i++)
+    {
+        while (evgroup_send(&_group, EVGROUP_ANY, _work, (void*)(intptr_t)i) != EV_OK) {}
+    }
+}
+
+static void _process_stdin(struct evloop* loop, struct ev* ev, void* arg)
+{
+    char buf[256] = {0};
+    int  readlen = read(ev->fd, buf, 256);
+    if (readlen <= 0) return;
+
+    dprint("loop %d got stdin", (int)(loop - evgroup_loop(&_group, 0)));
+}
+
+static void _bench(int loop_num)
+{
+    evgroup_init(&_group, loop_num, 100, EVGROUP_DIST_ROUNDROBIN);
+    evgroup_run(&_group);
+
+    _done = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct thread t[BENCH_PRODUCERS];
+    int i;
+    for (i=0; i<BENCH_PRODUCERS; i++)
+    {
+        t[i].func = _producer;
+        t[i].arg  = NULL;
+    }
+    thread_join(t, BENCH_PRODUCERS);
+
+    long total = (long)BENCH_PRODUCERS * BENCH_PER_PRODUCER;
+    while (__sync_fetch_and_add(&_done, 0) < total)
+    {
+        usleep(1000);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    dprint("%2d loops, %ld msgs, %.3f s, %.2f Mmsgs/s", loop_num, total, sec, total / sec / 1e6);
+
+    evgroup_uninit(&_group);
+}
+
+// posts of one thread are applied in order, even when some overflow the ring
+
+#define ORDER_PER_PRODUCER (100000)
+#define ORDER_WORK (2000)
+#define ORDER_BURST (1000)
+
+static long _order_next[BENCH_PRODUCERS];
+static long _order_bad = 0;
+
+static void _check_order(struct evloop* loop, struct ev* ev, void* arg)
+{
+    long p   = (long)(intptr_t)arg >> 32;
+    long seq = (long)(intptr_t)arg & 0xffffffff;
+    if (seq != _order_next[p]) _order_bad++;
+    _order_next[p] = seq + 1;
+
+    // slow enough that the producers refill the ring while it is drained
+    unsigned int h = (unsigned int)seq;
+    int i;
+    for (i=0; i<ORDER_WORK; i++)
+    {
+        h = h * 16777619u ^ i;
+    }
+    if (h == 0) dprint("h = 0");
+
+    __sync_add_and_fetch(&_done, 1);
+}
+
+static void _order_producer(void* arg)
+{
+    long p = (long)(intptr_t)arg;
+    long i;
+    for (i=0; i<ORDER_PER_PRODUCER; i++)
+    {
+        while (evgroup_send(&_group, 0, _check_order, (void*)(intptr_t)((p << 32) | i)) != EV_OK) {}
+
+        // bursts, so that posts also land while the loop is halfway through the ring
+        if (i % ORDER_BURST == 0) usleep(100);
+    }
+}
+
+static int _test_order(void)
+{
+    evgroup_init(&_group, 1, 100, EVGROUP_DIST_ROUNDROBIN);
+    evgroup_run(&_group);
+    _done = 0;
+
+    struct thread t[BENCH_PRODUCERS];
+    int i;
+    for (i=0; i<BENCH_PRODUCERS; i++)
+    {
+        t[i].func = _order_producer;
+        t[i].arg  = (void*)(intptr_t)i;
+    }
+    thread_join(t, BENCH_PRODUCERS);
+
+    long total = (long)BENCH_PRODUCERS * ORDER_PER_PRODUCER;
+    while (__sync_fetch_and_add(&_done, 0) < total)
+    {
+        usleep(1000);
+    }
+    evgroup_uninit(&_group);
+
+    dprint("%ld posts from %d threads, %ld out of order", total, BENCH_PRODUCERS, _order_bad);
+    return (_order_bad == 0) ? 0 : -1;
+}
+
+// evgroup_break must not wait for a loop that already left evloop_run
+
+static void _quit(struct evloop* loop, struct ev* ev, void* arg)
+{
+    evloop_break(loop);
+}
+
+static void _test_exited(void)
+{
+    evgroup_init(&_group, 2, 100, EVGROUP_DIST_ROUNDROBIN);
+    evgroup_run(&_group);
+
+    struct evloop* loop = evgroup_loop(&_group, 0);
+    evgroup_send(&_group, 0, _quit, NULL);
+    while (__atomic_load_n(&loop->is_exited, __ATOMIC_ACQUIRE) == 0)
+    {
+        usleep(1000);
+    }
+    evgroup_uninit(&_group);
+    dprint("loop exited before evgroup_break");
+}
+
+int main(int argc, char const *argv[])
+{
+    evgroup_init(&_group, 0, 100, EVGROUP_DIST_FDHASH);
+    dprint("%d loops", _group.loop_num);
+
+    struct ev io = {};
+    evio_init(&io, 0, EVIO_READ, _process_stdin, NULL);
+    evgroup_io_start(&_group, &io);
+
+    evgroup_run(&_group);
+    usleep(100 * 1000);
+    evgroup_io_stop(&_group, &io);
+    evgroup_uninit(&_group);
+
+    _test_exited();
+    CHECK_IF(_test_order() != 0, return -1, "posts applied out of order");
+
+    int cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    int loop_num;
+    for (loop_num=1; loop_num<=cpu_num; loop_num++)
+    {
+        _bench(loop_num);
+    }
+
+    dprint("ok");
+    return 0;
+}
@@ -1,4 +1,7 @@
 #include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
 #include "basic.h"
 
 #include "fast_queue.h"
@@ -40,6 +43,68 @@ static void _consumer(void* arg)
     }
 }
 
+#define BENCH_THREADS   (4)
+#define BENCH_PER_THREAD (1000000)
+
+struct bench
+{
+    struct fqueue* q;
+    long popped;
+};
+
+static void _bench_producer(void* arg)
+{
+    struct bench* b = (struct bench*)arg;
+    long i;
+    for (i=0; i<BENCH_PER_THREAD; i++)
+    {
+        while (fqueue_push(b->q, (void*)(intptr_t)(i+1)) != FQUEUE_OK)
+        {
+            sched_yield();
+        }
+    }
+}
+
+static void _bench_consumer(void* arg)
+{
+    struct bench* b = (struct bench*)arg;
+    long total = (long)BENCH_THREADS * BENCH_PER_THREAD;
+    while (__sync_fetch_and_add(&b->popped, 0) < total)
+    {
+        if (fqueue_pop(b->q))
+        {
+            __sync_add_and_fetch(&b->popped, 1);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+static void _bench(char* name, struct fqueue* q)
+{
+    struct bench b = {q, 0};
+    struct thread t[BENCH_THREADS * 2];
+    int i;
+    for (i=0; i<BENCH_THREADS; i++)
+    {
+        t[i].func = _bench_producer;
+        t[i].arg  = &b;
+        t[BENCH_THREADS + i].func = _bench_consumer;
+        t[BENCH_THREADS + i].arg  = &b;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    thread_join(t, BENCH_THREADS * 2);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    dprint("%-9s %d producers x %d consumers, %ld msgs, %.3f s, %.2f Mops/s",
+           name, BENCH_THREADS, BENCH_THREADS, b.popped, sec, b.popped / sec / 1e6);
+}
+
 int main(int argc, char const *argv[])
 {
     struct fqueue *q = fqueue_create(NULL);
@@ -88,6 +153,29 @@ int main(int argc, char const *argv[])
 
     fqueue_release(q);
 
+    q = fqueue_create_ex(NULL, FQUEUE_FLAG_LOCKFREE, 4);
+
+    fqueue_push(q, (void*)(intptr_t)1);
+    fqueue_push(q, (void*)(intptr_t)2);
+    fqueue_push(q, (void*)(intptr_t)3);
+    fqueue_push(q, (void*)(intptr_t)4);
+    chk = fqueue_push(q, (void*)(intptr_t)5);
+    dprint("lockfree full chk = %d", chk);
+
+    FQUEUE_FOREACH(q, data)
+    {
+        dprint("data = %p", data);
+    }
+    fqueue_release(q);
+
+    q = fqueue_create(NULL);
+    _bench("spinlock", q);
+    fqueue_release(q);
+
+    q = fqueue_create_ex(NULL, FQUEUE_FLAG_LOCKFREE, 4096);
+    _bench("lockfree", q);
+    fqueue_release(q);
+
     dprint("ok");
     return 0;
 }
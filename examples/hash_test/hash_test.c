@@ -72,6 +72,45 @@ int main(int argc, char const *argv[])
 
     hash_uninit(&h);
 
+    dprint("grow and churn");
+
+    hash_init(&h, 16, NULL);
+
+    char buf[32];
+    long i;
+    for (i = 1; i <= 200000; i++)
+    {
+        snprintf(buf, sizeof(buf), "key%ld", i);
+        hash_add(&h, buf, (void*)i);
+    }
+    dprint("after add, num = %d", hash_num(&h));
+
+    for (i = 1; i <= 200000; i += 2)
+    {
+        snprintf(buf, sizeof(buf), "key%ld", i);
+        hash_del(&h, buf, &value);
+    }
+    dprint("after del, num = %d", hash_num(&h));
+
+    int miss = 0;
+    for (i = 1; i <= 200000; i++)
+    {
+        snprintf(buf, sizeof(buf), "key%ld", i);
+        value = hash_find(&h, buf);
+        if ((i % 2) && value) miss++;
+        if (((i % 2) == 0) && ((long)value != i)) miss++;
+    }
+    dprint("miss = %d", miss);
+
+    long sum = 0;
+    HASH_FOREACH(&h, key, value)
+    {
+        sum += (long)value;
+    }
+    dprint("sum = %ld", sum);
+
+    hash_uninit(&h);
+
     dprint("ok");
 
     return 0;
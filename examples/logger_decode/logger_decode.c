@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "basic.h"
+#include "logger.h"
+
+// renders a logger_set_binary file as the text sink would have written it
+//
+// logger_decode FILE [-l LEVEL] [-f FROM] [-t TO]
+//   -l : only records with level <= LEVEL (LOG_LV_FATAL 0 ... LOG_LV_V3 6)
+//   -f, -t : only records between FROM and TO seconds after the first one
+
+struct decoder
+{
+    char* map;
+    long size;
+    struct log_bin_head head;
+
+    const char** fmts; // by call site id
+    int fmt_num;
+    int fmt_cap;
+
+    int level;
+    double from;
+    double to;
+    uint64_t first_ts;
+};
+
+static void _usage(void)
+{
+    fprintf(stderr, "usage : logger_decode FILE [-l LEVEL] [-f FROM_SEC] [-t TO_SEC]\n");
+}
+
+static int _add_fmt(struct decoder* d, uint32_t id, const char* fmt)
+{
+    if (id >= d->fmt_cap)
+    {
+        int cap = (d->fmt_cap > 0) ? d->fmt_cap * 2 : 64;
+        while (cap <= id) cap *= 2;
+
+        const char** fmts = realloc(d->fmts, sizeof(char*) * cap);
+        CHECK_IF(fmts == NULL, return FAIL, "realloc failed");
+        memset(fmts + d->fmt_cap, 0, sizeof(char*) * (cap - d->fmt_cap));
+        d->fmts = fmts;
+        d->fmt_cap = cap;
+    }
+    d->fmts[id] = fmt;
+    if (id >= d->fmt_num) d->fmt_num = id + 1;
+    return OK;
+}
+
+static void _print_rec(struct decoder* d, struct log_bin_entry* e, const char* payload)
+{
+    uint64_t ts;
+    CHECK_IF(e->len < sizeof(ts), return, "record too short, len = %d", e->len);
+    memcpy(&ts, payload, sizeof(ts));
+
+    if (d->first_ts == 0) d->first_ts = ts;
+    if (e->level > d->level) return;
+
+    double sec = (double)(ts - d->first_ts) / 1e9;
+    if ((sec < d->from) || (sec > d->to)) return;
+
+    if (e->kind == LOG_BIN_STR)
+    {
+        fwrite(payload + sizeof(ts), 1, e->len - sizeof(ts), stdout);
+        return;
+    }
+
+    CHECK_IF((e->id >= d->fmt_num) || (d->fmts[e->id] == NULL), return, "unknown call site %u", e->id);
+
+    char line[LOG_LINE_MAX];
+    uint64_t wall = ts + d->head.wall_offset;
+    int len = snprintf(line, sizeof(line), "(%03lds,%03ldms): ", (long)(wall / 1000000000 % 1000), (long)(wall / 1000000 % 1000));
+    len += logger_format(line + len, sizeof(line) - len, d->fmts[e->id], payload + sizeof(ts), e->len - sizeof(ts));
+    fwrite(line, 1, len, stdout);
+}
+
+static int _decode(struct decoder* d)
+{
+    CHECK_IF(d->size < sizeof(struct log_bin_head), return FAIL, "file too short");
+    memcpy(&d->head, d->map, sizeof(d->head));
+    CHECK_IF(memcmp(d->head.magic, LOG_BIN_MAGIC, sizeof(LOG_BIN_MAGIC)) != 0, return FAIL, "not a binary log");
+    CHECK_IF(d->head.version != LOG_BIN_VERSION, return FAIL, "version = %u unknown", d->head.version);
+    CHECK_IF(d->head.seg_size == 0, return FAIL, "seg_size is 0");
+
+    long seg = d->head.seg_size;
+    long pos = sizeof(struct log_bin_head);
+    struct log_bin_entry e;
+    while (pos + (long)sizeof(e) <= d->size)
+    {
+        memcpy(&e, d->map + pos, sizeof(e));
+        if (e.kind == 0)
+        {
+            // unused end of a segment
+            pos = (pos / seg + 1) * seg;
+            continue;
+        }
+
+        const char* payload = d->map + pos + sizeof(e);
+        pos += sizeof(e) + e.len;
+        CHECK_IF(pos > d->size, return FAIL, "entry cut at the end of the file");
+
+        if (e.kind == LOG_BIN_FMT)
+        {
+            CHECK_IF((e.len == 0) || (payload[e.len - 1] != '\0'), return FAIL, "bad format entry");
+            CHECK_IF(_add_fmt(d, e.id, payload) != OK, return FAIL, "_add_fmt failed");
+        }
+        else if ((e.kind == LOG_BIN_REC) || (e.kind == LOG_BIN_STR))
+        {
+            _print_rec(d, &e, payload);
+        }
+        else
+        {
+            derror("unknown entry kind %d at %ld", e.kind, pos);
+            return FAIL;
+        }
+    }
+    return OK;
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        _usage();
+        return -1;
+    }
+
+    struct decoder d = {};
+    d.level = LOG_LEVELS;
+    d.from  = 0;
+    d.to    = 1e18;
+
+    int i;
+    for (i=2; i+1<argc; i+=2)
+    {
+        if (strcmp(argv[i], "-l") == 0) d.level = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-f") == 0) d.from = atof(argv[i+1]);
+        else if (strcmp(argv[i], "-t") == 0) d.to = atof(argv[i+1]);
+        else
+        {
+            _usage();
+            return -1;
+        }
+    }
+    if (i != argc)
+    {
+        _usage();
+        return -1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    CHECK_IF(fd < 0, return -1, "open %s failed", argv[1]);
+
+    struct stat st;
+    CHECK_IF(fstat(fd, &st) != 0, return -1, "fstat failed");
+    d.size = st.st_size;
+    CHECK_IF(d.size == 0, return -1, "%s is empty", argv[1]);
+
+    d.map = mmap(NULL, d.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    CHECK_IF(d.map == MAP_FAILED, return -1, "mmap failed");
+
+    int ret = _decode(&d);
+    munmap(d.map, d.size);
+    free(d.fmts);
+    return (ret == OK) ? 0 : -1;
+}
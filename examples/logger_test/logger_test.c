@@ -1,4 +1,11 @@
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "basic.h"
+
+// V3 statements of this file are compiled out, _test_levels checks their arguments are never evaluated
+#define LOG_LV_COMPILE LOG_LV_V2
 #include "logger.h"
 #include "thread.h"
 #include "queue.h"
@@ -28,8 +35,377 @@ static void _printer(void* arg)
     logger_break(lg);
 }
 
+// logger_test bench : ns per log_print call with a file sink, the logger runs on its own thread
+
+#define BENCH_NUM   (256 * 1024)
+#define BENCH_FILE  "/tmp/taco_logger_bench.txt"
+#define BENCH_PORT  (55557)
+
+#define BIN_FILE  "/tmp/taco_logger.bin"
+#define BIN_TEXT  "/tmp/taco_logger_bin.txt"
+#define BIN_SEG   (64 * 1024)
+#define BIN_LINES (100000)
+#define BIN_ENQ   (100 * 1024) // a logger_enq string longer than a segment
+
+#define LEVELS_FILE  "/tmp/taco_logger_levels.txt"
+#define LEVELS_CALLS (10 * 1000 * 1000)
+
+#define ROTATE_FILE  "/tmp/taco_logger_rotate.txt"
+#define ROTATE_SIZE  (64 * 1024)
+#define ROTATE_LINES (20000)
+
+struct bench
+{
+    struct logger* lg;
+    long cost_ns;
+};
+
+static long _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void _bench_writer(void* arg)
+{
+    struct bench* b = (struct bench*)arg;
+    int i;
+    long start = _now_ns();
+    for (i=0; i<BENCH_NUM; i++)
+    {
+        log_print(b->lg, LOG_LV_V1, "bench %d of %s, %.3f done\n", i, "writer", i * 100.0 / BENCH_NUM);
+    }
+    b->cost_ns = _now_ns() - start;
+}
+
+static long _count_lines(char* path)
+{
+    FILE* fp = fopen(path, "r");
+    CHECK_IF(fp == NULL, return -1, "fopen failed");
+
+    long lines = 0;
+    int c;
+    while ((c = fgetc(fp)) != EOF)
+    {
+        if (c == '\n') lines++;
+    }
+    fclose(fp);
+    return lines;
+}
+
+struct bench_logger
+{
+    struct logger* lg;
+    long cpu_ns;
+};
+
+// logger_run with the cpu time it took, formatting and sinks included
+static void _bench_logger(void* arg)
+{
+    struct bench_logger* bl = (struct bench_logger*)arg;
+    struct timespec ts;
+    logger_run(bl->lg);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    bl->cpu_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+struct driver
+{
+    struct logger* lg;
+    struct bench* benches;
+    int writer_num;
+};
+
+// run the writers, then stop the logger once they are done
+static void _driver(void* arg)
+{
+    struct driver* d = (struct driver*)arg;
+    struct thread t[d->writer_num];
+    int i;
+    for (i=0; i<d->writer_num; i++)
+    {
+        t[i].func = _bench_writer;
+        t[i].arg  = &d->benches[i];
+    }
+    thread_join(t, d->writer_num);
+    logger_break(d->lg);
+}
+
+// a full ring spills to the heap and nothing is lost, unless the logger drops
+static int _bench(int writer_num, bool drop)
+{
+    struct logger* lg = logger_create();
+    if (drop) logger_set_drop(lg);
+    logger_set_file(lg, BENCH_FILE);
+    logger_set_udp(lg, "127.0.0.1", BENCH_PORT);
+    logger_set_level(lg, LOG_LV_V1);
+
+    // a bound socket nobody reads, datagrams to a closed port would cost an icmp error each
+    struct udp sink = {};
+    udp_init(&sink, "127.0.0.1", BENCH_PORT);
+
+    struct bench b[writer_num];
+    int i;
+    for (i=0; i<writer_num; i++)
+    {
+        b[i].lg = lg;
+    }
+
+    struct bench_logger bl = {lg, 0};
+    struct driver d = {lg, b, writer_num};
+    struct thread t[2] = {
+        {_bench_logger, &bl},
+        {_driver, &d}
+    };
+    thread_join(t, 2);
+    logger_release(lg);
+    udp_uninit(&sink);
+
+    long cost = 0;
+    for (i=0; i<writer_num; i++)
+    {
+        cost += b[i].cost_ns;
+    }
+    long lines = _count_lines(BENCH_FILE);
+    unlink(BENCH_FILE);
+
+    dprint("%d writers%s : %.1f ns per log_print, %ld of %d lines written, logger_run %.1f ns per line",
+           writer_num, drop ? " dropping" : "", (double)cost / (writer_num * BENCH_NUM), lines, writer_num * BENCH_NUM,
+           (double)bl.cpu_ns / lines);
+    if (drop) return (lines > 0) ? 0 : -1;
+    return (lines == writer_num * BENCH_NUM) ? 0 : -1;
+}
+
+static void _bin_writer(void* arg)
+{
+    struct logger* lg = (struct logger*)arg;
+    int i;
+    for (i=0; i<BIN_LINES; i++)
+    {
+        if (i % 3 == 0) log_print(lg, LOG_LV_INFO, "bin %d of %s, %.3f done\n", i, "writer", i * 100.0 / BIN_LINES);
+        if (i % 3 == 1) log_print(lg, LOG_LV_WARN, "bin %ld %zu %p %c\n", -(long)i, (size_t)i * 7, (void*)(long)i, 'a' + i % 26);
+        if (i % 3 == 2) log_print(lg, LOG_LV_V1, "bin %-8.3s|%*d|%%\n", "abcdef", 6, i);
+        if ((i & 255) == 255) usleep(1000);
+
+        if (i == BIN_LINES / 2)
+        {
+            char* str = malloc(BIN_ENQ + 1);
+            memset(str, 'a' + i % 26, BIN_ENQ);
+            str[BIN_ENQ - 1] = '\n';
+            str[BIN_ENQ] = '\0';
+            logger_enq(lg, str);
+        }
+    }
+    logger_break(lg);
+}
+
+static long _run_binary(int flags)
+{
+    struct logger* lg = logger_create();
+    logger_set_level(lg, LOG_LV_V1);
+    if (flags & LOG_FLAG_FILE) logger_set_file(lg, BIN_TEXT);
+    if (flags & LOG_FLAG_BINARY) logger_set_binary(lg, BIN_FILE, BIN_SEG);
+
+    struct bench_logger bl = {lg, 0};
+    struct thread t[2] = {
+        {_bench_logger, &bl},
+        {_bin_writer, lg}
+    };
+    thread_join(t, 2);
+    logger_release(lg);
+    return bl.cpu_ns;
+}
+
+static long _file_size(char* path)
+{
+    struct stat st;
+    return (stat(path, &st) == 0) ? (long)st.st_size : -1;
+}
+
+// logger_test binary : text sink against binary sink, both files are left for logger_decode
+static int _test_binary(void)
+{
+    long text_ns = _run_binary(LOG_FLAG_FILE);
+    long text_size = _file_size(BIN_TEXT);
+    long bin_ns = _run_binary(LOG_FLAG_BINARY);
+    long bin_size = _file_size(BIN_FILE);
+    CHECK_IF((text_size <= 0) || (bin_size <= 0), return -1, "nothing written");
+
+    dprint("text   : logger_run %.1f ns per line, %ld bytes", (double)text_ns / BIN_LINES, text_size);
+    dprint("binary : logger_run %.1f ns per line, %ld bytes", (double)bin_ns / BIN_LINES, bin_size);
+
+    _run_binary(LOG_FLAG_FILE | LOG_FLAG_BINARY);
+    dprint("logger_decode %s | cmp - %s", BIN_FILE, BIN_TEXT);
+    return 0;
+}
+
+static int _evals = 0;
+
+static int _eval(void)
+{
+    return ++_evals;
+}
+
+static long _count_with(char* path, char* text)
+{
+    FILE* fp = fopen(path, "r");
+    CHECK_IF(fp == NULL, return -1, "fopen failed");
+
+    char line[LOG_LINE_MAX];
+    long num = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strstr(line, text)) num++;
+    }
+    fclose(fp);
+    return num;
+}
+
+static void _levels_writer(void* arg)
+{
+    struct logger* lg = (struct logger*)arg;
+    int i;
+
+    // allowed at run time, gone at compile time
+    logger_set_level(lg, LOG_LV_V3);
+    log_print(lg, LOG_LV_V3, "v3 %d\n", _eval());
+    logger_set_level(lg, LOG_LV_INFO);
+
+    log_print(lg, LOG_LV_V1, "file v1\n");
+    logger_set_module_level(lg, "net", LOG_LV_V1);
+    log_mprint(lg, "net", LOG_LV_V1, "net v1\n");
+    logger_set_module_level(lg, "net", LOG_LV_INVALID);
+    log_mprint(lg, "net", LOG_LV_V1, "net v1 again\n");
+
+    for (i=0; i<1000; i++)
+    {
+        log_print_every(lg, LOG_LV_INFO, 10, "every %d\n", i);
+        log_print_rate(lg, LOG_LV_INFO, 5, "rate %d\n", i);
+    }
+
+    long start = _now_ns();
+    for (i=0; i<LEVELS_CALLS; i++)
+    {
+        log_print(lg, LOG_LV_V1, "filtered %d\n", i);
+    }
+    dprint("filtered log_print : %.2f ns", (double)(_now_ns() - start) / LEVELS_CALLS);
+
+    logger_break(lg);
+}
+
+// logger_test levels : compile time level, module levels, sampled and rate limited statements
+static int _test_levels(void)
+{
+    struct logger* lg = logger_create();
+    logger_set_file(lg, LEVELS_FILE);
+
+    struct thread t[2] = {
+        {_logger, lg},
+        {_levels_writer, lg}
+    };
+    thread_join(t, 2);
+    logger_release(lg);
+
+    long file_v1 = _count_with(LEVELS_FILE, "file v1");
+    long net_v1  = _count_with(LEVELS_FILE, "net v1");
+    long every   = _count_with(LEVELS_FILE, "every");
+    long rate    = _count_with(LEVELS_FILE, "rate");
+    unlink(LEVELS_FILE);
+
+    dprint("evals %d, file v1 %ld, net v1 %ld, every %ld, rate %ld", _evals, file_v1, net_v1, every, rate);
+    CHECK_IF(_evals != 0, return -1, "a compiled out statement was evaluated");
+    CHECK_IF((file_v1 != 0) || (net_v1 != 1), return -1, "module levels not applied");
+    CHECK_IF(every != 100, return -1, "every = %ld", every);
+    CHECK_IF((rate < 5) || (rate > 10), return -1, "rate = %ld", rate);
+    return 0;
+}
+
+static void _rotate_writer(void* arg)
+{
+    struct logger* lg = (struct logger*)arg;
+    int i;
+    for (i=0; i<ROTATE_LINES; i++)
+    {
+        log_print(lg, LOG_LV_INFO, "rotate line %05d\n", i);
+        if ((i & 255) == 255) usleep(1000);
+    }
+    logger_break(lg);
+}
+
+// logger_test rotate : the file is rotated by size while logger_run keeps going
+static int _test_rotate(void)
+{
+    struct logger* lg = logger_create();
+    logger_set_file(lg, ROTATE_FILE);
+    logger_set_rotate(lg, ROTATE_SIZE, 0, 3);
+
+    struct thread t[2] = {
+        {_logger, lg},
+        {_rotate_writer, lg}
+    };
+    thread_join(t, 2);
+    logger_release(lg);
+
+    char path[64];
+    struct stat st;
+    long lines = 0;
+    int i;
+    int ret = 0;
+    for (i=0; i<=4; i++)
+    {
+        if (i == 0) snprintf(path, sizeof(path), "%s", ROTATE_FILE);
+        else snprintf(path, sizeof(path), "%s.%d", ROTATE_FILE, i);
+
+        if (stat(path, &st) != 0)
+        {
+            if (i < 4) ret = -1;
+            continue;
+        }
+
+        if ((i == 4) || (st.st_size > ROTATE_SIZE)) ret = -1;
+        dprint("%s : %ld bytes", path, (long)st.st_size);
+        lines += _count_lines(path);
+        unlink(path);
+    }
+    CHECK_IF(ret != 0, return -1, "bad rotation");
+
+    // 4 files of at most ROTATE_SIZE bytes are kept out of the whole log
+    CHECK_IF((lines <= 0) || (lines >= ROTATE_LINES), return -1, "lines = %ld", lines);
+    return 0;
+}
+
 int main(int argc, char const *argv[])
 {
+    if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+    {
+        int ret = _bench(1, false) | _bench(4, false) | _bench(4, true);
+        CHECK_IF(ret != 0, return -1, "lines got lost");
+        dprint("ok");
+        return 0;
+    }
+
+    if ((argc > 1) && (strcmp(argv[1], "binary") == 0))
+    {
+        CHECK_IF(_test_binary() != 0, return -1, "_test_binary failed");
+        dprint("ok");
+        return 0;
+    }
+
+    if ((argc > 1) && (strcmp(argv[1], "levels") == 0))
+    {
+        CHECK_IF(_test_levels() != 0, return -1, "_test_levels failed");
+        dprint("ok");
+        return 0;
+    }
+
+    if ((argc > 1) && (strcmp(argv[1], "rotate") == 0))
+    {
+        CHECK_IF(_test_rotate() != 0, return -1, "_test_rotate failed");
+        dprint("ok");
+        return 0;
+    }
+
     struct logger* lg = logger_create();
 
     logger_set_udp(lg, "127.0.0.1", 55555);
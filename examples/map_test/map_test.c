@@ -1,6 +1,8 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "basic.h"
 #include "thread.h"
@@ -75,6 +77,76 @@ static void _create(void* arg)
     }
 }
 
+#define BENCH_THREADS (4)
+#define BENCH_IDS (64)
+#define BENCH_LOOPS (1000000)
+#define BENCH_CHURN (20000)
+
+static mapid _bench_ids[BENCH_IDS];
+static long _bench_bad = 0;
+
+static void _bench_reader(void* arg)
+{
+    struct map* map = (struct map*)arg;
+    unsigned int seed = (unsigned int)(intptr_t)&seed;
+    int i, r;
+    void* ptr;
+    for (i=0; i<BENCH_LOOPS; i++)
+    {
+        r = rand_r(&seed) % BENCH_IDS;
+        ptr = map_grab(map, _bench_ids[r]);
+        if (ptr != (void*)((intptr_t)r+1)) __sync_add_and_fetch(&_bench_bad, 1);
+        map_release(map, _bench_ids[r]);
+    }
+}
+
+// keeps adding and dropping entries, so the slot array grows while readers run
+static void _bench_writer(void* arg)
+{
+    struct map* map = (struct map*)arg;
+    int i;
+    mapid id;
+    for (i=0; i<BENCH_CHURN; i++)
+    {
+        id = map_new(map, (void*)((intptr_t)-1));
+        if ((i % 4) != 0) map_release(map, id);
+    }
+}
+
+static void _bench(int flag)
+{
+    struct map map;
+    map_init_ex(&map, NULL, flag);
+
+    int i;
+    for (i=0; i<BENCH_IDS; i++)
+    {
+        _bench_ids[i] = map_new(&map, (void*)((intptr_t)i+1));
+    }
+    _bench_bad = 0;
+
+    struct thread t[BENCH_THREADS + 1];
+    for (i=0; i<BENCH_THREADS; i++)
+    {
+        t[i].func = _bench_reader;
+        t[i].arg  = &map;
+    }
+    t[BENCH_THREADS].func = _bench_writer;
+    t[BENCH_THREADS].arg  = &map;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    thread_join(t, BENCH_THREADS + 1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long total = (long)BENCH_THREADS * BENCH_LOOPS;
+    dprint("%s : %ld grab/release, %.3f s, %.2f Mops/s, %d slots, bad = %ld",
+            (flag & MAP_FLAG_LOCKFREE) ? "lockfree" : "rwlock  ", total, sec, total / sec / 1e6, map.max_num, _bench_bad);
+
+    map_uninit(&map);
+}
+
 int main(int argc, char const *argv[])
 {
     struct map map;
@@ -92,5 +164,8 @@ int main(int argc, char const *argv[])
 
     map_uninit(&map);
 
+    _bench(0);
+    _bench(MAP_FLAG_LOCKFREE);
+
     return 0;
 }
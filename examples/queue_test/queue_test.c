@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <time.h>
+#include <unistd.h>
 #include "basic.h"
 #include "queue.h"
 #include "thread.h"
@@ -33,10 +35,10 @@ static void _consumer(void* arg)
     }
 }
 
-int main(int argc, char const *argv[])
+static int _test(int mode)
 {
     struct queue q;
-    queue_init(&q, -1, NULL, 0);
+    queue_init(&q, -1, NULL, mode);
 
     queue_push(&q, (void*)(intptr_t)1);
     queue_push(&q, (void*)(intptr_t)2);
@@ -54,13 +56,14 @@ int main(int argc, char const *argv[])
     }
     queue_clean(&q);
 
-    queue_init(&q, 3, _cleanFn, 0);
+    queue_init(&q, 3, _cleanFn, mode);
 
     queue_push(&q, (void*)(intptr_t)10);
     queue_push(&q, (void*)(intptr_t)20);
     queue_push(&q, (void*)(intptr_t)30);
     int chk = queue_push(&q, (void*)(intptr_t)40);
     dprint("chk = %d", chk);
+    CHECK_IF(chk != QUEUE_FAIL, return -1, "pushed into a full queue");
 
     dprint("queue_num = %d", queue_num(&q));
 
@@ -71,7 +74,7 @@ int main(int argc, char const *argv[])
 
     queue_clean(&q);
 
-    queue_init(&q, 5, NULL, QUEUE_FLAG_PUSH_BLOCK | QUEUE_FLAG_POP_BLOCK);
+    queue_init(&q, 5, NULL, mode | QUEUE_FLAG_PUSH_BLOCK | QUEUE_FLAG_POP_BLOCK);
     // queue_init(&q, 5, NULL, QUEUE_FLAG_POP_BLOCK);
     // queue_init(&q, 5, NULL, QUEUE_FLAG_PUSH_BLOCK);
 
@@ -83,6 +86,97 @@ int main(int argc, char const *argv[])
     thread_join(t, 2);
 
     queue_clean(&q);
+    return 0;
+}
+
+// queue_test bench : 4 producers and 4 blocking consumers, every value is seen once
+
+#define BENCH_THREADS (4)
+#define BENCH_NUM     (250000)
+
+struct bench
+{
+    struct queue* q;
+    int id;
+    long sum;
+    long num;
+};
+
+static long _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void _bench_producer(void* arg)
+{
+    struct bench* b = (struct bench*)arg;
+    long i;
+    for (i=0; i<BENCH_NUM; i++)
+    {
+        while (queue_push(b->q, (void*)(intptr_t)(b->id * BENCH_NUM + i + 1)) != QUEUE_OK) {}
+    }
+}
+
+static void _bench_consumer(void* arg)
+{
+    struct bench* b = (struct bench*)arg;
+    long i;
+    for (i=0; i<BENCH_NUM; i++)
+    {
+        b->sum += (intptr_t)queue_pop(b->q);
+        b->num++;
+    }
+}
+
+static int _bench(int mode, int depth)
+{
+    struct queue q;
+    queue_init(&q, depth, NULL, mode | QUEUE_FLAG_PUSH_BLOCK | QUEUE_FLAG_POP_BLOCK);
+
+    struct bench b[2 * BENCH_THREADS] = {};
+    struct thread t[2 * BENCH_THREADS];
+    int i;
+    for (i=0; i<2*BENCH_THREADS; i++)
+    {
+        b[i].q  = &q;
+        b[i].id = i;
+        t[i].func = (i < BENCH_THREADS) ? _bench_producer : _bench_consumer;
+        t[i].arg  = &b[i];
+    }
+
+    long start = _now_ns();
+    thread_join(t, 2 * BENCH_THREADS);
+    long cost = _now_ns() - start;
+    queue_clean(&q);
+
+    long total = (long)BENCH_THREADS * BENCH_NUM;
+    long sum = 0;
+    long num = 0;
+    for (i=BENCH_THREADS; i<2*BENCH_THREADS; i++)
+    {
+        sum += b[i].sum;
+        num += b[i].num;
+    }
+
+    dprint("%s depth %d : %.1f ns per item", (mode & QUEUE_FLAG_LOCKFREE) ? "lockfree" : "locked  ", depth, (double)cost / total);
+    CHECK_IF((num != total) || (sum != total * (total + 1) / 2), return -1, "num = %ld, sum = %ld", num, sum);
+    return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+    {
+        int ret = _bench(0, -1) | _bench(QUEUE_FLAG_LOCKFREE, -1) | _bench(0, 1024) | _bench(QUEUE_FLAG_LOCKFREE, 1024);
+        CHECK_IF(ret != 0, return -1, "_bench failed");
+        dprint("ok");
+        return 0;
+    }
+
+    CHECK_IF(_test(0) != 0, return -1, "_test failed");
+    CHECK_IF(_test(QUEUE_FLAG_LOCKFREE) != 0, return -1, "_test lockfree failed");
 
     dprint("ok");
     return 0;
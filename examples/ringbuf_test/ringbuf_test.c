@@ -1,11 +1,54 @@
+#include <sched.h>
 #include "basic.h"
 #include "ringbuf.h"
+#include "thread.h"
 
 struct taco
 {
     int a;
 };
 
+#define SPSC_TOTAL (1000000)
+#define SPSC_BATCH (32)
+
+static void _spsc_producer(void* arg)
+{
+    struct ringbuf* rb = (struct ringbuf*)arg;
+    struct taco batch[SPSC_BATCH];
+    int next = 0;
+    int i, num;
+    while (next < SPSC_TOTAL)
+    {
+        for (i=0; i<SPSC_BATCH; i++)
+        {
+            batch[i].a = next + i;
+        }
+        num = ringbuf_write_n(rb, batch, SPSC_BATCH);
+        if (num == 0) sched_yield();
+        next += num;
+    }
+}
+
+static void _spsc_consumer(void* arg)
+{
+    struct ringbuf* rb = (struct ringbuf*)arg;
+    struct taco batch[SPSC_BATCH];
+    int expect = 0;
+    int error  = 0;
+    int i, num;
+    while (expect < SPSC_TOTAL)
+    {
+        num = ringbuf_read_n(rb, batch, SPSC_BATCH);
+        if (num == 0) sched_yield();
+        for (i=0; i<num; i++)
+        {
+            if (batch[i].a != expect + i) error++;
+        }
+        expect += num;
+    }
+    dprint("received %d elements, %d out of order", expect, error);
+}
+
 int main(int argc, char const *argv[])
 {
     struct ringbuf rb = {};
@@ -80,6 +123,22 @@ int main(int argc, char const *argv[])
 
     ringbuf_uninit(&rb);
 
+    dprint("");
+
+    dprint("4th Ring Use Case : spsc between two threads with batched write and read");
+
+    ringbuf_init_spsc(&rb, 1000, sizeof(struct taco), NULL);
+    dprint("rb size = %d", rb.size);
+
+    struct thread t[2] = {
+        {_spsc_producer, &rb},
+        {_spsc_consumer, &rb}
+    };
+    thread_join(t, 2);
+    dprint("ringbuf is %s", ringbuf_empty(&rb) ? "empty" : "not empty");
+
+    ringbuf_uninit(&rb);
+
     dprint("over");
     return 0;
 }
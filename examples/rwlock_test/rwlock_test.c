@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "basic.h"
+#include "rwlock.h"
+
+#define BENCH_OPS (400000)  // split over the threads of one round
+#define BENCH_WRITE_PCT (10)
+#define BENCH_DATA (16)
+
+#define LOCK_RWLOCK  (0)
+#define LOCK_BRLOCK  (1)
+#define LOCK_PTHREAD (2)
+
+static const char* _names[] = {"rwlock ", "brlock ", "pthread"};
+
+static struct rwlock _rwlock;
+static struct brlock _brlock;
+static pthread_rwlock_t _prwlock;
+
+// every write bumps all of them, a reader seeing them differ means the lock is broken
+static volatile long _data[BENCH_DATA];
+static long _bad = 0;
+
+struct bench_arg
+{
+    int type;
+    int ops;
+    unsigned int seed;
+};
+
+static void _read_data(void)
+{
+    long first = _data[0];
+    int i;
+    for (i=1; i<BENCH_DATA; i++)
+    {
+        if (_data[i] != first) __sync_add_and_fetch(&_bad, 1);
+    }
+}
+
+static void _write_data(void)
+{
+    int i;
+    for (i=0; i<BENCH_DATA; i++)
+    {
+        _data[i]++;
+    }
+}
+
+static void* _worker(void* arg)
+{
+    struct bench_arg* b = (struct bench_arg*)arg;
+    int i, slot;
+    for (i=0; i<b->ops; i++)
+    {
+        int is_write = (rand_r(&b->seed) % 100) < BENCH_WRITE_PCT;
+        switch (b->type)
+        {
+            case LOCK_RWLOCK:
+                if (is_write) { rwlock_wlock(&_rwlock); _write_data(); rwlock_wunlock(&_rwlock); }
+                else          { rwlock_rlock(&_rwlock); _read_data();  rwlock_runlock(&_rwlock); }
+                break;
+
+            case LOCK_BRLOCK:
+                if (is_write) { brlock_wlock(&_brlock); _write_data(); brlock_wunlock(&_brlock); }
+                else          { slot = brlock_rlock(&_brlock); _read_data(); brlock_runlock(&_brlock, slot); }
+                break;
+
+            default:
+                if (is_write) { pthread_rwlock_wrlock(&_prwlock); _write_data(); pthread_rwlock_unlock(&_prwlock); }
+                else          { pthread_rwlock_rdlock(&_prwlock); _read_data();  pthread_rwlock_unlock(&_prwlock); }
+                break;
+        }
+    }
+    return NULL;
+}
+
+static void _bench(int type, int thread_num)
+{
+    pthread_t tids[thread_num];
+    struct bench_arg args[thread_num];
+    struct timespec start, end;
+    int i;
+
+    _bad = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0; i<thread_num; i++)
+    {
+        args[i].type = type;
+        args[i].ops  = BENCH_OPS / thread_num;
+        args[i].seed = i + 1;
+        pthread_create(&tids[i], NULL, _worker, &args[i]);
+    }
+    for (i=0; i<thread_num; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    dprint("%s %2d threads : %.3f s, %.2f Mops/s, bad = %ld", _names[type], thread_num, sec, BENCH_OPS / sec / 1e6, _bad);
+}
+
+int main(int argc, char const *argv[])
+{
+    rwlock_init(&_rwlock);
+    brlock_init(&_brlock);
+    pthread_rwlock_init(&_prwlock, NULL);
+
+    int type, thread_num;
+    for (thread_num=1; thread_num<=64; thread_num*=2)
+    {
+        for (type=LOCK_RWLOCK; type<=LOCK_PTHREAD; type++)
+        {
+            _bench(type, thread_num);
+        }
+    }
+
+    pthread_rwlock_destroy(&_prwlock);
+    dprint("ok");
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <time.h>
+#include "basic.h"
+#include "service.h"
+
+// request/response latency with many calls in flight, then a call that must time out
+
+#define CALL_NUM (200000)
+
+struct client
+{
+    serviceid server;
+    serviceid blackhole;
+    int depth;
+    int issued;
+    int done;
+    int timeouts;
+    int plain; // messages with a negative session, they are no replies
+    long* lat;
+};
+
+static long _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static ret_t _on_timeout(serviceid self, void* db, int status, void* msg, int msglen, void* arg)
+{
+    struct client* c = (struct client*)db;
+    CHECK_IF(status != SERV_CALL_TIMEOUT, return RET_OK, "status = %d, expect timeout", status);
+
+    c->timeouts++;
+    service_system_break();
+    return RET_OK;
+}
+
+static void _issue(serviceid self, struct client* c);
+
+static ret_t _on_reply(serviceid self, void* db, int status, void* msg, int msglen, void* arg)
+{
+    struct client* c = (struct client*)db;
+    CHECK_IF(status != SERV_CALL_OK, return RET_OK, "status = %d", status);
+    CHECK_IF(*(long*)msg != (long)(intptr_t)arg, return RET_OK, "reply of call %ld routed to %ld", *(long*)msg, (long)(intptr_t)arg);
+
+    c->lat[c->done++] = _now_ns() - *((long*)msg + 1);
+    if (c->issued < CALL_NUM)
+    {
+        _issue(self, c);
+    }
+    else if (c->done == CALL_NUM)
+    {
+        long req[2] = {-1, _now_ns()};
+        service_call(self, c->blackhole, req, sizeof(req), 30, _on_timeout, NULL);
+    }
+    return RET_OK;
+}
+
+static void _issue(serviceid self, struct client* c)
+{
+    long req[2] = {c->issued, _now_ns()};
+    int session = service_call(self, c->server, req, sizeof(req), 1000, _on_reply, (void*)(intptr_t)c->issued);
+    CHECK_IF(session <= 0, return, "service_call failed");
+    c->issued++;
+}
+
+static void _init_client(serviceid sid, void* db)
+{
+    struct client* c = (struct client*)db;
+    c->server    = service_getid("server");
+    c->blackhole = service_getid("blackhole");
+
+    int session = -1;
+    service_send(sid, sid, TAG_COPY, session, &session, sizeof(session));
+
+    int i;
+    for (i=0; i<c->depth; i++)
+    {
+        _issue(sid, c);
+    }
+}
+
+static ret_t _handle_client(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    struct client* c = (struct client*)db;
+    if ((session < 0) && (*(int*)msg == session)) c->plain++;
+    return RET_OK;
+}
+
+static ret_t _handle_server(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    service_reply(self, src, session, msg, msglen);
+    return RET_OK;
+}
+
+static ret_t _handle_blackhole(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    return RET_OK;
+}
+
+static int _cmp(const void* a, const void* b)
+{
+    long x = *(long*)a;
+    long y = *(long*)b;
+    return (x > y) - (x < y);
+}
+
+static int _bench(bool mn, int depth)
+{
+    struct client c = {.depth = depth};
+    c.lat = malloc(sizeof(long) * CALL_NUM);
+
+    if (mn) service_system_init_ex(0);
+    else    service_system_init();
+
+    service_create("server", NULL, _handle_server, NULL, NULL);
+    service_create("blackhole", NULL, _handle_blackhole, NULL, NULL);
+    service_create("client", &c, _handle_client, _init_client, NULL);
+
+    long start = _now_ns();
+    service_system_run();
+    double cost = (_now_ns() - start) / 1e9;
+    service_system_uninit();
+
+    qsort(c.lat, c.done, sizeof(long), _cmp);
+    dprint("%-7s depth %3d : %d calls, %.2f M calls/s, latency p50 %.1f us p99 %.1f us, timeouts %d, plain %d",
+           mn ? "M:N" : "thread", depth, c.done, c.done / cost / 1e6,
+           c.lat[c.done / 2] / 1e3, c.lat[c.done * 99 / 100] / 1e3, c.timeouts, c.plain);
+
+    int ret = ((c.done == CALL_NUM) && (c.timeouts == 1) && (c.plain == 1)) ? 0 : -1;
+    free(c.lat);
+    return ret;
+}
+
+int main(int argc, char const *argv[])
+{
+    int ret = 0;
+    ret |= _bench(false, 1);
+    ret |= _bench(false, 64);
+    ret |= _bench(true, 1);
+    ret |= _bench(true, 64);
+    CHECK_IF(ret != 0, return -1, "calls got lost");
+
+    dprint("ok");
+    return 0;
+}
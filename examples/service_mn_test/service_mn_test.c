@@ -0,0 +1,116 @@
+#include <time.h>
+#include "basic.h"
+#include "service.h"
+
+// thousands of services pass tokens around a ring on a few workers,
+// a service must never run on two workers at the same time
+
+#define RING_SIZE   (4096)
+#define TOKEN_NUM   (256)
+#define TOTAL_HOPS  (2000000)
+
+struct node
+{
+    serviceid next;
+    int inside;
+    int hops;
+};
+
+static struct node _nodes[RING_SIZE];
+static serviceid   _ids[RING_SIZE];
+static long _hops    = 0;
+static int  _overlap = 0;
+static int  _ticks   = 0;
+
+static ret_t _handle_node(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    struct node* n = (struct node*)db;
+    if (__atomic_add_fetch(&n->inside, 1, __ATOMIC_SEQ_CST) != 1)
+    {
+        __atomic_add_fetch(&_overlap, 1, __ATOMIC_RELAXED);
+    }
+
+    n->hops++;
+    if (__atomic_add_fetch(&_hops, 1, __ATOMIC_RELAXED) < TOTAL_HOPS)
+    {
+        service_send(self, n->next, 0, session, msg, msglen);
+    }
+
+    __atomic_sub_fetch(&n->inside, 1, __ATOMIC_SEQ_CST);
+    return RET_OK;
+}
+
+static void _init_node(serviceid sid, void* db)
+{
+    struct node* n = (struct node*)db;
+    int idx = n - _nodes;
+    n->next = _ids[(idx + 1) % RING_SIZE];
+
+    if (idx % (RING_SIZE / TOKEN_NUM) == 0)
+    {
+        static char token[] = "token";
+        service_send(sid, n->next, 0, idx, token, sizeof(token));
+    }
+}
+
+static void _check(serviceid sid, void* db, void* arg)
+{
+    _ticks++;
+    if ((__atomic_load_n(&_hops, __ATOMIC_RELAXED) >= TOTAL_HOPS) || (_ticks >= 300))
+    {
+        service_system_break();
+    }
+}
+
+static ret_t _handle_checker(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    return RET_OK;
+}
+
+static void _init_checker(serviceid sid, void* db)
+{
+    service_start_timer(sid, 10, 10, _check, NULL);
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char const *argv[])
+{
+    int worker_num = (argc > 1) ? atoi(argv[1]) : 0;
+    int i;
+    char name[32];
+
+    CHECK_IF(service_system_init_ex(worker_num) != SERV_OK, return -1, "service_system_init_ex failed");
+
+    for (i=0; i<RING_SIZE; i++)
+    {
+        snprintf(name, sizeof(name), "node%d", i);
+        _ids[i] = service_create(name, &_nodes[i], _handle_node, _init_node, NULL);
+        CHECK_IF(_ids[i] == INVALID_ID, return -1, "service_create failed");
+    }
+    service_create("checker", NULL, _handle_checker, _init_checker, NULL);
+
+    double start = _now();
+    service_system_run();
+    double cost = _now() - start;
+
+    long min = TOTAL_HOPS;
+    for (i=0; i<RING_SIZE; i++)
+    {
+        min = (_nodes[i].hops < min) ? _nodes[i].hops : min;
+    }
+
+    dprint("%d services, %ld hops in %.3fs : %.2f M msg/s, min hops %ld, overlap %d",
+           RING_SIZE, _hops, cost, _hops / cost / 1e6, min, _overlap);
+    CHECK_IF(_hops < TOTAL_HOPS, return -1, "tokens got lost");
+    CHECK_IF(_overlap != 0, return -1, "a service ran on two workers at once");
+
+    service_system_uninit();
+    dprint("ok");
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <time.h>
+#include "basic.h"
+#include "service.h"
+
+// messages/sec from a producer to a consumer service, the consumer hands out credits to bound the queue
+
+#define MSG_NUM    (1000000)
+#define MSG_SIZE   (64)
+#define WINDOW     (1024)
+#define CREDIT     (256)
+
+struct peer
+{
+    serviceid other;
+    long sent;
+    long recv;
+    bool zerocopy;
+};
+
+static void _produce(serviceid self, struct peer* p, int num)
+{
+    char buf[MSG_SIZE] = {0};
+    int i;
+    for (i=0; (i<num) && (p->sent<MSG_NUM); i++, p->sent++)
+    {
+        if (p->zerocopy)
+        {
+            long* msg = service_msg_alloc(MSG_SIZE);
+            *msg = p->sent;
+            service_send_msg(self, p->other, 0, msg, MSG_SIZE);
+        }
+        else
+        {
+            *(long*)buf = p->sent;
+            service_send(self, p->other, TAG_COPY, 0, buf, MSG_SIZE);
+        }
+    }
+}
+
+static ret_t _handle_producer(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    _produce(self, (struct peer*)db, CREDIT);
+    return RET_OK;
+}
+
+static void _init_producer(serviceid sid, void* db)
+{
+    struct peer* p = (struct peer*)db;
+    p->other = service_getid("consumer");
+    _produce(sid, p, WINDOW);
+}
+
+static ret_t _handle_consumer(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    struct peer* c = (struct peer*)db;
+    CHECK_IF(*(long*)msg != c->recv, service_system_break(), "got %ld, expect %ld", *(long*)msg, c->recv);
+
+    c->recv++;
+    if (c->recv == MSG_NUM)
+    {
+        service_system_break();
+    }
+    else if (c->recv % CREDIT == 0)
+    {
+        int credit = CREDIT;
+        service_send(self, src, TAG_COPY, 0, &credit, sizeof(credit));
+    }
+    return RET_OK;
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int _bench(bool mn, bool zerocopy)
+{
+    struct peer producer = {.zerocopy = zerocopy};
+    struct peer consumer = {};
+
+    if (mn) service_system_init_ex(0);
+    else    service_system_init();
+
+    service_create("consumer", &consumer, _handle_consumer, NULL, NULL);
+    service_create("producer", &producer, _handle_producer, _init_producer, NULL);
+
+    double start = _now();
+    service_system_run();
+    double cost = _now() - start;
+    service_system_uninit();
+
+    dprint("%-7s %-9s : %ld msgs in %.3fs, %.2f M msg/s", mn ? "M:N" : "thread", zerocopy ? "zerocopy" : "copy",
+           consumer.recv, cost, consumer.recv / cost / 1e6);
+    return (consumer.recv == MSG_NUM) ? 0 : -1;
+}
+
+// a flooded mailbox must not starve the timer of its service
+
+#define FLOOD_NUM  (100000)
+#define FLOOD_COST (2000) // ns per message
+#define FLOOD_BUDGET_US (20) // fewer messages than SERV_LAT_SAMPLE fit in
+
+struct victim
+{
+    long recv;
+    int  ticks; // while the flood is handled
+};
+
+static ret_t _handle_victim(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    struct victim* v = (struct victim*)db;
+    double end = _now() + FLOOD_COST / 1e9;
+    while (_now() < end) {}
+
+    if (++v->recv == FLOOD_NUM) service_system_break();
+    return RET_OK;
+}
+
+static void _tick(serviceid sid, void* db, void* arg)
+{
+    struct victim* v = (struct victim*)db;
+    if (v->recv < FLOOD_NUM) v->ticks++;
+}
+
+static void _init_victim(serviceid sid, void* db)
+{
+    service_start_timer(sid, 5, 5, _tick, NULL);
+}
+
+static void _init_flooder(serviceid sid, void* db)
+{
+    serviceid dst = service_getid("victim");
+    int i;
+    for (i=0; i<FLOOD_NUM; i++)
+    {
+        service_send_msg(sid, dst, 0, service_msg_alloc(MSG_SIZE), MSG_SIZE);
+    }
+}
+
+static ret_t _handle_flooder(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    return RET_OK;
+}
+
+static int _test_budget(bool mn, int budget, int budget_us)
+{
+    struct victim v = {};
+
+    if (mn) service_system_init_ex(0);
+    else    service_system_init();
+
+    serviceid sid = service_create("victim", &v, _handle_victim, _init_victim, NULL);
+    service_create("flooder", NULL, _handle_flooder, _init_flooder, NULL);
+    service_set_budget(sid, budget, budget_us);
+
+    service_system_run();
+
+    struct service_stats st = {};
+    service_get_stats(sid, &st);
+    service_system_uninit();
+
+    dprint("%-7s budget %5d %3d us : %d ticks during the flood, %ld turns, %ld cut, max batch %d, max depth %d, latency avg %ld ns max %ld ns",
+           mn ? "M:N" : "thread", budget, budget_us, v.ticks, st.turns, st.budget_hits, st.max_batch, st.max_depth,
+           st.lat_samples ? st.lat_total_ns / st.lat_samples : 0, st.lat_max_ns);
+
+    // the deadline is checked after every message, not only the sampled ones
+    CHECK_IF((budget_us > 0) && (st.max_batch > budget_us * 1000 / FLOOD_COST + 1), return -1,
+             "max batch %d overruns %d us", st.max_batch, budget_us);
+    return (st.msgs == FLOOD_NUM) ? 0 : -1;
+}
+
+// payloads kept with RET_DONTFREE are released with free() like before the pool, or given back to it
+
+#define KEEP_NUM (64)
+
+struct keeper
+{
+    void* kept[KEEP_NUM];
+    int lens[KEEP_NUM];
+    int num;
+};
+
+static ret_t _handle_keeper(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    struct keeper* k = (struct keeper*)db;
+    k->kept[k->num] = msg;
+    k->lens[k->num] = msglen;
+    if (++k->num == KEEP_NUM) service_system_break();
+    return RET_DONTFREE;
+}
+
+static void _init_sender(serviceid sid, void* db)
+{
+    serviceid dst = service_getid("keeper");
+    static char buf[3 * 8192];
+    int i;
+    for (i=0; i<KEEP_NUM; i++)
+    {
+        int len = (i * 397) % sizeof(buf);
+        memset(buf, i, len);
+        service_send(sid, dst, TAG_COPY, 0, buf, len);
+    }
+}
+
+static int _test_keep(bool mn)
+{
+    struct keeper k = {};
+
+    if (mn) service_system_init_ex(0);
+    else    service_system_init();
+
+    service_create("keeper", &k, _handle_keeper, NULL, NULL);
+    service_create("sender", NULL, _handle_flooder, _init_sender, NULL);
+    service_system_run();
+    service_system_uninit();
+
+    int ret = (k.num == KEEP_NUM) ? 0 : -1;
+    int i, j;
+    for (i=0; i<k.num; i++)
+    {
+        unsigned char* m = (unsigned char*)k.kept[i];
+        for (j=0; j<k.lens[i]; j++)
+        {
+            if (m[j] != (unsigned char)i) ret = -1;
+        }
+        if (i % 2) free(m);
+        else       service_msg_free(m);
+    }
+
+    dprint("%-7s kept %d messages", mn ? "M:N" : "thread", k.num);
+    return ret;
+}
+
+int main(int argc, char const *argv[])
+{
+    int ret = 0;
+    ret |= _bench(false, false);
+    ret |= _bench(false, true);
+    ret |= _bench(true, false);
+    ret |= _bench(true, true);
+    CHECK_IF(ret != 0, return -1, "messages got lost");
+
+    ret |= _test_budget(false, 0, 0);
+    ret |= _test_budget(false, SERV_BUDGET_MSGS, 0);
+    ret |= _test_budget(false, 0, FLOOD_BUDGET_US);
+    ret |= _test_budget(true, 0, 0);
+    ret |= _test_budget(true, SERV_BUDGET_MSGS, 0);
+    ret |= _test_budget(true, 0, FLOOD_BUDGET_US);
+    CHECK_IF(ret != 0, return -1, "flood messages got lost");
+
+    ret |= _test_keep(false);
+    ret |= _test_keep(true);
+    CHECK_IF(ret != 0, return -1, "kept messages got lost");
+
+    dprint("ok");
+    return 0;
+}
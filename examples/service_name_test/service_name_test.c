@@ -0,0 +1,83 @@
+#include <time.h>
+#include "basic.h"
+#include "service.h"
+
+// name lookups among many services, and handles taken before the service exists
+
+#define SERVICE_NUM (4096)
+#define LOOKUP_NUM  (1000000)
+
+static long _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static ret_t _handle(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    return RET_OK;
+}
+
+int main(int argc, char const *argv[])
+{
+    static serviceid ids[SERVICE_NUM];
+    char name[32];
+    int i;
+
+    CHECK_IF(service_system_init_ex(1) != SERV_OK, return -1, "service_system_init_ex failed");
+
+    struct service_name* early = service_intern("router");
+    CHECK_IF(service_resolve(early) != INVALID_ID, return -1, "router resolved before it exists");
+
+    for (i=0; i<SERVICE_NUM; i++)
+    {
+        snprintf(name, sizeof(name), "svc%d", i);
+        ids[i] = service_create(name, NULL, _handle, NULL, NULL);
+    }
+    serviceid router = service_create("router", NULL, _handle, NULL, NULL);
+    serviceid dup    = service_create("router", NULL, _handle, NULL, NULL);
+    CHECK_IF(service_resolve(early) != router, return -1, "handle not filled by service_create");
+    CHECK_IF(service_getid("router") != router, return -1, "the first router must keep the name (dup %u)", dup);
+    CHECK_IF(service_getid("nobody") != INVALID_ID, return -1, "found a service that does not exist");
+    CHECK_IF(service_getid("a name longer than twenty chars") != INVALID_ID, return -1, "long name matched");
+
+    long t0 = _now_ns();
+    int wrong = 0;
+    for (i=0; i<LOOKUP_NUM; i++)
+    {
+        int k = (int)((i * 7919L) % SERVICE_NUM);
+        snprintf(name, sizeof(name), "svc%d", k);
+        if (service_getid(name) != ids[k]) wrong++;
+    }
+    long t1 = _now_ns();
+
+    struct service_name* handles[64];
+    for (i=0; i<64; i++)
+    {
+        snprintf(name, sizeof(name), "svc%d", i * 61);
+        handles[i] = service_intern(name);
+    }
+    long t2 = _now_ns();
+    for (i=0; i<LOOKUP_NUM; i++)
+    {
+        if (service_resolve(handles[i & 63]) != ids[(i & 63) * 61]) wrong++;
+    }
+    long t3 = _now_ns();
+
+    // snprintf of the name is part of the getid loop, take it out
+    for (i=0; i<LOOKUP_NUM; i++)
+    {
+        snprintf(name, sizeof(name), "svc%d", (int)((i * 7919L) % SERVICE_NUM));
+    }
+    long t4 = _now_ns();
+
+    service_system_uninit();
+
+    dprint("%d services : getid %.1f ns, resolve %.1f ns, wrong %d",
+           SERVICE_NUM, (double)((t1 - t0) - (t4 - t3)) / LOOKUP_NUM, (double)(t3 - t2) / LOOKUP_NUM, wrong);
+    CHECK_IF(wrong != 0, return -1, "lookups went wrong");
+
+    dprint("ok");
+    return 0;
+}
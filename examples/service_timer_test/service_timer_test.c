@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include "basic.h"
+#include "service.h"
+
+// 50k timers in one service : every other one is stopped, the rest must fire once and not early
+
+#define TIMER_NUM (50000)
+#define SPAN_MS   (500)
+
+struct probe
+{
+    watchid wid;
+    long start;
+    int after;
+    int fired;
+};
+
+struct bench
+{
+    struct probe probes[TIMER_NUM];
+    int fired;
+    int early;
+    long late_max;
+    int ticks;
+    double start_ns; // per service_start_timer
+    double stop_ns;
+    int fds;
+};
+
+static struct bench _b;
+
+static long _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static long _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int _count_fds(void)
+{
+    int num = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    CHECK_IF(dir == NULL, return -1, "opendir failed");
+    while (readdir(dir)) num++;
+    closedir(dir);
+    return num;
+}
+
+static void _fire(serviceid sid, void* db, void* arg)
+{
+    struct probe* p = (struct probe*)arg;
+    long passed = _now_ms() - p->start;
+
+    p->fired++;
+    _b.fired++;
+    if (passed < p->after) _b.early++;
+    if (passed - p->after > _b.late_max) _b.late_max = passed - p->after;
+}
+
+static void _tick(serviceid sid, void* db, void* arg)
+{
+    if (++_b.ticks * 50 > SPAN_MS + 200) service_system_break();
+}
+
+static void _init(serviceid sid, void* db)
+{
+    int fds = _count_fds();
+    int i;
+    long t0 = _now_ns();
+    for (i=0; i<TIMER_NUM; i++)
+    {
+        struct probe* p = &_b.probes[i];
+        p->after = 1 + (i * 7919) % SPAN_MS;
+        p->start = _now_ms();
+        p->wid   = service_start_timer(sid, p->after, 0, _fire, p);
+        CHECK_IF(p->wid == INVALID_ID, return, "service_start_timer failed");
+    }
+    long t1 = _now_ns();
+    for (i=0; i<TIMER_NUM; i+=2)
+    {
+        service_stop_timer(sid, _b.probes[i].wid);
+    }
+    long t2 = _now_ns();
+
+    _b.start_ns = (double)(t1 - t0) / TIMER_NUM;
+    _b.stop_ns  = (double)(t2 - t1) / (TIMER_NUM / 2);
+    _b.fds      = _count_fds() - fds;
+    service_start_timer(sid, 50, 50, _tick, NULL);
+}
+
+static ret_t _handle(serviceid self, void* db, int session, serviceid src, void* msg, int msglen)
+{
+    return RET_OK;
+}
+
+static int _test(bool mn)
+{
+    memset(&_b, 0, sizeof(_b));
+
+    if (mn) service_system_init_ex(0);
+    else    service_system_init();
+
+    service_create("timers", NULL, _handle, _init, NULL);
+    service_system_run();
+    service_system_uninit();
+
+    int i;
+    int wrong = 0;
+    for (i=0; i<TIMER_NUM; i++)
+    {
+        if (_b.probes[i].fired != ((i % 2) ? 1 : 0)) wrong++;
+    }
+
+    dprint("%-7s : %d timers, start %.0f ns, stop %.0f ns, %d new fds, fired %d, wrong %d, early %d, late max %ld ms",
+           mn ? "M:N" : "thread", TIMER_NUM, _b.start_ns, _b.stop_ns, _b.fds, _b.fired, wrong, _b.early, _b.late_max);
+    return ((wrong == 0) && (_b.early == 0)) ? 0 : -1;
+}
+
+int main(int argc, char const *argv[])
+{
+    int ret = 0;
+    ret |= _test(false);
+    ret |= _test(true);
+    CHECK_IF(ret != 0, return -1, "timers went wrong");
+
+    dprint("ok");
+    return 0;
+}
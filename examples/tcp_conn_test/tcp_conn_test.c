@@ -0,0 +1,251 @@
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "basic.h"
+#include "tcp_conn.h"
+
+#define TEST_IP   "127.0.0.1"
+#define TEST_PORT (17801)
+
+#define CONN_TOTAL    (10000)
+#define CONN_PARALLEL (64)
+
+#define ECHO_CLIENTS (8)
+#define ECHO_WINDOW  (4)
+#define ECHO_MSGS    (4000)
+#define ECHO_SIZE    (16 * 1024)
+
+static struct evloop _loop;
+
+static int _conn_started  = 0;
+static int _conn_done     = 0;
+static int _echo_done     = 0;
+static long _echo_bytes   = 0;
+static int _server_frames = 0;
+
+static char _payload[ECHO_SIZE];
+
+struct echo_client
+{
+    int sent;
+    int received;
+};
+
+static struct echo_client _clients[ECHO_CLIENTS];
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// frame : 4 bytes length in network order + payload
+static int _frame(struct tcp_conn* conn, void* data, int len)
+{
+    if (len < 4) return 0;
+
+    uint32_t payload_len;
+    memcpy(&payload_len, data, 4);
+    payload_len = ntohl(payload_len);
+    if (payload_len > ECHO_SIZE) return -1;
+
+    return 4 + payload_len;
+}
+
+static int _ping(struct tcp_conn* conn, int len)
+{
+    uint32_t hdr = htonl(len);
+    if (tcp_conn_send(conn, &hdr, 4) != TCP_CONN_OK) return TCP_CONN_FAIL;
+    return tcp_conn_send(conn, _payload, len);
+}
+
+static void _early_check(void);
+
+static void _server_recv(struct tcp_conn* conn, void* data, int len)
+{
+    _server_frames++;
+    _early_check();
+    tcp_conn_send(conn, data, len);
+}
+
+static void _accept(struct tcp_listener* listener, struct tcp_conn* conn)
+{
+    conn->framefn = _frame;
+    conn->recvfn  = _server_recv;
+}
+
+//////////////////////////////////////// connections per second
+
+static void _conn_client_event(struct tcp_conn* conn, int event);
+
+static void _conn_client_recv(struct tcp_conn* conn, void* data, int len)
+{
+    tcp_conn_close(conn);
+}
+
+static void _conn_client_start(void)
+{
+    _conn_started++;
+    struct tcp_conn* conn = tcp_conn_connect(&_loop, TEST_IP, TEST_PORT, _conn_client_event, _conn_client_recv, _frame, NULL);
+    CHECK_IF(conn == NULL, _conn_done++, "tcp_conn_connect failed");
+}
+
+static void _conn_client_event(struct tcp_conn* conn, int event)
+{
+    if (event == TCP_CONN_EV_CONNECTED)
+    {
+        _ping(conn, 4);
+    }
+    else if (event == TCP_CONN_EV_CLOSED)
+    {
+        _conn_done++;
+        if (_conn_started < CONN_TOTAL) _conn_client_start();
+        if (_conn_done == CONN_TOTAL) evloop_break(&_loop);
+    }
+}
+
+static void _bench_conn(void)
+{
+    double start = _now();
+
+    int i;
+    for (i=0; i<CONN_PARALLEL; i++)
+    {
+        _conn_client_start();
+    }
+    evloop_run(&_loop);
+
+    double sec = _now() - start;
+    dprint("%d connections, %.3f s, %.0f conns/s", _conn_done, sec, _conn_done / sec);
+}
+
+//////////////////////////////////////// bytes per second
+
+static void _echo_client_event(struct tcp_conn* conn, int event)
+{
+    struct echo_client* client = (struct echo_client*)conn->arg;
+    if (event == TCP_CONN_EV_CONNECTED)
+    {
+        for ( ; client->sent < ECHO_WINDOW; client->sent++)
+        {
+            _ping(conn, ECHO_SIZE);
+        }
+    }
+    else if (event == TCP_CONN_EV_ERROR)
+    {
+        derror("echo client %d failed", (int)(client - _clients));
+    }
+    else if (event == TCP_CONN_EV_CLOSED)
+    {
+        _echo_done++;
+        if (_echo_done == ECHO_CLIENTS) evloop_break(&_loop);
+    }
+}
+
+static void _echo_client_recv(struct tcp_conn* conn, void* data, int len)
+{
+    struct echo_client* client = (struct echo_client*)conn->arg;
+    client->received++;
+    _echo_bytes += len;
+
+    if (client->sent < ECHO_MSGS)
+    {
+        _ping(conn, ECHO_SIZE);
+        client->sent++;
+    }
+    else if (client->received == ECHO_MSGS)
+    {
+        tcp_conn_close(conn);
+    }
+}
+
+static void _bench_echo(void)
+{
+    double start = _now();
+
+    int i;
+    for (i=0; i<ECHO_CLIENTS; i++)
+    {
+        struct tcp_conn* conn = tcp_conn_connect(&_loop, TEST_IP, TEST_PORT, _echo_client_event, _echo_client_recv, _frame, &_clients[i]);
+        CHECK_IF(conn == NULL, return, "tcp_conn_connect failed");
+    }
+    evloop_run(&_loop);
+
+    double sec = _now() - start;
+    dprint("%d clients, %ld bytes echoed, %.3f s, %.1f MB/s", ECHO_CLIENTS, _echo_bytes, sec, _echo_bytes / sec / (1024 * 1024));
+
+    for (i=0; i<ECHO_CLIENTS; i++)
+    {
+        CHECK_IF(_clients[i].received != ECHO_MSGS, return, "client %d received %d", i, _clients[i].received);
+    }
+}
+
+//////////////////////////////////////// closed while connecting, the queued frame still goes out
+
+static int _early_frames = -1; // server frames to wait for
+static int _early_closed = 0;
+static struct ev _early_tm;
+
+static void _early_check(void)
+{
+    if ((_early_frames >= 0) && _early_closed && (_server_frames >= _early_frames))
+    {
+        evtm_stop(&_loop, &_early_tm);
+        evloop_break(&_loop);
+    }
+}
+
+static void _early_event(struct tcp_conn* conn, int event)
+{
+    if (event == TCP_CONN_EV_CLOSED)
+    {
+        _early_closed = 1;
+        _early_check();
+    }
+}
+
+static void _early_timeout(struct evloop* loop, struct ev* ev, void* arg)
+{
+    evloop_break(loop);
+}
+
+static int _test_close_early(void)
+{
+    struct tcp_conn* conn = tcp_conn_connect(&_loop, TEST_IP, TEST_PORT, _early_event, NULL, _frame, NULL);
+    CHECK_IF(conn == NULL, return -1, "tcp_conn_connect failed");
+
+    _early_frames = _server_frames + 1;
+    CHECK_IF(_ping(conn, ECHO_SIZE) != TCP_CONN_OK, return -1, "_ping failed");
+    tcp_conn_close(conn);
+    evtm_init(&_early_tm, 2000, 0, _early_timeout, NULL);
+    evtm_start(&_loop, &_early_tm);
+    evloop_run(&_loop);
+
+    dprint("closed while connecting : %d of 1 frames arrived", _server_frames - _early_frames + 1);
+    return (_server_frames == _early_frames) ? 0 : -1;
+}
+
+int main(int argc, char const *argv[])
+{
+    memset(_payload, 'x', sizeof(_payload));
+
+    int chk = evloop_init(&_loop, 256);
+    CHECK_IF(chk != EV_OK, return -1, "evloop_init failed");
+
+    struct tcp_listener listener;
+    chk = tcp_listener_init(&listener, &_loop, TEST_IP, TEST_PORT, 1024, _accept, NULL);
+    CHECK_IF(chk != TCP_CONN_OK, return -1, "tcp_listener_init failed");
+
+    _bench_conn();
+    _bench_echo();
+    CHECK_IF(_test_close_early() != 0, return -1, "queued frame lost");
+
+    tcp_listener_uninit(&listener);
+    evloop_uninit(&_loop);
+
+    dprint("ok");
+    return 0;
+}
@@ -3,12 +3,112 @@
 
 #include <signal.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define SELF_PORT (17802)
+#define SELF_ZC_SIZE (64 * 1024)
+#define SELF_ZC_NUM (64)
 
 static int _running = 1;
+static long _self_received = 0;
+
+static void* _self_sink(void* arg)
+{
+    struct tcp_server* server = (struct tcp_server*)arg;
+    struct tcp tcp = {};
+    tcp_server_accept(server, &tcp);
+
+    char buffer[64 * 1024];
+    int recvlen;
+    while ((recvlen = tcp_recv(&tcp, buffer, sizeof(buffer))) > 0)
+    {
+        _self_received += recvlen;
+    }
+    tcp_client_uninit(&tcp);
+    return NULL;
+}
+
+// sendv, zerocopy and sendfile against a local sink
+static void _self_test(void)
+{
+    struct tcp_server server = {};
+    tcp_server_init(&server, "127.0.0.1", SELF_PORT, 10);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, _self_sink, &server);
+
+    struct tcp client = {};
+    CHECK_IF(tcp_client_init(&client, "127.0.0.1", SELF_PORT, TCP_PORT_ANY) != TCP_OK, return, "connect failed");
+
+    long expect = 0;
+
+    char hdr[8] = "header:";
+    char body[32] = "payload without a copy";
+    struct iovec iov[2] = {{hdr, strlen(hdr)}, {body, strlen(body)}};
+    expect += tcp_sendv(&client, iov, 2);
+    dprint("sendv %ld bytes", expect);
+
+    char* zcbuf = malloc(SELF_ZC_SIZE);
+    memset(zcbuf, 'z', SELF_ZC_SIZE);
+    if (tcp_zerocopy_enable(&client) == TCP_OK)
+    {
+        int i, sendlen;
+        for (i=0; i<SELF_ZC_NUM; i++)
+        {
+            sendlen = tcp_send_zc(&client, zcbuf, SELF_ZC_SIZE);
+            if (sendlen > 0) expect += sendlen;
+            tcp_zerocopy_reap(&client);
+        }
+        while (client.zc_done != client.zc_next)
+        {
+            usleep(1000);
+            tcp_zerocopy_reap(&client);
+        }
+        dprint("zerocopy %u sends completed, %u copied by kernel", client.zc_done, client.zc_copied);
+    }
+    free(zcbuf);
+
+    FILE* fp = tmpfile();
+    int i;
+    for (i=0; i<10000; i++)
+    {
+        fprintf(fp, "line %d\n", i);
+    }
+    fflush(fp);
+    int filelen = ftell(fp);
+    off_t offset = 0;
+    int sendlen = tcp_sendfile(&client, fileno(fp), &offset, filelen);
+    dprint("sendfile %d of %d bytes", sendlen, filelen);
+    expect += sendlen;
+    fclose(fp);
+
+    // sendfile refuses a pipe, the splice fallback reports its end like sendfile does
+    int pipefd[2];
+    pipe(pipefd);
+    write(pipefd[1], "from a pipe", 11);
+    close(pipefd[1]);
+    sendlen = tcp_sendfile(&client, pipefd[0], NULL, filelen);
+    int eoflen = tcp_sendfile(&client, pipefd[0], NULL, filelen);
+    dprint("splice %d bytes, then %d at end of file", sendlen, eoflen);
+    if (sendlen > 0) expect += sendlen;
+    close(pipefd[0]);
+
+    tcp_client_uninit(&client);
+    pthread_join(tid, NULL);
+    tcp_server_uninit(&server);
+
+    dprint("sent %ld, received %ld", expect, _self_received);
+}
 
 int main(int argc, char const *argv[])
 {
-    if (argc == 2)
+    if (argc == 1)
+    {
+        _self_test();
+    }
+    else if (argc == 2)
     {
         int port = atoi(argv[1]);
 
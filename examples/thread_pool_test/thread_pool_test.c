@@ -0,0 +1,244 @@
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "basic.h"
+#include "thread.h"
+
+#define BENCH_TASKS (20000)
+#define BENCH_BATCH (8)
+#define BENCH_WORK (20000)
+
+#define FOR_NUM (1000000)
+#define FOR_GRAIN (10000)
+
+static long _done = 0;
+
+static void _work(void* arg)
+{
+    // a short cpu task, like parsing a message
+    unsigned int h = (unsigned int)(intptr_t)arg;
+    int i;
+    for (i=0; i<BENCH_WORK; i++)
+    {
+        h = h * 16777619u ^ i;
+    }
+    if (h == 0) dprint("h = 0");
+
+    __sync_add_and_fetch(&_done, 1);
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the old way : one pthread per task, created per batch
+static void _bench_join(void)
+{
+    struct thread t[BENCH_BATCH];
+    int i, j;
+
+    _done = 0;
+    double start = _now();
+    for (i=0; i<BENCH_TASKS; i+=BENCH_BATCH)
+    {
+        for (j=0; j<BENCH_BATCH; j++)
+        {
+            t[j].func = _work;
+            t[j].arg  = (void*)(intptr_t)(i + j);
+        }
+        thread_join(t, BENCH_BATCH);
+    }
+    double sec = _now() - start;
+    dprint("thread_join       : %ld tasks, %.3f s, %.0f tasks/s", _done, sec, _done / sec);
+}
+
+static void _bench_pool(int worker_num)
+{
+    struct thread_pool pool;
+    thread_pool_init(&pool, worker_num);
+
+    struct thread_task tasks[BENCH_BATCH];
+    struct thread_wg wg;
+    thread_wg_init(&wg);
+    int i, j;
+
+    _done = 0;
+    double start = _now();
+    for (i=0; i<BENCH_TASKS; i+=BENCH_BATCH)
+    {
+        for (j=0; j<BENCH_BATCH; j++)
+        {
+            tasks[j].func = _work;
+            tasks[j].arg  = (void*)(intptr_t)(i + j);
+        }
+        thread_pool_submit_batch(&pool, tasks, BENCH_BATCH, &wg);
+        thread_wg_wait(&wg);
+    }
+    double sec = _now() - start;
+    dprint("pool %2d workers   : %ld tasks, %.3f s, %.0f tasks/s", pool.worker_num, _done, sec, _done / sec);
+
+    thread_pool_uninit(&pool);
+}
+
+static long _sums[FOR_NUM / FOR_GRAIN];
+
+static void _sum(int begin, int end, void* arg)
+{
+    long sum = 0;
+    int i;
+    for (i=begin; i<end; i++)
+    {
+        sum += i;
+    }
+    _sums[begin / FOR_GRAIN] = sum;
+}
+
+// tasks that submit and wait for their own subtasks, from inside the workers
+static void _nested(void* arg)
+{
+    struct thread_pool* pool = (struct thread_pool*)arg;
+    struct thread_wg wg;
+    thread_wg_init(&wg);
+
+    int i;
+    for (i=0; i<BENCH_BATCH; i++)
+    {
+        thread_pool_submit(pool, _work, (void*)(intptr_t)i, &wg);
+    }
+    thread_pool_wait(pool, &wg);
+}
+
+// a worker waiting on a group helps with what the group's last task fans out later
+
+#define FAN_NUM (100)
+
+static pthread_t _fan_owner;
+static pthread_t _fan_tids[FAN_NUM];
+static int _fan_started = 0;
+
+static void _fan_sub(void* arg)
+{
+    _fan_tids[(intptr_t)arg] = pthread_self();
+    usleep(1000);
+}
+
+static void _fan_out(void* arg)
+{
+    struct thread_pool* pool = (struct thread_pool*)arg;
+    _fan_owner = pthread_self();
+    __atomic_store_n(&_fan_started, 1, __ATOMIC_RELEASE);
+    usleep(20 * 1000); // the root has run out of tasks and parked by now
+
+    struct thread_wg wg;
+    thread_wg_init(&wg);
+    int i;
+    for (i=0; i<FAN_NUM; i++)
+    {
+        thread_pool_submit(pool, _fan_sub, (void*)(intptr_t)i, &wg);
+    }
+    thread_pool_wait(pool, &wg);
+}
+
+static void _fan_root(void* arg)
+{
+    struct thread_pool* pool = (struct thread_pool*)arg;
+    struct thread_wg wg;
+    thread_wg_init(&wg);
+
+    // the other worker steals it
+    thread_pool_submit(pool, _fan_out, pool, &wg);
+    while (__atomic_load_n(&_fan_started, __ATOMIC_ACQUIRE) == 0)
+    {
+        sched_yield();
+    }
+    thread_pool_wait(pool, &wg);
+}
+
+static int _check_fan(void)
+{
+    struct thread_pool pool;
+    thread_pool_init(&pool, 2);
+
+    struct thread_wg wg;
+    thread_wg_init(&wg);
+    thread_pool_submit(&pool, _fan_root, &pool, &wg);
+    thread_wg_wait(&wg);
+    thread_pool_uninit(&pool);
+
+    int helped = 0;
+    int i;
+    for (i=0; i<FAN_NUM; i++)
+    {
+        if (!pthread_equal(_fan_tids[i], _fan_owner)) helped++;
+    }
+    dprint("nested fan out : %d of %d subtasks ran on the waiting worker", helped, FAN_NUM);
+    return (helped > 0) ? 0 : -1;
+}
+
+static void _check(void)
+{
+    struct thread_pool pool;
+    thread_pool_init(&pool, 0);
+
+    thread_pool_for(&pool, 0, FOR_NUM, FOR_GRAIN, _sum, NULL);
+    long sum = 0;
+    int i;
+    for (i=0; i<FOR_NUM / FOR_GRAIN; i++)
+    {
+        sum += _sums[i];
+    }
+    dprint("parallel for sum = %ld, expect %ld", sum, (long)FOR_NUM * (FOR_NUM - 1) / 2);
+
+    _done = 0;
+    struct thread_wg wg;
+    thread_wg_init(&wg);
+    for (i=0; i<100; i++)
+    {
+        thread_pool_submit(&pool, _nested, &pool, &wg);
+    }
+    thread_wg_wait(&wg);
+    dprint("nested done = %ld, expect %d", _done, 100 * BENCH_BATCH);
+
+    // a batch without wg leaves alone what the tasks carried before
+    struct thread_wg stale;
+    thread_wg_init(&stale);
+    struct thread_task batch[BENCH_BATCH];
+    for (i=0; i<BENCH_BATCH; i++)
+    {
+        batch[i].func = _work;
+        batch[i].arg  = (void*)(intptr_t)i;
+        batch[i].wg   = &stale;
+    }
+    _done = 0;
+    thread_pool_submit_batch(&pool, batch, BENCH_BATCH, NULL);
+    while (__sync_fetch_and_add(&_done, 0) < BENCH_BATCH)
+    {
+        usleep(1000);
+    }
+    dprint("stale wg count = %d, expect 0", __atomic_load_n(&stale.count, __ATOMIC_ACQUIRE));
+
+    thread_pool_uninit(&pool);
+}
+
+int main(int argc, char const *argv[])
+{
+    _check();
+    CHECK_IF(_check_fan() != 0, return -1, "the waiting worker did not help");
+
+    _bench_join();
+
+    int cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    int worker_num;
+    for (worker_num=1; worker_num<=cpu_num; worker_num*=2)
+    {
+        _bench_pool(worker_num);
+    }
+
+    dprint("ok");
+    return 0;
+}
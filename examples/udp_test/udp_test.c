@@ -3,6 +3,7 @@
 
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 
 // int main(int argc, char const *argv[])
 // {
@@ -22,9 +23,179 @@
 
 static int _running = 1;
 
+#define BENCH_PORT  (17803)
+#define BENCH_BATCH (64)
+#define BENCH_ROUNDS (5000)
+#define BENCH_SIZE  (64)
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// loopback datagrams, BENCH_BATCH sent then BENCH_BATCH received per round
+static void _bench(void)
+{
+    struct udp rx = {};
+    struct udp tx = {};
+    udp_init(&rx, "127.0.0.1", BENCH_PORT);
+    udp_init(&tx, "127.0.0.1", UDP_PORT_ANY);
+
+    static char bufs[BENCH_BATCH][BENCH_SIZE];
+    struct udp_addr remote;
+    struct udp_addr from;
+    snprintf(remote.ip, INET6_ADDRSTRLEN, "127.0.0.1");
+    remote.port = BENCH_PORT;
+
+    long total = (long)BENCH_ROUNDS * BENCH_BATCH;
+    long received = 0;
+    int i, j;
+
+    double start = _now();
+    for (i=0; i<BENCH_ROUNDS; i++)
+    {
+        for (j=0; j<BENCH_BATCH; j++)
+        {
+            udp_send(&tx, remote, bufs[j], BENCH_SIZE);
+        }
+        for (j=0; j<BENCH_BATCH; j++)
+        {
+            if (udp_recv(&rx, bufs[j], BENCH_SIZE, &from) > 0) received++;
+        }
+    }
+    double sec = _now() - start;
+    dprint("udp_send/udp_recv       : %ld of %ld, %.3f s, %.2f Mpps", received, total, sec, received / sec / 1e6);
+
+    struct udp_msg msgs[BENCH_BATCH];
+    union sock_addr dst;
+    udp_to_sockaddr(remote, &dst);
+
+    received = 0;
+    start = _now();
+    int num;
+    for (i=0; i<BENCH_ROUNDS; i++)
+    {
+        for (j=0; j<BENCH_BATCH; j++)
+        {
+            msgs[j].data   = bufs[j];
+            msgs[j].len    = BENCH_SIZE;
+            msgs[j].remote = dst;
+        }
+        udp_send_batch(&tx, msgs, BENCH_BATCH);
+
+        for (j=0; j<BENCH_BATCH; j++)
+        {
+            msgs[j].data = bufs[j];
+            msgs[j].size = BENCH_SIZE;
+        }
+        for (j=0; j<BENCH_BATCH; j+=num)
+        {
+            num = udp_recv_batch(&rx, msgs + j, BENCH_BATCH - j);
+            if (num <= 0) break;
+            received += num;
+        }
+    }
+    sec = _now() - start;
+    dprint("udp_send/recv_batch(%d) : %ld of %ld, %.3f s, %.2f Mpps", BENCH_BATCH, received, total, sec, received / sec / 1e6);
+
+    udp_uninit(&tx);
+    udp_uninit(&rx);
+}
+
+#define GSO_SEG  (1400)
+#define GSO_SEGS (40)
+#define GSO_ROUNDS (5000)
+#define GSO_BIG  (100) // segments of one send past the kernel limit
+
+// GSO_SEGS datagrams of GSO_SEG bytes per round, one by one or as one offloaded send
+static void _bench_gso(int offload)
+{
+    struct udp rx = {};
+    struct udp tx = {};
+    udp_init(&rx, "127.0.0.1", BENCH_PORT);
+    udp_init(&tx, "127.0.0.1", UDP_PORT_ANY);
+
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(rx.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    if (offload)
+    {
+        CHECK_IF(udp_set_gso(&tx, GSO_SEG) != UDP_OK, return, "gso not supported");
+        CHECK_IF(udp_set_gro(&rx, 1) != UDP_OK, return, "gro not supported");
+    }
+
+    static char buf[GSO_SEG * GSO_SEGS];
+    struct udp_addr remote;
+    snprintf(remote.ip, INET6_ADDRSTRLEN, "127.0.0.1");
+    remote.port = BENCH_PORT;
+
+    union sock_addr from;
+    long total = (long)GSO_ROUNDS * GSO_SEGS;
+    long received = 0;
+    long coalesced = 0;
+    int i, j, recvlen, seg_size;
+
+    double start = _now();
+    for (i=0; i<GSO_ROUNDS; i++)
+    {
+        if (offload)
+        {
+            udp_send(&tx, remote, buf, sizeof(buf));
+        }
+        else
+        {
+            for (j=0; j<GSO_SEGS; j++)
+            {
+                udp_send(&tx, remote, buf + j * GSO_SEG, GSO_SEG);
+            }
+        }
+
+        for (j=0; j<GSO_SEGS; )
+        {
+            recvlen = udp_recv_gro(&rx, buf, sizeof(buf), &from, &seg_size);
+            if (recvlen <= 0) break;
+
+            int segs = (recvlen + seg_size - 1) / seg_size;
+            if (segs > 1) coalesced++;
+            j += segs;
+        }
+        received += j;
+    }
+    double sec = _now() - start;
+    dprint("%s : %ld of %ld datagrams, %ld coalesced reads, %.3f s, %.2f Mpps, %.1f MB/s",
+            offload ? "gso/gro on " : "gso/gro off", received, total, coalesced, sec,
+            received / sec / 1e6, received * GSO_SEG / sec / (1024 * 1024));
+
+    if (offload)
+    {
+        // more than UDP_GSO_MAX_SEGS segments, udp_send splits them into sends the kernel takes
+        static char big[GSO_SEG * GSO_BIG];
+        static char rbuf[UDP_GSO_MAX_SIZE];
+        int sent = udp_send(&tx, remote, big, sizeof(big));
+        for (j=0; j<GSO_BIG; )
+        {
+            recvlen = udp_recv_gro(&rx, rbuf, sizeof(rbuf), &from, &seg_size);
+            if (recvlen <= 0) break;
+            j += (recvlen + seg_size - 1) / seg_size;
+        }
+        dprint("gso send of %d segments : %d bytes sent, %d of %d datagrams", GSO_BIG, sent, j, GSO_BIG);
+    }
+
+    udp_uninit(&tx);
+    udp_uninit(&rx);
+}
+
 int main(int argc, char const *argv[])
 {
-    if (argc == 2)
+    if (argc == 1)
+    {
+        _bench();
+        _bench_gso(0);
+        _bench_gso(1);
+    }
+    else if (argc == 2)
     {
         int port = atoi(argv[1]);
 
@@ -1,16 +1,36 @@
 #ifndef _EVENTS_H_
 #define _EVENTS_H_
 
+#include <stdint.h>
 #include <pthread.h>
 #include <sys/timerfd.h>
 #include <sys/signalfd.h>
 #include <sys/eventfd.h>
+#include <sys/epoll.h>
 
 #include "fast_queue.h"
 
 #define EV_OK (0)
 #define EV_FAIL (-1)
 
+// hierarchical timing wheel, 1 ms per tick, 4 levels of 64 slots cover 2^24 ms
+#define EVTM_WHEEL_BITS   (6)
+#define EVTM_WHEEL_SIZE   (1 << EVTM_WHEEL_BITS)
+#define EVTM_WHEEL_MASK   (EVTM_WHEEL_SIZE - 1)
+#define EVTM_WHEEL_LEVELS (4)
+
+#define EV_CACHELINE_SIZE (64)
+
+// evio interest, also reported back in ev->revents (READ/WRITE only)
+#define EVIO_READ      (0x0001)
+#define EVIO_WRITE     (0x0002)
+#define EVIO_EDGE      (0x0004) // edge-triggered
+#define EVIO_ONESHOT   (0x0008) // disarmed after one event, re-arm with evio_modify
+#define EVIO_EXCLUSIVE (0x0010) // EPOLLEXCLUSIVE, cannot be modified
+
+struct ev;
+struct evact_cell;
+
 struct evloop
 {
     int epfd;
@@ -18,9 +38,33 @@ struct evloop
     int state;
 
     int qfd;
-    struct fqueue* act_queue;
+    struct fqueue* act_queue; // overflow when act_ring is full
+    long act_queued;          // posts pushed to act_queue and not applied yet
+
+    // preallocated mpsc ring of actions, posted by any thread, drained by the loop
+    struct evact_cell* act_ring;
+    unsigned long act_mask;
+
+    char _pad0[EV_CACHELINE_SIZE];
+    unsigned long act_tail;
+    int qfd_armed; // someone already wrote qfd since the loop last drained
+
+    char _pad1[EV_CACHELINE_SIZE];
+    unsigned long act_head;
+
+    char _pad2[EV_CACHELINE_SIZE];
 
     pthread_t tid;
+    int is_exited; // evgroup thread returned from evloop_run
+
+    // events returned by the current epoll_wait, stopped watchers are cleared from it
+    struct epoll_event* cur_evbuf;
+    int cur_ev_num;
+
+    // all evtm of this loop, driven by the epoll_wait timeout
+    uint64_t tm_current; // next tick to process
+    int tm_num;
+    struct ev* tm_wheel[EVTM_WHEEL_LEVELS][EVTM_WHEEL_SIZE];
 };
 
 struct ev
@@ -28,6 +72,8 @@ struct ev
     int fd;
     int type;
 
+    struct evloop* loop; // set by evgroup_io_start
+
     void* arg;
     void (*callback)(struct evloop* loop, struct ev* ev, void* arg);
 
@@ -35,9 +81,18 @@ struct ev
     {
         int signum;
         struct
+        {
+            int events;
+            int revents;
+        };
+        struct
         {
             int time_ms;
             int interval_ms;
+
+            uint64_t expire;
+            struct ev* tm_next;
+            struct ev** tm_pprev; // NULL if not in wheel
         };
     };
 };
@@ -48,8 +103,9 @@ void evloop_uninit(struct evloop* loop);
 void evloop_run(struct evloop* loop);
 void evloop_break(struct evloop* loop);
 
-int evio_init(struct ev* ev, int fd, void (*callback)(struct evloop*, struct ev*, void*), void* arg);
+int evio_init(struct ev* ev, int fd, int events, void (*callback)(struct evloop*, struct ev*, void*), void* arg);
 int evio_start(struct evloop* loop, struct ev* ev);
+int evio_modify(struct evloop* loop, struct ev* ev, int events);
 void evio_stop(struct evloop* loop, struct ev* ev);
 
 int evsig_init(struct ev* ev, int signum, void (*callback)(struct evloop*, struct ev*, void*), void* arg);
@@ -59,7 +115,40 @@ void evsig_stop(struct evloop* loop, struct ev* ev);
 int evtm_init(struct ev* ev, int time_ms, int interval_ms, void (*callback)(struct evloop*, struct ev*, void*), void* arg);
 int evtm_start(struct evloop* loop, struct ev* ev);
 void evtm_stop(struct evloop* loop, struct ev* ev);
+int evtm_again(struct evloop* loop, struct ev* ev); // restart with interval_ms (time_ms if no interval) from now
 
 int ev_send(struct evloop* loop, void (*callback)(struct evloop*, struct ev*, void*), void* arg);
 
+// N evloops, each running in its own thread pinned to a core
+
+#define EVGROUP_DIST_ROUNDROBIN (0)
+#define EVGROUP_DIST_FDHASH     (1)
+
+#define EVGROUP_ANY (-1)
+
+struct evgroup
+{
+    struct evloop* loops;
+    pthread_t* tids;
+    int loop_num;
+    int dist;
+    unsigned int next;
+    int is_running;
+};
+
+int evgroup_init(struct evgroup* group, int loop_num, int max_ev_num, int dist); // loop_num <= 0 : one per core
+void evgroup_uninit(struct evgroup* group);
+
+int evgroup_run(struct evgroup* group); // return after all loop threads are started
+void evgroup_break(struct evgroup* group);
+
+struct evloop* evgroup_loop(struct evgroup* group, int idx);
+struct evloop* evgroup_pick(struct evgroup* group, int fd);
+
+int evgroup_io_start(struct evgroup* group, struct ev* ev);
+void evgroup_io_stop(struct evgroup* group, struct ev* ev);
+
+// idx = EVGROUP_ANY : the loop with the fewest pending actions
+int evgroup_send(struct evgroup* group, int idx, void (*callback)(struct evloop*, struct ev*, void*), void* arg);
+
 #endif //_EVENTS_H_
@@ -4,11 +4,14 @@
 #define FQUEUE_OK (0)
 #define FQUEUE_FAIL (-1)
 
+#define FQUEUE_FLAG_LOCKFREE (0x0001) // bounded mpmc ring, push fails when full
+
 #define FQUEUE_FOREACH(pfqueue, _data) for (_data = fqueue_pop(pfqueue); _data; _data = fqueue_pop(pfqueue))
 
 struct fqueue;
 
 struct fqueue* fqueue_create(void (*cleanfn)(void* ud));
+struct fqueue* fqueue_create_ex(void (*cleanfn)(void* ud), int flag, int depth);
 void fqueue_release(struct fqueue* fq);
 
 int   fqueue_push(struct fqueue* fq, void* ud);
@@ -1,27 +1,51 @@
 #ifndef _HASH_H_
 #define _HASH_H_
 
-#ifndef _GNU_SOURCE
-    #define _GNU_SOURCE
-#endif
-
-#include <search.h>
-
 #include "basic.h"
-#include "list.h"
 
 #define HASH_OK (0)
 #define HASH_FAIL (-1)
 
 #define HASH_FOREACH(ptable, key, value) \
-    for(key = hash_first_key(ptable), value = hash_find(ptable, key); \
-        key && value; \
-        key = hash_next_key(ptable, key), value = hash_find(ptable, key))
+    for(int _hpos = hash_iter_next(ptable, -1); \
+        (_hpos >= 0) && ((key) = (ptable)->entries[_hpos].key, (value) = (ptable)->entries[_hpos].value, 1); \
+        _hpos = hash_iter_next(ptable, _hpos))
+
+struct hash_entry
+{
+    char* key; // NULL if deleted
+    void* value;
+    unsigned int hashv;
+};
+
+struct hash_slot
+{
+    unsigned int hashv;
+    int index; // position in entries, -1 if empty
+};
+
+struct hash_index
+{
+    struct hash_slot* slots;
+    unsigned int mask;
+};
 
 struct hash
 {
-    struct hsearch_data hdata;
-    struct list keys;
+    // dense array in insertion order, used by HASH_FOREACH
+    struct hash_entry* entries;
+    int entry_num;
+    int entry_max;
+    int num;
+
+    // robin hood open addressing, points into entries
+    struct hash_index index;
+
+    // while growing, entries [rehash_pos, rehash_end) are still only in old_index
+    struct hash_index old_index;
+    int rehash_pos;
+    int rehash_end;
+
     int max_num;
     void (*cleanfn)(void* value);
     int is_init;
@@ -36,8 +60,11 @@ int hash_modify(struct hash* h, char* key, void* value);
 
 void* hash_find(struct hash *h, char* key);
 int   hash_contains(struct hash *h, char* key);
+int   hash_num(struct hash* h);
 
 char* hash_first_key(struct hash* h);
 char* hash_next_key(struct hash* h, char* newkey);
 
+int hash_iter_next(struct hash* h, int pos);
+
 #endif //_HASH_H_
@@ -1,6 +1,7 @@
 #ifndef _LOGGER_H_
 #define _LOGGER_H_
 
+#include <stdint.h>
 #include <sys/time.h>
 
 #include "udp.h"
@@ -11,36 +12,116 @@
 
 #define LOG_LV_DEFAULT LOG_LV_INFO
 
-#define log_print(logger, level, msg, param...)\
+// callers only pack their arguments into a record of their own ring, logger_run formats them
+#define LOG_REC_SIZE   (256)        // bytes per record, long string arguments are cut to fit
+#define LOG_RING_SIZE  (512)        // records per writing thread, a full one spills to the heap unless logger_set_drop
+#define LOG_LINE_MAX   (1024)       // longest formatted line
+#define LOG_BATCH_SIZE (64 * 1024)  // formatted bytes written at once
+#define LOG_FLUSH_MS   (50)         // a busy logger_run still flushes lines this old
+#define LOG_BIN_SEG    (4 * 1024 * 1024) // default mmap window of the binary sink
+#define LOG_IDLE_MS    (100)        // logger_run sleeps at most this long without records
+
+// statements above this level compile to nothing, release builds take -DLOG_LV_COMPILE=LOG_LV_INFO
+#ifndef LOG_LV_COMPILE
+#define LOG_LV_COMPILE LOG_LV_V3
+#endif
+
+// module of the statements of a file, define it before including logger.h to tag a whole file
+#ifndef LOG_MODULE
+#define LOG_MODULE __FILE__
+#endif
+
+#define LOG_MODULES_MAX (256) // modules registered past this follow the logger level
+#define LOG_MOD_UNSET   (-2)
+
+// level of module index mod, read inline through the struct logger_levels every logger starts with
+#define logger_level_of(lg, mod)\
+({\
+    const struct logger_levels* _lv = (const struct logger_levels*)(lg);\
+    int _mod = (mod);\
+    (_mod >= 0) ? __atomic_load_n(&_lv->modules[_mod], __ATOMIC_RELAXED) : __atomic_load_n(&_lv->level, __ATOMIC_RELAXED);\
+})
+
+// each statement looks its module up once and keeps the index
+#define _LOG_PASS(logger, module, level)\
+({\
+    static int _log_mod = LOG_MOD_UNSET;\
+    int _m = __atomic_load_n(&_log_mod, __ATOMIC_RELAXED);\
+    if (_m == LOG_MOD_UNSET)\
+    {\
+        _m = logger_module(module);\
+        __atomic_store_n(&_log_mod, _m, __ATOMIC_RELAXED);\
+    }\
+    ((logger) != NULL) && (logger_level_of(logger, _m) >= (level));\
+})
+
+#define log_mprint(logger, module, level, msg, param...)\
+{\
+    if (((level) <= LOG_LV_COMPILE) && _LOG_PASS(logger, module, level))\
+    {\
+        logger_write(logger, level, msg, ##param);\
+    }\
+}
+
+#define log_print(logger, level, msg, param...) log_mprint(logger, LOG_MODULE, level, msg, ##param)
+
+// for hot loops : 1 of every n passes of the statement is written
+#define log_print_every(logger, level, n, msg, param...)\
 {\
-    if (logger_get_level(logger) >= level)\
+    static unsigned int _log_cnt = 0;\
+    if (((level) <= LOG_LV_COMPILE) && _LOG_PASS(logger, LOG_MODULE, level) &&\
+        (__atomic_fetch_add(&_log_cnt, 1, __ATOMIC_RELAXED) % (n) == 0))\
     {\
-        struct timeval __tv;\
-        char* __tmp;\
-        gettimeofday(&__tv, NULL);\
-        asprintf(&__tmp, "(%03lds,%03ldms): "msg, __tv.tv_sec%1000, __tv.tv_usec/1000, ##param);\
-        logger_enq(logger, __tmp);\
+        logger_write(logger, level, msg, ##param);\
     }\
 }
 
-// #define log_print(logger, level, msg, param...)\
-// {\
-//     if (logger_get_level(logger) >= level)\
-//     {\
-//         struct timeval __tv;\
-//         char* __tmp;\
-//         gettimeofday(&__tv, NULL);\
-//         asprintf(&__tmp, "(%03lds,%03ldms): "msg, __tv.tv_sec%1000, __tv.tv_usec/1000, ##param);\
-//         logger_handlemsg(logger, __tmp);\
-//         free(__tmp);
-//     }\
-// }
+// for hot loops : the statement is written at most per_sec times a second
+#define log_print_rate(logger, level, per_sec, msg, param...)\
+{\
+    static struct log_rate _log_rate = {};\
+    if (((level) <= LOG_LV_COMPILE) && _LOG_PASS(logger, LOG_MODULE, level) &&\
+        (logger_rate_pass(&_log_rate, per_sec) == LOG_OK))\
+    {\
+        logger_write(logger, level, msg, ##param);\
+    }\
+}
 
 enum
 {
     LOG_FLAG_STDOUT = 0x1,
     LOG_FLAG_UDP    = 0x2,
-    LOG_FLAG_FILE   = 0x4
+    LOG_FLAG_FILE   = 0x4,
+    LOG_FLAG_BINARY = 0x8,
+    LOG_FLAG_DROP   = 0x10
+};
+
+// binary sink file : struct log_bin_head, then entries packed back to back inside seg_size segments,
+// an entry never crosses a segment and kind 0 means the rest of the segment is unused
+#define LOG_BIN_MAGIC   "TACOLOG"
+#define LOG_BIN_VERSION (1)
+
+enum
+{
+    LOG_BIN_FMT = 1, // the format string of call site id, once per file before its first record
+    LOG_BIN_REC,     // uint64_t monotonic ns, then the arguments as logger_format takes them
+    LOG_BIN_STR      // uint64_t monotonic ns, then bytes of a logger_enq string written as they are
+};
+
+struct log_bin_head
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t seg_size;
+    int64_t wall_offset; // add to a record's ts for CLOCK_REALTIME ns
+};
+
+struct log_bin_entry
+{
+    uint8_t kind;
+    uint8_t level;
+    uint16_t len; // bytes that follow this header
+    uint32_t id;  // call site
 };
 
 enum
@@ -59,15 +140,42 @@ enum
 
 struct logger;
 
+struct logger_levels
+{
+    int level;                            // of modules without their own
+    signed char modules[LOG_MODULES_MAX]; // level in effect for each module
+};
+
+struct log_rate
+{
+    uint64_t sec;
+    unsigned int count;
+};
+
 struct logger* logger_create(void);
 void logger_release(struct logger* lg);
 
+// formats and writes records until logger_break, what is queued by then is still written
 void logger_run(struct logger* lg);
 void logger_break(struct logger* lg);
 
 void logger_set_level(struct logger* lg, int lv);
 int logger_get_level(struct logger* lg);
 
+// module names are registered once for the process, return the index or -1 once LOG_MODULES_MAX are taken
+int logger_module(const char* name);
+
+// LOG_LV_INVALID puts the module back on the logger level
+int logger_set_module_level(struct logger* lg, const char* module, int lv);
+int logger_get_module_level(struct logger* lg, const char* module);
+
+// LOG_OK while the calls of this second are within per_sec
+int logger_rate_pass(struct log_rate* rate, int per_sec);
+
+// fmt must outlive the logger, a string literal as log_print passes it
+void logger_write(struct logger* lg, int level, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// str is written as it is, without the time prefix, and freed by the logger
 void logger_enq(struct logger* lg, char* str);
 
 int logger_set_udp(struct logger* logger, char* dstip, int dstport);
@@ -76,4 +184,23 @@ int logger_unset_udp(struct logger* logger);
 int logger_set_file(struct logger* logger, char* filepath);
 int logger_unset_file(struct logger* logger);
 
+// logger_run moves filepath to filepath.1 (.1 to .2 ... up to .keep) once the file would pass max_size bytes
+// or is max_secs old, 0 turns either off
+int logger_set_rotate(struct logger* logger, long max_size, int max_secs, int keep);
+
+// records are appended to a preallocated mmap of filepath unformatted, examples/logger_decode renders them
+// seg_size is rounded up to pages, 0 is LOG_BIN_SEG
+int logger_set_binary(struct logger* logger, char* filepath, long seg_size);
+int logger_unset_binary(struct logger* logger);
+
+// formats args packed by the binary sink the way logger_run does, return the length written to out
+int logger_format(char* out, int size, const char* fmt, const void* args, int args_len);
+
+// a thread whose ring is full drops the record and logger_run reports the count, instead of spilling it to the heap
+int logger_set_drop(struct logger* logger);
+int logger_unset_drop(struct logger* logger);
+
+int logger_set_stdout(struct logger* logger);
+int logger_unset_stdout(struct logger* logger);
+
 #endif //_LOGGER_H_
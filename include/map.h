@@ -8,6 +8,9 @@
 
 #define MAPID_INVALID (0)
 
+#define MAP_FLAG_LOCKFREE (0x0001) // lock-free grab/release, writers still serialize
+#define MAP_LF_READERS (16)
+
 typedef unsigned int mapid;
 
 struct map_slot
@@ -17,6 +20,26 @@ struct map_slot
     void* data;
 };
 
+// lock-free mode : one slot per entry on its own cache line, id and data never change
+struct map_lfslot
+{
+    mapid id;
+    int   ref;
+    void* data;
+} __attribute__((aligned(64)));
+
+struct map_lftable
+{
+    int max_num;
+    struct map_lfslot* slots[]; // NULL if empty
+};
+
+// readers inside the table, counted under the epoch parity they entered with
+struct map_lfreader
+{
+    int cnt[2];
+} __attribute__((aligned(64)));
+
 struct map
 {
     mapid lastid;
@@ -28,10 +51,16 @@ struct map
     struct map_slot* slots;
     void (*cleanfn)(void* data);
 
+    int flag;
+    struct map_lftable* table;
+    unsigned int epoch;
+    struct map_lfreader* readers;
+
     int is_init;
 };
 
 int map_init(struct map* map, void (*cleanfn)(void*));
+int map_init_ex(struct map* map, void (*cleanfn)(void*), int flag);
 int map_uninit(struct map* map);
 
 mapid map_new(struct map* map, void *data);
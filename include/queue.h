@@ -1,6 +1,7 @@
 #ifndef _QUEUE_H_
 #define _QUEUE_H_
 
+#include <stdint.h>
 #include <semaphore.h>
 
 #define QUEUE_OK (0)
@@ -8,6 +9,12 @@
 
 #define QUEUE_FLAG_PUSH_BLOCK (0x0001)
 #define QUEUE_FLAG_POP_BLOCK  (0x0010)
+#define QUEUE_FLAG_LOCKFREE   (0x0100) // Michael-Scott queue, blocking sleeps on a futex only when empty or full
+
+// lock-free nodes come from a process wide pool, a node is never freed since a stale reader may still look at it
+#define QUEUE_NODE_CHUNK  (4096)  // nodes allocated at once
+#define QUEUE_NODE_CHUNKS (16384) // so at most 64M nodes exist
+#define QUEUE_NODE_BATCH  (256)   // nodes moved between a thread cache and the shared depot at once
 
 #define QUEUE_FOREACH(pqueue, _data) for (_data = queue_pop(pqueue); _data; _data = queue_pop(pqueue))
 
@@ -31,9 +38,20 @@ struct queue
     int flag;
 
     void (*cleanfn)(void* data);
+
+    // QUEUE_FLAG_LOCKFREE : node index in the low 32 bits, ABA tag in the high 32 bits
+    uint64_t lf_head __attribute__((aligned(64)));
+    uint64_t lf_tail __attribute__((aligned(64)));
+
+    // futex eventcounts, only bumped when someone waits on them
+    int pop_seq __attribute__((aligned(64)));
+    int pop_waiters;
+    int push_seq;
+    int push_waiters;
 };
 
 int queue_init(struct queue* q, int depth, void (*cleanfn)(void*), int flag);
+// a QUEUE_FLAG_LOCKFREE queue needs queue_init again after queue_clean, which must not race its users
 void queue_clean(struct queue* q);
 
 int queue_push(struct queue* q, void *data);
@@ -6,6 +6,8 @@
 #define RB_OK (0)
 #define RB_FAIL (-1)
 
+#define RB_CACHELINE_SIZE (64)
+
 struct ringbuf
 {
     int size;
@@ -18,14 +20,36 @@ struct ringbuf
     int elem_size;
 
     int is_need_free;
+
+    // single producer / single consumer mode, see ringbuf_init_spsc()
+    int is_spsc;
+    unsigned int mask;
+
+    char _pad0[RB_CACHELINE_SIZE];
+    unsigned int head; // consumer side
+    unsigned int cached_tail;
+
+    char _pad1[RB_CACHELINE_SIZE];
+    unsigned int tail; // producer side
+    unsigned int cached_head;
+
+    char _pad2[RB_CACHELINE_SIZE];
 };
 
 int ringbuf_init(struct ringbuf* rb, int rb_size, int elem_size, void* elements);
 int ringbuf_uninit(struct ringbuf* rb);
 
+// one writer thread and one reader thread without locks, write fails when full
+// instead of overwriting. rb_size is rounded up to power of 2 if elements is NULL
+int ringbuf_init_spsc(struct ringbuf* rb, int rb_size, int elem_size, void* elements);
+
 int ringbuf_write(struct ringbuf* rb, void* input);
 int ringbuf_read(struct ringbuf* rb, void* output);
 
+// return number of elements actually written / read
+int ringbuf_write_n(struct ringbuf* rb, void* input, int num);
+int ringbuf_read_n(struct ringbuf* rb, void* output, int num);
+
 int ringbuf_empty(struct ringbuf* rb); // yes : return 1(true), no return 0(false)
 int ringbuf_full(struct ringbuf* rb); // yes : return 1(true), no return 0(false)
 
@@ -7,56 +7,50 @@
 #define atom_spinlock(ptr) while (__sync_lock_test_and_set(ptr,1)) {}
 #define atom_spinunlock(ptr) __sync_lock_release(ptr)
 
+#define RWLOCK_SPIN (128)    // busy polls before yielding
+#define RWLOCK_YIELD (8)     // sched_yield rounds before sleeping on a futex
+#define BRLOCK_SLOTS (32)    // reader counters of a brlock, picked by cpu
+
+// phase-fair ticket lock : readers and writers take turns, so neither side starves.
+// waiters spin, yield a few times to a preempted holder and then sleep in futex_wait
 struct rwlock
 {
-    int write;
-    int read;
+    unsigned int rin;  // reader entries << 8 | writer present | writer phase
+    unsigned int rout; // reader exits << 8
+    unsigned int win;  // writer tickets
+    unsigned int wout; // writer tickets served
+    int rsleep;        // readers sleeping on rin
+    int wsleep;        // writers sleeping on wout
+    int dsleep;        // the writer sleeping on rout until readers drain
+    unsigned int drain_rout; // rout value that writer waits for
 };
 
-static inline void rwlock_init(struct rwlock* lock)
-{
-    lock->write = lock->read = 0;
-}
+void rwlock_init(struct rwlock* lock);
+void rwlock_rlock(struct rwlock* lock);
+void rwlock_runlock(struct rwlock* lock);
+void rwlock_wlock(struct rwlock* lock);
+void rwlock_wunlock(struct rwlock* lock);
 
-static inline void rwlock_rlock(struct rwlock* lock)
-{
-    while (1)
-    {
-        while (lock->write)
-        {
-            atom_sync();
-        }
-
-        atom_inc(&lock->read);
-
-        if (lock->write)
-        {
-            atom_dec(&lock->read);
-        }
-        else
-        {
-            break;
-        }
-    }
-}
-
-static inline void rwlock_runlock(struct rwlock* lock)
+struct brlock_slot
 {
-    atom_dec(&lock->read);
-}
+    int cnt;
+} __attribute__((aligned(64)));
 
-static inline void rwlock_wlock(struct rwlock* lock)
+// big reader lock : readers only touch the counter of their cpu, writers pay for it
+struct brlock
 {
-    atom_spinlock(&lock->write);
-    while (lock->read)
-    {
-        atom_sync();
-    }
-}
-
-static inline void rwlock_wunlock(struct rwlock* lock)
-{
-    atom_spinunlock(&lock->write);
-}
+    struct brlock_slot slots[BRLOCK_SLOTS];
+    unsigned int writer; // readers sleep on it
+    int rsleep;
+    unsigned int drain;  // bumped by readers leaving while a writer waits
+    int wsleep;
+    struct rwlock wlock; // orders writers
+};
+
+void brlock_init(struct brlock* lock);
+int  brlock_rlock(struct brlock* lock); // return the slot to pass to brlock_runlock
+void brlock_runlock(struct brlock* lock, int slot);
+void brlock_wlock(struct brlock* lock);
+void brlock_wunlock(struct brlock* lock);
 
 #endif //_RWLOCK_H_
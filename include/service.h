@@ -2,17 +2,53 @@
 #define _SERVICE_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "map.h"
 #include "fast_queue.h"
+#include "thread.h"
 
 #define SERV_OK (0)
 #define SERV_FAIL (-1)
 
 #define SERVICE_NAME_SIZE (20)
 
-#define MAX_SERVICE_NUM (100)
+#define MAX_SERVICE_NUM (100) // thread mode only
 #define MAX_WATCH_NUM (1000)
 
+// M:N mode : a service runs on at most one worker at a time
+#define SERV_ST_IDLE     (0)
+#define SERV_ST_QUEUED   (1)
+#define SERV_ST_RUNNING  (2)
+#define SERV_ST_NOTIFIED (3) // woken while running, runs again afterwards
+
+// message pool : payload and header in one malloced block, cached per thread by size class
+#define SERV_MSG_CLASSES (4)   // 128, 512, 2048, 8192 bytes including the header, bigger ones are malloced
+#define SERV_MSG_BATCH   (64)  // messages moved between a thread cache and the shared depot at once
+#define SERV_MSG_DEPOT   (256) // batches kept by the depot per class, the rest goes back to malloc
+
+// dispatch budget : a turn ends after this many messages or microseconds, then timers and fds get their share
+#define SERV_BUDGET_MSGS (1024)
+#define SERV_BUDGET_US   (0)    // 0 : no time limit
+#define SERV_LAT_SAMPLE  (16)   // handler latency is measured for one message out of this many
+
+// service_call : requests carry a positive session, replies the same one marked as a reply
+#define SERV_CALL_OK      (0)
+#define SERV_CALL_TIMEOUT (1)   // msg is NULL
+#define SERV_CALL_TICK_MS (10)  // timeout resolution
+#define SERV_CALL_SLOT_BITS (20) // calls in flight per service : 1 << SERV_CALL_SLOT_BITS
+
+// timers : hierarchical wheel per service, 1 ms per tick, 4 levels of 64 slots cover 2^24 ms,
+// all timers of a service share one timerfd
+#define SERV_TM_BITS      (6)
+#define SERV_TM_SIZE      (1 << SERV_TM_BITS)
+#define SERV_TM_MASK      (SERV_TM_SIZE - 1)
+#define SERV_TM_LEVELS    (4)
+#define SERV_TM_CHUNK     (256) // timers are allocated in chunks that never move
+#define SERV_TM_SLOT_BITS (20)  // timers per service : 1 << SERV_TM_SLOT_BITS
+
+#define SERV_NAME_INIT (64) // initial slots of the name index, it doubles at half load
+
 #define INVALID_ID MAPID_INVALID
 
 typedef unsigned int serviceid;
@@ -36,8 +72,85 @@ struct service_msg
 {
     int session;
     serviceid src;
-    void* msg;
+    void* msg;    // start of the block holding this header, or caller memory for TAG_DONTCOPY
     int msglen;
+    void* block;  // malloced block this header sits at the end of
+    int cls;      // pool size class, < 0 : malloced
+    bool is_ref;  // msg is caller memory, free()d unless RET_DONTFREE
+    bool is_reply; // sent by service_reply, goes to the call instead of the handler
+};
+
+// a reply keeps msg with RET_DONTFREE like a service_cb does
+typedef ret_t (*service_reply_cb)(serviceid self, void* db, int status, void* msg, int msglen, void* arg);
+
+struct service_call
+{
+    int seq;      // high bits of the session, changes on every reuse of the slot
+    int prev;     // deadline list, or next free slot in next
+    int next;
+    long deadline; // ns, 0 : no timeout
+    service_reply_cb cb; // NULL : free slot
+    void* arg;
+};
+
+// session table of the calls a service waits for, only touched by the service itself
+struct service_calls
+{
+    struct service_call* slots;
+    int size;
+    int num;
+    int free_head;
+    int dl_head;  // calls with a timeout, sorted by deadline
+    int dl_tail;
+    watchid timer;
+};
+
+struct service_timer
+{
+    int idx;
+    int seq;          // high bits of the watchid, changes on every reuse
+    uint64_t expire;  // ms
+    int interval_ms;
+    void (*callback)(serviceid sid, void* db, void* arg); // NULL : free
+    void* arg;
+    struct service_timer*  tm_next;  // wheel slot, or free list
+    struct service_timer** tm_pprev; // NULL if not in wheel
+};
+
+struct service_wheel
+{
+    pthread_mutex_t lock;
+    struct service_timer* slots[SERV_TM_LEVELS][SERV_TM_SIZE];
+    uint64_t current;
+    uint64_t armed;   // expiry the timerfd is set to, 0 : disarmed
+    int num;          // timers in the wheel
+
+    struct service_timer** chunks;
+    int chunk_num;
+    struct service_timer* free_list;
+
+    int fd;
+};
+
+// interned name, stays valid until service_system_uninit
+struct service_name
+{
+    unsigned int hashv;
+    serviceid id; // INVALID_ID until a service of this name is created
+    char name[SERVICE_NAME_SIZE+1];
+};
+
+struct service_stats
+{
+    long msgs;         // messages handled
+    long turns;        // mailbox drains
+    long budget_hits;  // drains cut short by the budget
+    int  depth;        // messages queued right now
+    int  max_depth;
+    int  max_batch;    // most messages handled in one drain
+    long lat_samples;  // sampled handler calls
+    long lat_total_ns;
+    long lat_max_ns;
 };
 
 typedef ret_t (*service_cb)(serviceid self, void* db, int session, serviceid src, void* msg, int msglen);
@@ -59,9 +172,21 @@ struct service
     struct map watchers;
 
     int qfd;
+    int qwake;    // qfd written and not read yet, later sends skip the write
     int stopfd;
 
     bool watching;
+
+    int budget_msgs;
+    int budget_us;
+    struct service_stats stats;
+    struct service_calls calls;
+    struct service_wheel* wheel; // created with the first timer
+
+    // M:N mode
+    int sched;
+    struct fqueue* evq; // ids of watchers with a ready fd
+    bool is_started;
 };
 
 struct watcher
@@ -70,26 +195,44 @@ struct watcher
     int fd;
     void (*callback)(serviceid sid, void* db, int fd, void* arg);
     void* arg;
-
-    int time_ms;
-    int interval_ms;
-    void (*tmcallback)(serviceid sid, void* db, void* arg);
-    serviceid sid;
 };
 
 serviceid service_create(char* name, void* db, service_cb handlemsg, void (*init)(serviceid sid, void* db), void (*uninit)(serviceid sid, void* db));
 
 serviceid service_getid(char* name);
 
+// resolve a name once and keep the handle, service_resolve is a single load
+struct service_name* service_intern(char* name);
+serviceid service_resolve(struct service_name* handle);
+
 watchid service_watch(serviceid sid, int fd, void (*callback)(serviceid sid, void* db, int fd, void* arg), void* arg);
 void service_unwatch(serviceid sid, watchid wid);
 
+// first after time_ms (0 : interval_ms), then every interval_ms (0 : once). no syscall unless it is the earliest timer
 watchid service_start_timer(serviceid sid, int time_ms, int interval_ms, void (*callback)(serviceid sid, void* db, void* arg), void* arg);
 void service_stop_timer(serviceid sid, watchid wid);
 
+// TAG_COPY copies msg into a pooled message. a handler keeping it with RET_DONTFREE releases it later
+// with free() as it always did, or with service_msg_free() to give it back to the pool
 int service_send(serviceid src, serviceid dst, tag_t tag, int session, void* msg, int msglen);
 
-int service_system_init(void);
+// reserve a pooled buffer of size bytes, fill it and pass it on with service_send_msg without copying.
+// the buffer belongs to the receiver after service_send_msg, even if it fails
+void* service_msg_alloc(int size);
+int service_send_msg(serviceid src, serviceid dst, int session, void* msg, int msglen);
+void service_msg_free(void* msg);
+
+// send a request from inside service src, cb runs in src with the reply or on timeout (timeout_ms <= 0 : never).
+// return the session, dst answers it with service_reply
+int service_call(serviceid src, serviceid dst, void* msg, int msglen, int timeout_ms, service_reply_cb cb, void* arg);
+int service_reply(serviceid self, serviceid dst, int session, void* msg, int msglen);
+
+// <= 0 : no limit on that side
+int service_set_budget(serviceid sid, int max_msgs, int max_us);
+int service_get_stats(serviceid sid, struct service_stats* stats);
+
+int service_system_init(void);                  // one thread per service
+int service_system_init_ex(int worker_num);     // services multiplexed on worker_num workers, <= 0 : one per core
 void service_system_uninit(void);
 
 void service_system_run(void);
@@ -35,4 +35,10 @@ int sudp_receive(int fd, void* buffer, int buffer_size, union ipaddr* src_addr);
 int sudp_receive_timed(int fd, void* buffer, int buffer_size, union ipaddr* src_addr, int timeout_ms);
 int sudp_receive_nonblocking(int fd, void* buffer, int buffer_size, union ipaddr* src_addr);
 
+// UDP_SEGMENT : a send larger than seg_size leaves as seg_size datagrams, 0 turns it off
+int sudp_set_gso(int fd, int seg_size);
+// UDP_GRO : datagrams of a flow may arrive coalesced, see sudp_receive_gro()
+int sudp_set_gro(int fd, int on);
+int sudp_receive_gro(int fd, void* buffer, int buffer_size, union ipaddr* src_addr, int* seg_size);
+
 #endif //_SIMPLE_UDP_H
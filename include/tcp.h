@@ -4,11 +4,15 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #define TCP_PORT_ANY -1
 #define TCP_OK (0)
 #define TCP_FAIL (-1)
 
+// below this the page pinning of MSG_ZEROCOPY costs more than the copy
+#define TCP_ZEROCOPY_MIN (10 * 1024)
+
 struct tcp_addr
 {
     char ipv4[INET_ADDRSTRLEN];
@@ -21,6 +25,12 @@ struct tcp
     int local_port;
     int is_init;
     struct tcp_addr remote;
+
+    // MSG_ZEROCOPY sends are numbered from 0, buffers of sends < zc_done can be reused
+    int is_zerocopy;
+    unsigned int zc_next;
+    unsigned int zc_done;
+    unsigned int zc_copied; // sends the kernel fell back to copying for
 };
 
 struct tcp_server
@@ -39,6 +49,17 @@ int tcp_client_uninit(struct tcp* tcp);
 
 int tcp_recv(struct tcp* tcp, void* buffer, int buffer_size);
 int tcp_send(struct tcp* tcp, void* data, int data_len);
+int tcp_sendv(struct tcp* tcp, struct iovec* iov, int iov_num);
+
+int tcp_zerocopy_enable(struct tcp* tcp);
+// data must stay untouched until tcp_zerocopy_reap() moves zc_done past this send.
+// sends shorter than TCP_ZEROCOPY_MIN are plain copies, they get no completion and data is free at once
+int tcp_send_zc(struct tcp* tcp, void* data, int data_len);
+int tcp_zerocopy_reap(struct tcp* tcp); // non-blocking, return number of sends completed
+
+// send count bytes of file_fd from *offset (or its file position if offset is NULL),
+// sendfile() first and splice() through a pipe for fds sendfile does not take
+int tcp_sendfile(struct tcp* tcp, int file_fd, off_t* offset, int count);
 
 int tcp_to_sockaddr(struct tcp_addr tcp_addr, struct sockaddr_in* sock_addr);
 int tcp_to_tcpaddr(struct sockaddr_in sock_addr, struct tcp_addr* tcp_addr);
@@ -0,0 +1,83 @@
+#ifndef _TCP_CONN_H_
+#define _TCP_CONN_H_
+
+#include "events.h"
+#include "tcp.h"
+
+// non-blocking tcp connections driven by an evloop,
+// every tcp_conn_xxx call must be made from the loop thread
+
+#define TCP_CONN_OK (0)
+#define TCP_CONN_FAIL (-1)
+
+#define TCP_CONN_EV_CONNECTED (1)
+#define TCP_CONN_EV_CLOSED    (2)
+#define TCP_CONN_EV_ERROR     (3) // followed by TCP_CONN_EV_CLOSED
+
+#define TCP_CONN_BUF_MIN  (16 * 1024)
+#define TCP_CONN_BUF_MAX  (16 * 1024 * 1024)
+
+struct tcp_conn_buf
+{
+    char* data;
+    int start;
+    int end;
+    int size;
+};
+
+struct tcp_conn
+{
+    int fd;
+    int state;
+    struct evloop* loop;
+    struct ev ev;
+    struct tcp_addr remote;
+
+    struct tcp_conn_buf in;
+    struct tcp_conn_buf out;
+
+    // return length of the first complete frame in data, 0 if incomplete, < 0 to drop the connection.
+    // NULL : every received chunk is delivered as it is
+    int  (*framefn)(struct tcp_conn* conn, void* data, int len);
+    void (*recvfn)(struct tcp_conn* conn, void* data, int len);
+    void (*eventfn)(struct tcp_conn* conn, int event);
+    void* arg;
+
+    int busy; // inside our own callbacks, free it later
+};
+
+struct tcp_listener
+{
+    int fd;
+    int local_port;
+    struct evloop* loop;
+    struct ev ev;
+
+    // set conn->framefn/recvfn/eventfn/arg here, conn starts reading after return
+    void (*acceptfn)(struct tcp_listener* listener, struct tcp_conn* conn);
+    void* arg;
+
+    int is_init;
+};
+
+// SO_REUSEPORT is set, so every loop of an evgroup can own a listener of the same port
+int tcp_listener_init(struct tcp_listener* listener, struct evloop* loop, char* local_ip, int local_port, int max_conn_num,
+                      void (*acceptfn)(struct tcp_listener*, struct tcp_conn*), void* arg);
+int tcp_listener_uninit(struct tcp_listener* listener);
+
+// TCP_CONN_EV_CONNECTED is reported through eventfn when the connection is established
+struct tcp_conn* tcp_conn_connect(struct evloop* loop, char* remote_ip, int remote_port,
+                                  void (*eventfn)(struct tcp_conn*, int),
+                                  void (*recvfn)(struct tcp_conn*, void*, int),
+                                  int  (*framefn)(struct tcp_conn*, void*, int),
+                                  void* arg);
+
+// what cannot be sent right now is queued and flushed on EPOLLOUT, return TCP_CONN_OK.
+// when the rest does not fit TCP_CONN_BUF_MAX the bytes already sent are returned, or TCP_CONN_FAIL if none
+int tcp_conn_send(struct tcp_conn* conn, void* data, int data_len);
+int tcp_conn_pending(struct tcp_conn* conn);
+
+// queued output is flushed first, also when conn is still connecting, conn is freed after TCP_CONN_EV_CLOSED
+void tcp_conn_close(struct tcp_conn* conn);
+
+#endif //_TCP_CONN_H_
@@ -16,9 +16,81 @@ struct thread_event
     int flag;
 };
 
+#define THREAD_OK (0)
+#define THREAD_FAIL (-1)
+
+#define THREAD_DEQUE_SIZE (4096) // tasks per worker, pow of 2, overflow goes to the injection queue
+#define THREAD_SPIN (64)         // steal rounds before a worker parks
+#define THREAD_WAIT_MS (10)      // thread_pool_wait looks for tasks again at least this often while parked
+
+// counts outstanding tasks, waiters sleep on count
+struct thread_wg
+{
+    int count;
+};
+
+struct thread_task
+{
+    void (*func)(void* arg);
+    void* arg;
+    struct thread_wg* wg; // done once func returns, may be NULL
+};
+
+// chase-lev deque : the owner pushes and pops at bottom, thieves take from top
+struct thread_worker
+{
+    long top __attribute__((aligned(64)));
+    long bottom __attribute__((aligned(64)));
+    struct thread_task tasks[THREAD_DEQUE_SIZE] __attribute__((aligned(64)));
+
+    pthread_t tid;
+    struct thread_pool* pool;
+    int idx;
+    unsigned int seed;
+};
+
+struct thread_pool
+{
+    struct thread_worker* workers;
+    int worker_num;
+
+    // submissions from outside the workers
+    pthread_mutex_t inj_lock;
+    struct thread_task* inj_tasks;
+    int inj_head;
+    int inj_num;
+    int inj_size;
+
+    unsigned int seq; // bumped on every submit, idle workers sleep on it
+    int sleeping;
+    unsigned int wait_seq; // bumped on every submit and finished group, thread_pool_wait sleeps on it
+    int waiting;
+    int is_running;
+    int is_init;
+};
+
 void thread_join(struct thread* thread_array, int num);
 void thread_ev_create(struct thread_event* ev);
 void thread_ev_release(struct thread_event* ev);
 void thread_ev_trigger(struct thread_event* ev);
 void thread_ev_wait(struct thread_event* ev);
+
+void thread_wg_init(struct thread_wg* wg);
+void thread_wg_add(struct thread_wg* wg, int num);
+void thread_wg_done(struct thread_wg* wg);
+void thread_wg_wait(struct thread_wg* wg);
+
+int  thread_pool_init(struct thread_pool* pool, int worker_num); // worker_num <= 0 : one per core
+void thread_pool_uninit(struct thread_pool* pool);               // runs what is queued, then joins
+
+// wg may be NULL, it is added to before the tasks are queued. the wg field of tasks is set to it
+int thread_pool_submit(struct thread_pool* pool, void (*func)(void*), void* arg, struct thread_wg* wg);
+int thread_pool_submit_batch(struct thread_pool* pool, struct thread_task* tasks, int num, struct thread_wg* wg);
+
+// like thread_wg_wait, but runs pool tasks meanwhile, so workers may wait on nested work
+void thread_pool_wait(struct thread_pool* pool, struct thread_wg* wg);
+
+// func(begin, end, arg) on chunks of [begin, end) no larger than grain, return when all are done
+int thread_pool_for(struct thread_pool* pool, int begin, int end, int grain,
+                    void (*func)(int begin, int end, void* arg), void* arg);
 #endif //_THREAD_H_
@@ -12,6 +12,12 @@
 #define UDPv4 AF_INET
 #define UDPv6 AF_INET6
 
+#define UDP_BATCH_MAX (256)
+
+// one GSO send carries at most this many segments and 64K of payload
+#define UDP_GSO_MAX_SEGS (64)
+#define UDP_GSO_MAX_SIZE (65507)
+
 union sock_addr
 {
     struct sockaddr_storage ss;
@@ -25,6 +31,15 @@ struct udp_addr
     int  port;
 };
 
+// one datagram of udp_recv_batch/udp_send_batch, the address stays raw
+struct udp_msg
+{
+    void* data;
+    int   size; // recv : capacity of data
+    int   len;  // recv : filled in, send : bytes of data to send
+    union sock_addr remote;
+};
+
 struct udp
 {
     int type;
@@ -33,11 +48,26 @@ struct udp
     int lock;
     int fd;
     int is_init;
+
+    int gso_size; // 0 : off
+    int is_gro;
 };
 
 int udp_send(struct udp* udp, struct udp_addr remote, void* data, int data_len);
 int udp_recv(struct udp* udp, void* buffer, int buffer_size, struct udp_addr* remote);
 
+// blocks until at least one datagram arrives, return the number of msgs filled
+int udp_recv_batch(struct udp* udp, struct udp_msg* msgs, int msg_num);
+// no lock is taken, return the number of msgs sent
+int udp_send_batch(struct udp* udp, struct udp_msg* msgs, int msg_num);
+
+// every send larger than seg_size leaves as seg_size datagrams (the last may be shorter), 0 turns it off.
+// udp_send splits what is past UDP_GSO_MAX_SEGS segments or UDP_GSO_MAX_SIZE bytes, udp_send_batch rejects it
+int udp_set_gso(struct udp* udp, int seg_size);
+int udp_set_gro(struct udp* udp, int on);
+// buffer may hold several coalesced datagrams of seg_size each (the last may be shorter)
+int udp_recv_gro(struct udp* udp, void* buffer, int buffer_size, union sock_addr* remote, int* seg_size);
+
 int udp_init(struct udp* udp, char* local_ip, int local_port);
 int udp_uninit(struct udp* udp);
 
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 
 #define UNPATH_SIZE 108
 #define UN_OK (0)
@@ -32,5 +33,6 @@ int untcp_client_uninit(struct untcp* untcp);
 
 int untcp_recv(struct untcp* untcp, void* buffer, int buffer_size);
 int untcp_send(struct untcp* untcp, void* data, int data_len);
+int untcp_sendv(struct untcp* untcp, struct iovec* iov, int iov_num);
 
 #endif //_UNSOCK_H_
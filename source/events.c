@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sched.h>
 #include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/time.h>
 
 #include "events.h"
 
@@ -15,6 +20,8 @@
 
 #define EV_ACT_START (1)
 #define EV_ACT_STOP  (2)
+#define EV_ACT_AGAIN (3)
+#define EV_ACT_MODIFY (4)
 
 #define EV_IO     (1)
 #define EV_TIMER  (2)
@@ -31,22 +38,241 @@
     }\
 }
 
+#define EV_ACT_RING_SIZE (4096)
+
 struct evact
 {
     int action;
     struct ev* ev;
+    int events; // EV_ACT_MODIFY
+
+    // ev_send, no struct ev is allocated
+    void (*callback)(struct evloop* loop, struct ev* ev, void* arg);
+    void* arg;
+};
+
+struct evact_cell
+{
+    unsigned long seq;
+    struct evact act;
 };
 
 static void _clean_act(void* input)
 {
     if (input == NULL) return;
+    free(input);
+}
 
-    struct evact* act = (struct evact*)input;
-    if (act->ev && (act->ev->type == EV_PURE))
+static int _ring_push(struct evloop* loop, struct evact* act)
+{
+    struct evact_cell* cell;
+    unsigned long pos = __atomic_load_n(&loop->act_tail, __ATOMIC_RELAXED);
+    long diff;
+    while (1)
     {
-        free(act->ev);
+        cell = &loop->act_ring[pos & loop->act_mask];
+        diff = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)pos;
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&loop->act_tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return EV_FAIL; // FULL
+        }
+        else
+        {
+            pos = __atomic_load_n(&loop->act_tail, __ATOMIC_RELAXED);
+        }
     }
-    free(act);
+
+    cell->act = *act;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return EV_OK;
+}
+
+static int _ring_pop(struct evloop* loop, struct evact* act)
+{
+    // only the loop thread pops, no need to compete for act_head
+    unsigned long pos = loop->act_head;
+    struct evact_cell* cell = &loop->act_ring[pos & loop->act_mask];
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1) return EV_FAIL; // EMPTY
+
+    *act = cell->act;
+    __atomic_store_n(&cell->seq, pos + loop->act_mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&loop->act_head, pos + 1, __ATOMIC_RELAXED); // read by _evgroup_least_loaded
+    return EV_OK;
+}
+
+static void _wakeup(struct evloop* loop)
+{
+    if (__atomic_exchange_n(&loop->qfd_armed, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        eventfd_write(loop->qfd, 1);
+    }
+}
+
+static uint64_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline int _is_loop_thread(struct evloop* loop)
+{
+    return (loop->state == EV_ST_RUNNING) && pthread_equal(loop->tid, pthread_self());
+}
+
+static void _tm_link(struct evloop* loop, struct ev* ev)
+{
+    uint64_t expire = (ev->expire < loop->tm_current) ? loop->tm_current : ev->expire;
+    uint64_t delta  = expire - loop->tm_current;
+
+    int level;
+    for (level=0; level<EVTM_WHEEL_LEVELS-1; level++)
+    {
+        if (delta < ((uint64_t)1 << (EVTM_WHEEL_BITS * (level+1)))) break;
+    }
+
+    if (delta >= ((uint64_t)1 << (EVTM_WHEEL_BITS * EVTM_WHEEL_LEVELS)))
+    {
+        // farther than the wheel can hold, park it in the last slot and re-place it on cascade
+        expire = loop->tm_current + ((uint64_t)1 << (EVTM_WHEEL_BITS * EVTM_WHEEL_LEVELS)) - 1;
+    }
+
+    struct ev** head = &loop->tm_wheel[level][(expire >> (EVTM_WHEEL_BITS * level)) & EVTM_WHEEL_MASK];
+    ev->tm_next  = *head;
+    ev->tm_pprev = head;
+    if (*head) (*head)->tm_pprev = &ev->tm_next;
+    *head = ev;
+}
+
+static void _tm_unlink(struct ev* ev)
+{
+    *(ev->tm_pprev) = ev->tm_next;
+    if (ev->tm_next) ev->tm_next->tm_pprev = ev->tm_pprev;
+    ev->tm_next  = NULL;
+    ev->tm_pprev = NULL;
+}
+
+static void _tm_add(struct evloop* loop, struct ev* ev, int after_ms)
+{
+    if (ev->tm_pprev)
+    {
+        _tm_unlink(ev);
+        loop->tm_num--;
+    }
+
+    if (loop->tm_num == 0) loop->tm_current = _now_ms();
+
+    ev->expire = _now_ms() + after_ms;
+    _tm_link(loop, ev);
+    loop->tm_num++;
+}
+
+static void _tm_del(struct evloop* loop, struct ev* ev)
+{
+    if (ev->tm_pprev == NULL) return;
+
+    _tm_unlink(ev);
+    loop->tm_num--;
+}
+
+static void _tm_cascade(struct evloop* loop, int level, int idx)
+{
+    struct ev* ev = loop->tm_wheel[level][idx];
+    struct ev* next;
+    loop->tm_wheel[level][idx] = NULL;
+    for (; ev; ev = next)
+    {
+        next = ev->tm_next;
+        _tm_link(loop, ev);
+    }
+}
+
+static void _tm_expire(struct evloop* loop)
+{
+    uint64_t now = _now_ms();
+    if (loop->tm_num == 0)
+    {
+        loop->tm_current = now;
+        return;
+    }
+
+    uint64_t tick;
+    int level, idx;
+    struct ev* pending;
+    struct ev* ev;
+    while ((loop->tm_current <= now) && (loop->tm_num > 0) && (loop->state == EV_ST_RUNNING))
+    {
+        tick = loop->tm_current;
+        for (level=1; level<EVTM_WHEEL_LEVELS; level++)
+        {
+            if ((tick >> (EVTM_WHEEL_BITS * (level-1))) & EVTM_WHEEL_MASK) break;
+
+            _tm_cascade(loop, level, (tick >> (EVTM_WHEEL_BITS * level)) & EVTM_WHEEL_MASK);
+        }
+
+        // callbacks may stop any timer, so run them from a list they can unlink from
+        idx     = tick & EVTM_WHEEL_MASK;
+        pending = loop->tm_wheel[0][idx];
+        loop->tm_wheel[0][idx] = NULL;
+        if (pending) pending->tm_pprev = &pending;
+
+        loop->tm_current = tick + 1;
+
+        while (pending)
+        {
+            ev = pending;
+            _tm_unlink(ev);
+            loop->tm_num--;
+
+            if (ev->interval_ms > 0)
+            {
+                ev->expire = tick + ev->interval_ms;
+                if (ev->expire <= now) ev->expire = now + ev->interval_ms;
+                _tm_link(loop, ev);
+                loop->tm_num++;
+            }
+            ev->callback(loop, ev, ev->arg);
+        }
+    }
+
+    if (loop->tm_num == 0) loop->tm_current = now;
+}
+
+static int _tm_timeout(struct evloop* loop)
+{
+    if (loop->tm_num == 0) return EPOLL_WAIT_MS;
+
+    uint64_t next = UINT64_MAX;
+    uint64_t base;
+    int level, i, shift;
+    for (level=0; level<EVTM_WHEEL_LEVELS; level++)
+    {
+        shift = EVTM_WHEEL_BITS * level;
+        base  = loop->tm_current >> shift;
+        for (i=0; i<=EVTM_WHEEL_SIZE; i++)
+        {
+            if (((base + i) << shift) < loop->tm_current) continue; // already cascaded
+
+            if (loop->tm_wheel[level][(base + i) & EVTM_WHEEL_MASK])
+            {
+                if (((base + i) << shift) < next) next = (base + i) << shift;
+                break;
+            }
+        }
+    }
+
+    uint64_t now = _now_ms();
+    if (next <= now) return 0;
+    if (next - now > EPOLL_WAIT_MS) return EPOLL_WAIT_MS;
+    return (int)(next - now);
 }
 
 int evloop_init(struct evloop* loop, int max_ev_num)
@@ -58,6 +284,16 @@ int evloop_init(struct evloop* loop, int max_ev_num)
     loop->act_queue = fqueue_create(_clean_act);
     loop->epfd      = epoll_create(max_ev_num);
 
+    loop->act_ring = calloc(sizeof(struct evact_cell), EV_ACT_RING_SIZE);
+    CHECK_IF(loop->act_ring == NULL, return EV_FAIL, "calloc failed");
+
+    unsigned long i;
+    for (i=0; i<EV_ACT_RING_SIZE; i++)
+    {
+        loop->act_ring[i].seq = i;
+    }
+    loop->act_mask = EV_ACT_RING_SIZE - 1;
+
     loop->qfd = eventfd(0, 0);
     struct epoll_event tmp = {
         .events = EPOLLIN,
@@ -66,6 +302,7 @@ int evloop_init(struct evloop* loop, int max_ev_num)
     epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->qfd, &tmp);
 
     loop->max_ev_num = max_ev_num;
+    loop->tm_current = _now_ms();
     loop->state      = EV_ST_INIT;
     return EV_OK;
 }
@@ -83,6 +320,23 @@ void evloop_uninit(struct evloop* loop)
     loop->qfd = -1;
 
     fqueue_release(loop->act_queue);
+    free(loop->act_ring);
+    loop->act_ring = NULL;
+
+    int level, idx;
+    struct ev* ev;
+    for (level=0; level<EVTM_WHEEL_LEVELS; level++)
+    {
+        for (idx=0; idx<EVTM_WHEEL_SIZE; idx++)
+        {
+            while ((ev = loop->tm_wheel[level][idx]) != NULL)
+            {
+                _tm_unlink(ev);
+            }
+        }
+    }
+    loop->tm_num = 0;
+
     close(loop->epfd);
     loop->epfd       = -1;
     loop->max_ev_num = 0;
@@ -90,34 +344,121 @@ void evloop_uninit(struct evloop* loop)
     return;
 }
 
-static void _handle_ev(struct evloop* loop, struct ev* ev)
+static uint32_t _to_epoll_events(int events)
+{
+    uint32_t epevents = 0;
+    if (events & EVIO_READ)      epevents |= EPOLLIN;
+    if (events & EVIO_WRITE)     epevents |= EPOLLOUT;
+    if (events & EVIO_EDGE)      epevents |= EPOLLET;
+    if (events & EVIO_ONESHOT)   epevents |= EPOLLONESHOT;
+    if (events & EVIO_EXCLUSIVE) epevents |= EPOLLEXCLUSIVE;
+    return epevents;
+}
+
+static int _from_epoll_events(uint32_t epevents)
+{
+    int revents = 0;
+    if (epevents & (EPOLLIN | EPOLLRDHUP))  revents |= EVIO_READ;
+    if (epevents & EPOLLOUT)                revents |= EVIO_WRITE;
+    if (epevents & (EPOLLERR | EPOLLHUP))   revents |= EVIO_READ | EVIO_WRITE; // let recv/send report it
+    return revents;
+}
+
+static void _handle_ev(struct evloop* loop, struct ev* ev, uint32_t epevents)
 {
     CHECK_IF(loop == NULL, return, "loop is null");
     CHECK_IF(loop->state < EV_ST_RUNNING, return, "loop is not running yet");
     CHECK_IF(ev == NULL, return, "ev is null");
     CHECK_IF(ev->fd < 0, return, "ev->fd = %d invalid", ev->fd);
 
-    if (ev->type == EV_TIMER)
+    if (ev->type == EV_SIGNAL)
     {
         uint64_t val;
         ssize_t  sz = sizeof(val);
         read(ev->fd, &val, sz);
+    }
+    else if (ev->type == EV_IO)
+    {
+        ev->revents = _from_epoll_events(epevents);
+    }
+    ev->callback(loop, ev, ev->arg);
+}
+
+static void _apply_act(struct evloop* loop, struct evact* act)
+{
+    struct epoll_event tmp = {};
+    struct ev* ev = act->ev;
 
-        if (ev->interval_ms <= 0)
+    if (act->callback)
+    {
+        struct ev pure = {
+            .fd       = -1,
+            .type     = EV_PURE,
+            .arg      = act->arg,
+            .callback = act->callback
+        };
+        act->callback(loop, &pure, act->arg); // execute callback directly
+    }
+    else if (act->action == EV_ACT_START)
+    {
+        if (ev->type == EV_TIMER)
         {
-            struct epoll_event tmp = {};
-            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ev->fd, &tmp);
-            close(ev->fd);
-            ev->fd = -1;
+            _tm_add(loop, ev, (ev->time_ms > 0) ? ev->time_ms : ev->interval_ms);
+        }
+        else
+        {
+            if (ev->type == EV_SIGNAL)
+            {
+                sigset_t mask;
+                sigemptyset(&mask);
+                sigaddset(&mask, ev->signum);
+                sigprocmask(SIG_BLOCK, &mask, NULL);
+                ev->fd = signalfd(-1, &mask, 0);
+            }
+
+            tmp.events = (ev->type == EV_IO) ? _to_epoll_events(ev->events) : EPOLLIN;
+            tmp.data.ptr = ev;
+            epoll_ctl(loop->epfd, EPOLL_CTL_ADD, ev->fd, &tmp);
         }
     }
-    else if (ev->type == EV_SIGNAL)
+    else if (act->action == EV_ACT_AGAIN)
     {
-        uint64_t val;
-        ssize_t  sz = sizeof(val);
-        read(ev->fd, &val, sz);
+        _tm_add(loop, ev, (ev->interval_ms > 0) ? ev->interval_ms : ev->time_ms);
+    }
+    else if (act->action == EV_ACT_MODIFY)
+    {
+        ev->events   = act->events;
+        tmp.events   = _to_epoll_events(ev->events);
+        tmp.data.ptr = ev;
+        epoll_ctl(loop->epfd, EPOLL_CTL_MOD, ev->fd, &tmp);
+    }
+    else if (act->action == EV_ACT_STOP)
+    {
+        if (ev->type == EV_TIMER)
+        {
+            _tm_del(loop, ev);
+            return;
+        }
+
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ev->fd, &tmp);
+
+        // it may still be pending in this round, the owner is free to release it now
+        int i;
+        for (i=0; i<loop->cur_ev_num; i++)
+        {
+            if (loop->cur_evbuf[i].data.ptr == ev) loop->cur_evbuf[i].data.ptr = NULL;
+        }
+
+        if (ev->type == EV_SIGNAL)
+        {
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, ev->signum);
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            close(ev->fd);
+            ev->fd = -1;
+        }
     }
-    ev->callback(loop, ev, ev->arg);
 }
 
 static void _handle_acts(struct evloop* loop)
@@ -128,68 +469,34 @@ static void _handle_acts(struct evloop* loop)
     eventfd_t val;
     eventfd_read(loop->qfd, &val);
 
-    struct evact* act;
-    struct ev* ev;
-    FQUEUE_FOREACH(loop->act_queue, act)
+    // posts after this point write qfd again, posts before it are seen below
+    __atomic_store_n(&loop->qfd_armed, 0, __ATOMIC_SEQ_CST);
+
+    // only overflowed posts counted by now are applied below, every earlier ring post of their threads is reserved already
+    long queued = __atomic_load_n(&loop->act_queued, __ATOMIC_ACQUIRE);
+
+    // one ring's worth per wakeup, so a flood of posts cannot starve the fds
+    struct evact act;
+    unsigned long i;
+    for (i=0; (i<=loop->act_mask) && (loop->state == EV_ST_RUNNING); i++)
     {
-        struct epoll_event tmp = {};
-        ev = act->ev;
-        if (act->action == EV_ACT_START)
-        {
-            if (ev->type == EV_PURE)
-            {
-                ev->callback(loop, ev, ev->arg); // execute callback directly
-                free(ev);
-            }
-            else
-            {
-                if (ev->type == EV_TIMER)
-                {
-                    ev->fd = timerfd_create(CLOCK_MONOTONIC, 0);
-                    struct itimerspec timeval = {
-                        .it_value.tv_sec     = ev->time_ms / 1000,
-                        .it_value.tv_nsec    = (ev->time_ms % 1000) * 1000 * 1000,
-                        .it_interval.tv_sec  = ev->interval_ms / 1000,
-                        .it_interval.tv_nsec = (ev->interval_ms % 1000) * 1000 * 1000
-                    };
-                    timerfd_settime(ev->fd, 0, &timeval, NULL);
-                }
-                else if (ev->type == EV_SIGNAL)
-                {
-                    sigset_t mask;
-                    sigemptyset(&mask);
-                    sigaddset(&mask, ev->signum);
-                    sigprocmask(SIG_BLOCK, &mask, NULL);
-                    ev->fd = signalfd(-1, &mask, 0);
-                }
+        if (_ring_pop(loop, &act) != EV_OK) break;
+        _apply_act(loop, &act);
+    }
 
-                tmp.events = EPOLLIN;
-                tmp.data.ptr = ev;
-                epoll_ctl(loop->epfd, EPOLL_CTL_ADD, ev->fd, &tmp);
-            }
-        }
-        else if (act->action == EV_ACT_STOP)
-        {
-            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ev->fd, &tmp);
+    // and only once the ring is empty, slots still being filled included, so each thread's posts keep their order
+    if ((i > loop->act_mask) || (__atomic_load_n(&loop->act_tail, __ATOMIC_ACQUIRE) != loop->act_head))
+    {
+        _wakeup(loop);
+        return;
+    }
 
-            if (ev->type == EV_TIMER)
-            {
-                struct itimerspec timeval = {};
-                timerfd_settime(ev->fd, 0, &timeval, NULL);
-                close(ev->fd);
-                ev->fd = -1;
-            }
-            else if (ev->type == EV_SIGNAL)
-            {
-                sigset_t mask;
-                sigemptyset(&mask);
-                sigaddset(&mask, ev->signum);
-                sigprocmask(SIG_UNBLOCK, &mask, NULL);
-                close(ev->fd);
-                ev->fd = -1;
-            }
-        }
-        free(act);
+    struct evact* pact;
+    for (; (queued > 0) && ((pact = fqueue_pop(loop->act_queue)) != NULL); queued--)
+    {
+        __atomic_sub_fetch(&loop->act_queued, 1, __ATOMIC_RELAXED);
+        _apply_act(loop, pact);
+        free(pact);
     }
     return;
 }
@@ -205,16 +512,17 @@ void evloop_run(struct evloop* loop)
     struct epoll_event evbuf[loop->max_ev_num];
     memset(evbuf, 0, sizeof(struct epoll_event) * loop->max_ev_num);
 
-    loop->state = EV_ST_RUNNING;
+    __atomic_store_n(&loop->state, EV_ST_RUNNING, __ATOMIC_RELEASE); // evgroup_break waits for it
+    loop->cur_evbuf = evbuf;
 
     int i, ev_num;
     struct ev* ev;
-    struct evact* act;
     while (loop->state == EV_ST_RUNNING)
     {
-        ev_num = epoll_wait(loop->epfd, evbuf, loop->max_ev_num, EPOLL_WAIT_MS);
-        CHECK_IF(ev_num < 0, break, "epoll_wait fialed");
+        ev_num = epoll_wait(loop->epfd, evbuf, loop->max_ev_num, _tm_timeout(loop));
+        CHECK_IF((ev_num < 0) && (errno != EINTR), break, "epoll_wait fialed");
 
+        loop->cur_ev_num = (ev_num > 0) ? ev_num : 0;
         if (ev_num > 0)
         {
             for (i=0; i<ev_num && (loop->state == EV_ST_RUNNING); i++)
@@ -228,14 +536,19 @@ void evloop_run(struct evloop* loop)
                     }
                     else
                     {
-                        _handle_ev(loop, ev);
+                        _handle_ev(loop, ev, evbuf[i].events);
                     }
                 }
             }
         }
+
+        loop->cur_ev_num = 0;
+        _tm_expire(loop);
     }
-    loop->state = EV_ST_INIT;
+    loop->cur_evbuf  = NULL;
+    loop->cur_ev_num = 0;
     loop->tid   = 0;
+    __atomic_store_n(&loop->state, EV_ST_INIT, __ATOMIC_RELEASE);
     return;
 }
 
@@ -248,6 +561,9 @@ void evloop_break(struct evloop* loop)
     loop->state = EV_ST_WAITING_END;
     if (pthread_self() != loop->tid)
     {
+        _wakeup(loop);
+
+
         int i;
         for (i=0; (i<10) && (loop->state > EV_ST_INIT); i++)
         {
@@ -258,20 +574,53 @@ void evloop_break(struct evloop* loop)
     return;
 }
 
-int evio_init(struct ev* ev, int fd, void (*callback)(struct evloop*, struct ev*, void*), void* arg)
+int evio_init(struct ev* ev, int fd, int events, void (*callback)(struct evloop*, struct ev*, void*), void* arg)
 {
     CHECK_IF(ev == NULL, return EV_FAIL, "ev is null");
     CHECK_IF(fd < 0, return EV_FAIL, "fd = %d invalid", fd);
+    CHECK_IF((events & (EVIO_READ | EVIO_WRITE)) == 0, return EV_FAIL, "events = 0x%x has no read or write", events);
+    CHECK_IF((events & EVIO_EXCLUSIVE) && (events & EVIO_ONESHOT), return EV_FAIL, "exclusive can not be oneshot");
     CHECK_IF(callback == NULL, return EV_FAIL, "callback is null");
 
     memset(ev, 0, sizeof(struct ev));
     ev->fd       = fd;
     ev->type     = EV_IO;
+    ev->events   = events;
     ev->arg      = arg;
     ev->callback = callback;
     return EV_OK;
 }
 
+static int _post(struct evloop* loop, struct evact* act)
+{
+    // keep order with earlier posts which already overflowed
+    if (fqueue_empty(loop->act_queue) && (_ring_push(loop, act) == EV_OK))
+    {
+        _wakeup(loop);
+        return EV_OK;
+    }
+
+    struct evact* newact = calloc(sizeof(struct evact), 1);
+    CHECK_IF(newact == NULL, return EV_FAIL, "calloc failed");
+
+    *newact = *act;
+    int chk = fqueue_push(loop->act_queue, newact);
+    CHECK_IF(chk != FQUEUE_OK, free(newact); return EV_FAIL, "fqueue_push failed");
+    __atomic_add_fetch(&loop->act_queued, 1, __ATOMIC_RELEASE);
+
+    _wakeup(loop);
+    return EV_OK;
+}
+
+static int _post_act(struct evloop* loop, struct ev* ev, int action)
+{
+    struct evact act = {
+        .action = action,
+        .ev     = ev
+    };
+    return _post(loop, &act);
+}
+
 static int _start_ev(struct evloop* loop, struct ev* ev)
 {
     CHECK_IF(loop == NULL, return EV_FAIL, "loop is null");
@@ -280,18 +629,16 @@ static int _start_ev(struct evloop* loop, struct ev* ev)
     CHECK_IF(ev == NULL, return EV_FAIL, "ev is null");
     // CHECK_IF(ev->fd < 0, return EV_FAIL, "ev->fd = %d invalid", ev->fd);
 
-    struct evact* act = calloc(sizeof(struct evact), 1);
-    act->ev     = ev;
-    act->action = EV_ACT_START;
-
-    fqueue_push(loop->act_queue, act);
-
-    eventfd_t val = loop->qfd;
-    eventfd_write(loop->qfd, val);
-    return EV_OK;
+    if (_is_loop_thread(loop))
+    {
+        struct evact act = {.action = EV_ACT_START, .ev = ev};
+        _apply_act(loop, &act);
+        return EV_OK;
+    }
+    return _post_act(loop, ev, EV_ACT_START);
 }
 
-static _stop_ev(struct evloop* loop, struct ev* ev)
+static void _stop_ev(struct evloop* loop, struct ev* ev)
 {
     CHECK_IF(loop == NULL, return, "loop is null");
     CHECK_IF(loop->state < EV_ST_INIT, return, "loop is not init yet");
@@ -299,14 +646,13 @@ static _stop_ev(struct evloop* loop, struct ev* ev)
     CHECK_IF(ev == NULL, return, "ev is null");
     CHECK_IF(ev->fd < 0, return, "ev->fd = %d invalid", ev->fd);
 
-    struct evact* act = calloc(sizeof(struct evact), 1);
-    act->ev     = ev;
-    act->action = EV_ACT_STOP;
-
-    fqueue_push(loop->act_queue, act);
-
-    eventfd_t val = 1;
-    eventfd_write(loop->qfd, val);
+    if (_is_loop_thread(loop))
+    {
+        struct evact act = {.action = EV_ACT_STOP, .ev = ev};
+        _apply_act(loop, &act);
+        return;
+    }
+    _post_act(loop, ev, EV_ACT_STOP);
     return;
 }
 
@@ -315,6 +661,29 @@ int evio_start(struct evloop* loop, struct ev* ev)
     return _start_ev(loop, ev);
 }
 
+int evio_modify(struct evloop* loop, struct ev* ev, int events)
+{
+    CHECK_IF(loop == NULL, return EV_FAIL, "loop is null");
+    CHECK_IF(loop->state < EV_ST_INIT, return EV_FAIL, "loop is not init yet");
+    CHECK_IF(ev == NULL, return EV_FAIL, "ev is null");
+    CHECK_IF(ev->type != EV_IO, return EV_FAIL, "ev is not an io watcher");
+    CHECK_IF((events & (EVIO_READ | EVIO_WRITE)) == 0, return EV_FAIL, "events = 0x%x has no read or write", events);
+    CHECK_IF((ev->events | events) & EVIO_EXCLUSIVE, return EV_FAIL, "exclusive watcher can not be modified");
+
+    struct evact act = {
+        .action = EV_ACT_MODIFY,
+        .ev     = ev,
+        .events = events
+    };
+
+    if (_is_loop_thread(loop))
+    {
+        _apply_act(loop, &act);
+        return EV_OK;
+    }
+    return _post(loop, &act);
+}
+
 void evio_stop(struct evloop* loop, struct ev* ev)
 {
     _stop_ev(loop, ev);
@@ -362,27 +731,251 @@ int evtm_init(struct ev* ev, int time_ms, int interval_ms, void (*callback)(stru
 
 int evtm_start(struct evloop* loop, struct ev* ev)
 {
-    return _start_ev(loop, ev);
+    CHECK_IF(loop == NULL, return EV_FAIL, "loop is null");
+    CHECK_IF(loop->state < EV_ST_INIT, return EV_FAIL, "loop is not init yet");
+    CHECK_IF(ev == NULL, return EV_FAIL, "ev is null");
+    CHECK_IF(ev->type != EV_TIMER, return EV_FAIL, "ev is not a timer");
+
+    if (_is_loop_thread(loop))
+    {
+        _tm_add(loop, ev, (ev->time_ms > 0) ? ev->time_ms : ev->interval_ms);
+        return EV_OK;
+    }
+    return _post_act(loop, ev, EV_ACT_START);
 }
 
 void evtm_stop(struct evloop* loop, struct ev* ev)
 {
-    _stop_ev(loop, ev);
+    CHECK_IF(loop == NULL, return, "loop is null");
+    CHECK_IF(loop->state < EV_ST_INIT, return, "loop is not init yet");
+    CHECK_IF(ev == NULL, return, "ev is null");
+    CHECK_IF(ev->type != EV_TIMER, return, "ev is not a timer");
+
+    if (_is_loop_thread(loop))
+    {
+        _tm_del(loop, ev);
+        return;
+    }
+    _post_act(loop, ev, EV_ACT_STOP);
+}
+
+int evtm_again(struct evloop* loop, struct ev* ev)
+{
+    CHECK_IF(loop == NULL, return EV_FAIL, "loop is null");
+    CHECK_IF(loop->state < EV_ST_INIT, return EV_FAIL, "loop is not init yet");
+    CHECK_IF(ev == NULL, return EV_FAIL, "ev is null");
+    CHECK_IF(ev->type != EV_TIMER, return EV_FAIL, "ev is not a timer");
+
+    if (_is_loop_thread(loop))
+    {
+        _tm_add(loop, ev, (ev->interval_ms > 0) ? ev->interval_ms : ev->time_ms);
+        return EV_OK;
+    }
+    return _post_act(loop, ev, EV_ACT_AGAIN);
 }
 
 int ev_send(struct evloop* loop, void (*callback)(struct evloop*, struct ev*, void*), void* arg)
 {
     CHECK_IF(loop == NULL, return EV_FAIL, "loop is null");
+    CHECK_IF(loop->state < EV_ST_INIT, return EV_FAIL, "loop is not init yet");
     CHECK_IF(callback == NULL, return EV_FAIL, "callback is null");
 
-    struct ev* ev = calloc(sizeof(struct ev), 1);
-    ev->fd          = -1;
-    ev->type        = EV_PURE;
-    ev->arg         = arg;
-    ev->callback    = callback;
+    struct evact act = {
+        .action   = EV_ACT_START,
+        .callback = callback,
+        .arg      = arg
+    };
+    return _post(loop, &act);
+}
+
+static void* _evgroup_routine(void* input)
+{
+    struct evloop* loop = (struct evloop*)input;
+    evloop_run(loop);
+    __atomic_store_n(&loop->is_exited, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int evgroup_init(struct evgroup* group, int loop_num, int max_ev_num, int dist)
+{
+    CHECK_IF(group == NULL, return EV_FAIL, "group is null");
+    CHECK_IF(max_ev_num <= 0, return EV_FAIL, "max_ev_num = %d invalid", max_ev_num);
+    CHECK_IF((dist != EVGROUP_DIST_ROUNDROBIN) && (dist != EVGROUP_DIST_FDHASH), return EV_FAIL, "dist = %d invalid", dist);
+
+    memset(group, 0, sizeof(struct evgroup));
+
+    if (loop_num <= 0) loop_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (loop_num <= 0) loop_num = 1;
+
+    group->loops = calloc(sizeof(struct evloop), loop_num);
+    CHECK_IF(group->loops == NULL, goto _ERROR, "calloc failed");
+
+    group->tids = calloc(sizeof(pthread_t), loop_num);
+    CHECK_IF(group->tids == NULL, goto _ERROR, "calloc failed");
+
+    int i, chk;
+    for (i=0; i<loop_num; i++)
+    {
+        chk = evloop_init(&group->loops[i], max_ev_num);
+        CHECK_IF(chk != EV_OK, goto _ERROR, "evloop_init loops[%d] failed", i);
+        group->loop_num++;
+    }
+    group->dist = dist;
+    return EV_OK;
+
+_ERROR:
+    evgroup_uninit(group);
+    return EV_FAIL;
+}
+
+void evgroup_uninit(struct evgroup* group)
+{
+    CHECK_IF(group == NULL, return, "group is null");
+
+    if (group->is_running) evgroup_break(group);
+
+    int i;
+    for (i=0; i<group->loop_num; i++)
+    {
+        evloop_uninit(&group->loops[i]);
+    }
+    if (group->loops) free(group->loops);
+    if (group->tids) free(group->tids);
+    memset(group, 0, sizeof(struct evgroup));
+}
+
+int evgroup_run(struct evgroup* group)
+{
+    CHECK_IF(group == NULL, return EV_FAIL, "group is null");
+    CHECK_IF(group->loop_num <= 0, return EV_FAIL, "group is not init yet");
+    CHECK_IF(group->is_running, return EV_FAIL, "group is already running");
+
+    int cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    int i, chk;
+    for (i=0; i<group->loop_num; i++)
+    {
+        group->loops[i].is_exited = 0;
+        chk = pthread_create(&group->tids[i], NULL, _evgroup_routine, &group->loops[i]);
+        CHECK_IF(chk != 0, goto _ERROR, "pthread_create loops[%d] failed", i);
+
+        if (cpu_num > 0)
+        {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(i % cpu_num, &cpuset);
+            pthread_setaffinity_np(group->tids[i], sizeof(cpu_set_t), &cpuset);
+        }
+    }
+    group->is_running = 1;
+    return EV_OK;
+
+_ERROR:
+    while (--i >= 0)
+    {
+        evloop_break(&group->loops[i]);
+        pthread_join(group->tids[i], NULL);
+    }
+    return EV_FAIL;
+}
+
+void evgroup_break(struct evgroup* group)
+{
+    CHECK_IF(group == NULL, return, "group is null");
+    CHECK_IF(group->is_running == 0, return, "group is not running");
+
+    int i;
+    for (i=0; i<group->loop_num; i++)
+    {
+        // the loop thread may not have entered evloop_run yet, or already left it
+        while ((__atomic_load_n(&group->loops[i].state, __ATOMIC_ACQUIRE) == EV_ST_INIT) &&
+               (__atomic_load_n(&group->loops[i].is_exited, __ATOMIC_ACQUIRE) == 0))
+        {
+            sched_yield();
+        }
+        evloop_break(&group->loops[i]);
+    }
+    for (i=0; i<group->loop_num; i++)
+    {
+        pthread_join(group->tids[i], NULL);
+    }
+    group->is_running = 0;
+}
+
+struct evloop* evgroup_loop(struct evgroup* group, int idx)
+{
+    CHECK_IF(group == NULL, return NULL, "group is null");
+    CHECK_IF((idx < 0) || (idx >= group->loop_num), return NULL, "idx = %d invalid", idx);
+    return &group->loops[idx];
+}
+
+static int _evgroup_least_loaded(struct evgroup* group)
+{
+    int start = __sync_fetch_and_add(&group->next, 1) % group->loop_num;
+    int best  = start;
+    unsigned long load, best_load = (unsigned long)-1;
+    int i, idx;
+    for (i=0; i<group->loop_num; i++)
+    {
+        idx  = (start + i) % group->loop_num;
+        load = __atomic_load_n(&group->loops[idx].act_tail, __ATOMIC_RELAXED) -
+               __atomic_load_n(&group->loops[idx].act_head, __ATOMIC_RELAXED);
+        if (load < best_load)
+        {
+            best      = idx;
+            best_load = load;
+            if (load == 0) break;
+        }
+    }
+    return best;
+}
+
+struct evloop* evgroup_pick(struct evgroup* group, int fd)
+{
+    CHECK_IF(group == NULL, return NULL, "group is null");
+    CHECK_IF(group->loop_num <= 0, return NULL, "group is not init yet");
+
+    unsigned int idx;
+    if ((group->dist == EVGROUP_DIST_FDHASH) && (fd >= 0))
+    {
+        idx = ((unsigned int)fd * 2654435761u) % group->loop_num;
+    }
+    else
+    {
+        idx = __sync_fetch_and_add(&group->next, 1) % group->loop_num;
+    }
+    return &group->loops[idx];
+}
+
+int evgroup_io_start(struct evgroup* group, struct ev* ev)
+{
+    CHECK_IF(group == NULL, return EV_FAIL, "group is null");
+    CHECK_IF(ev == NULL, return EV_FAIL, "ev is null");
+    CHECK_IF(ev->type != EV_IO, return EV_FAIL, "ev is not an io watcher");
+
+    struct evloop* loop = evgroup_pick(group, ev->fd);
+    CHECK_IF(loop == NULL, return EV_FAIL, "evgroup_pick failed");
+
+    ev->loop = loop;
+    return evio_start(loop, ev);
+}
+
+void evgroup_io_stop(struct evgroup* group, struct ev* ev)
+{
+    CHECK_IF(group == NULL, return, "group is null");
+    CHECK_IF(ev == NULL, return, "ev is null");
+    CHECK_IF(ev->loop == NULL, return, "ev is not started by group");
+
+    evio_stop(ev->loop, ev);
+    ev->loop = NULL;
+}
+
+int evgroup_send(struct evgroup* group, int idx, void (*callback)(struct evloop*, struct ev*, void*), void* arg)
+{
+    CHECK_IF(group == NULL, return EV_FAIL, "group is null");
+    CHECK_IF(group->loop_num <= 0, return EV_FAIL, "group is not init yet");
+    CHECK_IF(idx >= group->loop_num, return EV_FAIL, "idx = %d invalid", idx);
 
-    int chk = _start_ev(loop, ev);
-    if (chk != EV_OK) free(ev);
+    if (idx < 0) idx = _evgroup_least_loaded(group);
 
-    return chk;
+    return ev_send(&group->loops[idx], callback, arg);
 }
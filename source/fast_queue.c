@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <semaphore.h>
 
 #include "fast_queue.h"
 
 #define DEFAULT_DEPTH  (16)
+#define CACHELINE_SIZE (64)
 
 #define atom_spinlock(ptr) while (__sync_lock_test_and_set(ptr,1)) {}
 #define atom_spinunlock(ptr) __sync_lock_release(ptr)
@@ -22,6 +24,12 @@
     }\
 }
 
+struct fqueue_cell
+{
+    unsigned long seq;
+    void* data;
+};
+
 struct fqueue
 {
     int num;
@@ -32,26 +40,162 @@ struct fqueue
     void** data;
 
     void (*cleanfn)(void* ud);
+
+    int flag;
+
+    // FQUEUE_FLAG_LOCKFREE, producers and consumers on their own cache lines
+    struct fqueue_cell* cells;
+    unsigned long mask;
+
+    unsigned long enq_pos __attribute__((aligned(CACHELINE_SIZE)));
+    unsigned long deq_pos __attribute__((aligned(CACHELINE_SIZE)));
 };
 
-struct fqueue* fqueue_create(void (*cleanfn)(void* ud))
+static struct fqueue* _create_lockfree(struct fqueue* fq, int depth)
+{
+    unsigned long num = 2;
+    while (num < (unsigned long)depth)
+    {
+        num *= 2;
+    }
+
+    fq->cells = calloc(sizeof(struct fqueue_cell), num);
+    CHECK_IF(fq->cells == NULL, goto _ERROR, "calloc failed");
+
+    unsigned long i;
+    for (i=0; i<num; i++)
+    {
+        fq->cells[i].seq = i;
+    }
+    fq->mask    = num - 1;
+    fq->enq_pos = 0;
+    fq->deq_pos = 0;
+    return fq;
+
+_ERROR:
+    free(fq);
+    return NULL;
+}
+
+struct fqueue* fqueue_create_ex(void (*cleanfn)(void* ud), int flag, int depth)
 {
-    struct fqueue* fq = calloc(sizeof(struct fqueue), 1);
-    CHECK_IF(fq == NULL, return NULL, "callc failed");
+    CHECK_IF(depth <= 0, return NULL, "depth = %d invalid", depth);
+
+    struct fqueue* fq = NULL;
+    int chk = posix_memalign((void**)&fq, CACHELINE_SIZE, sizeof(struct fqueue));
+    CHECK_IF(chk != 0, return NULL, "posix_memalign failed");
+
+    memset(fq, 0, sizeof(struct fqueue));
+    fq->flag    = flag;
+    fq->cleanfn = cleanfn;
+
+    if (flag & FQUEUE_FLAG_LOCKFREE)
+    {
+        return _create_lockfree(fq, depth);
+    }
 
     fq->lock    = 0;
-    fq->num     = DEFAULT_DEPTH;
+    fq->num     = depth;
     fq->head    = 0;
     fq->tail    = 0;
     fq->data    = calloc(sizeof(void*), fq->num);
-    fq->cleanfn = cleanfn;
+    CHECK_IF(fq->data == NULL, goto _ERROR, "calloc failed");
     return fq;
+
+_ERROR:
+    free(fq);
+    return NULL;
+}
+
+struct fqueue* fqueue_create(void (*cleanfn)(void* ud))
+{
+    return fqueue_create_ex(cleanfn, 0, DEFAULT_DEPTH);
+}
+
+static int _push_lockfree(struct fqueue* fq, void* ud)
+{
+    struct fqueue_cell* cell;
+    unsigned long pos = __atomic_load_n(&fq->enq_pos, __ATOMIC_RELAXED);
+    unsigned long seq;
+    long diff;
+    while (1)
+    {
+        cell = &fq->cells[pos & fq->mask];
+        seq  = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (long)seq - (long)pos;
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&fq->enq_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return FQUEUE_FAIL; // FULL
+        }
+        else
+        {
+            pos = __atomic_load_n(&fq->enq_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = ud;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return FQUEUE_OK;
+}
+
+static void* _pop_lockfree(struct fqueue* fq)
+{
+    struct fqueue_cell* cell;
+    unsigned long pos = __atomic_load_n(&fq->deq_pos, __ATOMIC_RELAXED);
+    unsigned long seq;
+    long diff;
+    while (1)
+    {
+        cell = &fq->cells[pos & fq->mask];
+        seq  = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (long)seq - (long)(pos + 1);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&fq->deq_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return NULL; // EMPTY
+        }
+        else
+        {
+            pos = __atomic_load_n(&fq->deq_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    void* ret = cell->data;
+    __atomic_store_n(&cell->seq, pos + fq->mask + 1, __ATOMIC_RELEASE);
+    return ret;
 }
 
 void fqueue_release(struct fqueue* fq)
 {
     CHECK_IF(fq == NULL, return, "fq is null");
 
+    if (fq->flag & FQUEUE_FLAG_LOCKFREE)
+    {
+        void* ud;
+        while ((ud = _pop_lockfree(fq)) != NULL)
+        {
+            if (fq->cleanfn) fq->cleanfn(ud);
+        }
+        free(fq->cells);
+        free(fq);
+        return;
+    }
+
     LOCK(fq);
     {
         if (fq->cleanfn)
@@ -101,6 +245,8 @@ int fqueue_push(struct fqueue* fq, void* ud)
     CHECK_IF(fq == NULL, return FQUEUE_FAIL, "fq is null");
     CHECK_IF(ud == NULL, return FQUEUE_FAIL, "ud is null");
 
+    if (fq->flag & FQUEUE_FLAG_LOCKFREE) return _push_lockfree(fq, ud);
+
     LOCK(fq);
     {
         int tail = fq->tail;
@@ -128,11 +274,19 @@ void* fqueue_pop(struct fqueue* fq)
 {
     CHECK_IF(fq == NULL, return NULL, "fq is null");
 
+    if (fq->flag & FQUEUE_FLAG_LOCKFREE) return _pop_lockfree(fq);
+
     if (fq->head == fq->tail) return NULL; // EMPTY
 
     void* ret;
     LOCK(fq);
     {
+        if (fq->head == fq->tail) // another consumer took it
+        {
+            UNLOCK(fq);
+            return NULL;
+        }
+
         ret = fq->data[fq->head];
         fq->head++;
         if (fq->head == fq->num)
@@ -147,5 +301,11 @@ void* fqueue_pop(struct fqueue* fq)
 int fqueue_empty(struct fqueue* fq)
 {
     CHECK_IF(fq == NULL, return 1, "fq is null");
+
+    if (fq->flag & FQUEUE_FLAG_LOCKFREE)
+    {
+        return (__atomic_load_n(&fq->deq_pos, __ATOMIC_ACQUIRE) ==
+                __atomic_load_n(&fq->enq_pos, __ATOMIC_ACQUIRE));
+    }
     return (fq->head == fq->tail);
 }
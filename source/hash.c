@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #include "hash.h"
 
@@ -13,96 +14,234 @@
     }\
 }
 
-static int _findkey(void* data, void* arg)
+#define HASH_MIN_SLOTS (8)
+#define HASH_REHASH_STEP (16)
+
+static unsigned int _hashfn(char* key)
 {
-    CHECK_IF(data == NULL, return 0, "data is null");
-    CHECK_IF(arg == NULL, return 0, "arg is null");
-    return (strcmp((char*)data, (char*)arg) == 0) ? 1 : 0;
+    unsigned int hv = 2166136261u;
+    unsigned char* p;
+    for (p = (unsigned char*)key; *p; p++)
+    {
+        hv ^= *p;
+        hv *= 16777619u;
+    }
+    hv ^= hv >> 16;
+    hv *= 0x85ebca6bu;
+    hv ^= hv >> 13;
+    hv *= 0xc2b2ae35u;
+    hv ^= hv >> 16;
+    return hv;
 }
 
-static int _hcreate(struct hsearch_data* hdata, int max_num)
+static int _index_create(struct hash_index* idx, unsigned int slot_num)
 {
-    CHECK_IF(hdata == NULL, return HASH_FAIL, "hdata is null");
-    CHECK_IF(max_num <= 0, return HASH_FAIL, "max_num = %d invalid", max_num);
+    CHECK_IF(idx == NULL, return HASH_FAIL, "idx is null");
 
-    int chk = hcreate_r(max_num, hdata);
-    CHECK_IF(chk == 0, return HASH_FAIL, "hcreate_r failed");
+    idx->slots = malloc(sizeof(struct hash_slot) * slot_num);
+    CHECK_IF(idx->slots == NULL, return HASH_FAIL, "malloc failed");
+
+    memset(idx->slots, 0xff, sizeof(struct hash_slot) * slot_num);
+    idx->mask = slot_num - 1;
     return HASH_OK;
 }
 
-static void _hdestroy(struct hsearch_data* hdata)
+static void _index_destroy(struct hash_index* idx)
 {
-    CHECK_IF(hdata == NULL, return, "hdata is null");
-    hdestroy_r(hdata);
+    if (idx->slots) free(idx->slots);
+    idx->slots = NULL;
+    idx->mask  = 0;
 }
 
-static int _hadd(struct hsearch_data* hdata, char* key, void* value)
+static inline unsigned int _index_dist(struct hash_index* idx, unsigned int pos, unsigned int hashv)
 {
-    CHECK_IF(hdata == NULL, return HASH_FAIL, "hdata is null");
-    CHECK_IF(key == NULL, return HASH_FAIL, "key is null");
-    CHECK_IF(value == NULL, return HASH_FAIL, "value is null");
+    return (pos - hashv) & idx->mask;
+}
+
+static int _index_find(struct hash* h, struct hash_index* idx, char* key, unsigned int hashv)
+{
+    if (idx->slots == NULL) return -1;
+
+    unsigned int pos  = hashv & idx->mask;
+    unsigned int dist = 0;
+    struct hash_slot* slot;
+    while (1)
+    {
+        slot = &(idx->slots[pos]);
+        if (slot->index < 0) return -1;
+        if (_index_dist(idx, pos, slot->hashv) < dist) return -1;
+
+        if ((slot->hashv == hashv) && (strcmp(h->entries[slot->index].key, key) == 0))
+        {
+            return (int)pos;
+        }
+        pos = (pos + 1) & idx->mask;
+        dist++;
+    }
+}
+
+static void _index_insert(struct hash_index* idx, unsigned int hashv, int index)
+{
+    struct hash_slot cur = {.hashv = hashv, .index = index};
+    struct hash_slot tmp;
+    unsigned int pos  = hashv & idx->mask;
+    unsigned int dist = 0;
+    unsigned int slot_dist;
+    while (1)
+    {
+        if (idx->slots[pos].index < 0)
+        {
+            idx->slots[pos] = cur;
+            return;
+        }
 
-    ENTRY item = {
-        .key = key,
-        .data = value
-    };
-    ENTRY *pitem = NULL;
-    int chk = hsearch_r(item, ENTER, &pitem, hdata);
-    CHECK_IF(chk == 0, return HASH_FAIL, "hsearch_r ENTER failed");
+        slot_dist = _index_dist(idx, pos, idx->slots[pos].hashv);
+        if (slot_dist < dist)
+        {
+            tmp = idx->slots[pos];
+            idx->slots[pos] = cur;
+            cur  = tmp;
+            dist = slot_dist;
+        }
+        pos = (pos + 1) & idx->mask;
+        dist++;
+    }
+}
 
-    pitem->data = value;
+static void _index_remove(struct hash_index* idx, unsigned int pos)
+{
+    unsigned int next;
+    while (1)
+    {
+        next = (pos + 1) & idx->mask;
+        if (idx->slots[next].index < 0) break;
+        if (_index_dist(idx, next, idx->slots[next].hashv) == 0) break;
+
+        idx->slots[pos] = idx->slots[next];
+        pos = next;
+    }
+    idx->slots[pos].index = -1;
+}
+
+static inline int _is_rehashing(struct hash* h)
+{
+    return (h->old_index.slots != NULL) ? 1 : 0;
+}
+
+static void _rehash_step(struct hash* h, int step)
+{
+    struct hash_entry* entry;
+    while (_is_rehashing(h) && (step-- > 0))
+    {
+        if (h->rehash_pos >= h->rehash_end)
+        {
+            _index_destroy(&(h->old_index));
+            break;
+        }
+
+        entry = &(h->entries[h->rehash_pos]);
+        if (entry->key)
+        {
+            _index_insert(&(h->index), entry->hashv, h->rehash_pos);
+        }
+        h->rehash_pos++;
+    }
+}
+
+static int _rehash_start(struct hash* h)
+{
+    _rehash_step(h, INT_MAX);
+
+    struct hash_index newidx = {};
+    int chk = _index_create(&newidx, (h->index.mask + 1) * 2);
+    CHECK_IF(chk != HASH_OK, return HASH_FAIL, "_index_create failed");
+
+    h->old_index  = h->index;
+    h->index      = newidx;
+    h->rehash_pos = 0;
+    h->rehash_end = h->entry_num;
     return HASH_OK;
 }
 
-static int _hdelete(struct hsearch_data* hdata, char* key)
+static void _compact(struct hash* h)
 {
-    CHECK_IF(hdata == NULL, return HASH_FAIL, "hdata is null");
-    CHECK_IF(key == NULL, return HASH_FAIL, "key is null");
+    _rehash_step(h, INT_MAX);
 
-    ENTRY item = {
-        .key = key
-    };
-    ENTRY *pitem = NULL;
-    int chk = hsearch_r(item, FIND, &pitem, hdata);
-    CHECK_IF(chk == 0, return HASH_FAIL, "hsearch_r FIND failed");
+    int i, j = 0;
+    for (i = 0; i < h->entry_num; i++)
+    {
+        if (h->entries[i].key == NULL) continue;
+        h->entries[j++] = h->entries[i];
+    }
+    h->entry_num = j;
+
+    memset(h->index.slots, 0xff, sizeof(struct hash_slot) * (h->index.mask + 1));
+    for (i = 0; i < h->entry_num; i++)
+    {
+        _index_insert(&(h->index), h->entries[i].hashv, i);
+    }
+}
 
-    pitem->data = NULL;
+static int _reserve_entry(struct hash* h)
+{
+    if (h->entry_num < h->entry_max) return HASH_OK;
+
+    // more than half of the dense array are holes, squeeze them out instead of growing
+    if ((h->num < h->entry_num) && ((h->entry_num - h->num) >= (h->entry_max / 2)))
+    {
+        _compact(h);
+        return HASH_OK;
+    }
+
+    int newmax = h->entry_max * 2;
+    struct hash_entry* newentries = realloc(h->entries, sizeof(struct hash_entry) * newmax);
+    CHECK_IF(newentries == NULL, return HASH_FAIL, "realloc failed");
+
+    h->entries   = newentries;
+    h->entry_max = newmax;
     return HASH_OK;
 }
 
-static void* _hfind(struct hsearch_data* hdata, char* key)
+static int _find_entry(struct hash* h, char* key, unsigned int hashv)
 {
-    CHECK_IF(hdata == NULL, return NULL, "hdata is null");
-    CHECK_IF(key == NULL, return NULL, "key is null");
+    int pos = _index_find(h, &(h->index), key, hashv);
+    if (pos >= 0) return h->index.slots[pos].index;
 
-    ENTRY item = {
-        .key = key
-    };
-    ENTRY *pitem = NULL;
-    int chk = hsearch_r(item, FIND, &pitem, hdata);
-    if (chk == 0) return NULL;
-    if (pitem == NULL) return NULL;
+    pos = _index_find(h, &(h->old_index), key, hashv);
+    if (pos >= 0) return h->old_index.slots[pos].index;
 
-    return pitem->data;
+    return -1;
 }
 
 int hash_init(struct hash* h, int max_num, void (*cleanfn)(void*))
 {
     CHECK_IF(h == NULL, return HASH_FAIL, "h is null");
+    CHECK_IF(max_num <= 0, return HASH_FAIL, "max_num = %d invalid", max_num);
 
     memset(h, 0, sizeof(struct hash));
 
-    int chk = list_init(&(h->keys), free);
-    CHECK_IF(chk != LIST_OK, return HASH_FAIL, "list_init failed");
-
     h->max_num = max_num;
     h->cleanfn = cleanfn;
 
-    chk = _hcreate(&(h->hdata), max_num);
-    CHECK_IF(chk != HASH_OK, return HASH_FAIL, "_hcreate failed");
+    unsigned int slot_num = HASH_MIN_SLOTS;
+    while (slot_num * 3 / 4 < (unsigned int)max_num)
+    {
+        slot_num *= 2;
+    }
+
+    int chk = _index_create(&(h->index), slot_num);
+    CHECK_IF(chk != HASH_OK, return HASH_FAIL, "_index_create failed");
 
+    h->entries = calloc(sizeof(struct hash_entry), max_num);
+    CHECK_IF(h->entries == NULL, goto _ERROR, "calloc failed");
+
+    h->entry_max = max_num;
     h->is_init = 1;
     return HASH_OK;
+
+_ERROR:
+    _index_destroy(&(h->index));
+    return HASH_FAIL;
 }
 
 int hash_uninit(struct hash* h)
@@ -110,17 +249,19 @@ int hash_uninit(struct hash* h)
     CHECK_IF(h == NULL, return HASH_FAIL, "h is null");
     CHECK_IF(h->is_init != 1, return HASH_FAIL, "h is not init yet");
 
-    if (h->cleanfn)
+    int i;
+    for (i = 0; i < h->entry_num; i++)
     {
-        char* key;
-        void* value;
-        HASH_FOREACH(h, key, value)
-        {
-            h->cleanfn(value);
-        }
+        if (h->entries[i].key == NULL) continue;
+
+        if (h->cleanfn) h->cleanfn(h->entries[i].value);
+        free(h->entries[i].key);
     }
-    list_clean(&(h->keys));
-    _hdestroy(&(h->hdata));
+    free(h->entries);
+    _index_destroy(&(h->index));
+    _index_destroy(&(h->old_index));
+
+    h->is_init = 0;
     return HASH_OK;
 }
 
@@ -130,27 +271,34 @@ int hash_add(struct hash *h, char* key, void* value)
     CHECK_IF(key == NULL, return HASH_FAIL, "key is null");
     CHECK_IF(value == NULL, return HASH_FAIL, "value is null");
     CHECK_IF(h->is_init != 1, return HASH_FAIL, "h is not init yet");
-    CHECK_IF(h->max_num <= list_num(&h->keys), return HASH_FAIL, "h is full");
 
-    int contain = hash_contains(h, key);
-    CHECK_IF(contain, return HASH_FAIL, "key = %s is already added", key);
+    unsigned int hashv = _hashfn(key);
+    CHECK_IF(_find_entry(h, key, hashv) >= 0, return HASH_FAIL, "key = %s is already added", key);
 
-    int chk = _hadd(&(h->hdata), key, value);
-    CHECK_IF(chk != HASH_OK, return HASH_FAIL, "_hadd failed");
+    _rehash_step(h, HASH_REHASH_STEP);
 
-    char* newkey = strdup(key);
-    CHECK_IF(newkey == NULL, goto _ERROR, "strdup failed");
+    int chk;
+    if ((unsigned int)(h->num + 1) > (h->index.mask + 1) * 3 / 4)
+    {
+        chk = _rehash_start(h);
+        CHECK_IF(chk != HASH_OK, return HASH_FAIL, "_rehash_start failed");
+    }
 
-    chk = list_append(&(h->keys), newkey);
-    CHECK_IF(chk != LIST_OK, goto _ERROR, "list_append failed");
+    chk = _reserve_entry(h);
+    CHECK_IF(chk != HASH_OK, return HASH_FAIL, "_reserve_entry failed");
 
-    return HASH_OK;
+    char* newkey = strdup(key);
+    CHECK_IF(newkey == NULL, return HASH_FAIL, "strdup failed");
 
-_ERROR:
-    if (newkey) free(newkey);
+    struct hash_entry* entry = &(h->entries[h->entry_num]);
+    entry->key   = newkey;
+    entry->value = value;
+    entry->hashv = hashv;
 
-    _hdelete(&(h->hdata), key);
-    return HASH_FAIL;
+    _index_insert(&(h->index), hashv, h->entry_num);
+    h->entry_num++;
+    h->num++;
+    return HASH_OK;
 }
 
 int hash_modify(struct hash* h, char* key, void* value)
@@ -160,9 +308,11 @@ int hash_modify(struct hash* h, char* key, void* value)
     CHECK_IF(value == NULL, return HASH_FAIL, "value is null");
     CHECK_IF(h->is_init != 1, return HASH_FAIL, "h is not init yet");
 
-    int contain = hash_contains(h, key);
-    CHECK_IF(contain == 0, return HASH_FAIL, "key = %s not exist in table", key);
-    return _hadd(&(h->hdata), key, value);
+    int index = _find_entry(h, key, _hashfn(key));
+    CHECK_IF(index < 0, return HASH_FAIL, "key = %s not exist in table", key);
+
+    h->entries[index].value = value;
+    return HASH_OK;
 }
 
 int hash_del(struct hash* h, char* key, void** pvalue)
@@ -172,15 +322,40 @@ int hash_del(struct hash* h, char* key, void** pvalue)
     CHECK_IF(pvalue == NULL, return HASH_FAIL, "pvalue is null");
     CHECK_IF(h->is_init != 1, return HASH_FAIL, "h is not init yet");
 
-    char* newkey = list_find(&(h->keys), _findkey, key);
-    CHECK_IF(newkey == NULL, return HASH_FAIL, "key = %s not exist in keys list", key);
+    unsigned int hashv = _hashfn(key);
+    int index = -1;
+
+    // an entry may sit in both indexes while rehashing
+    int pos = _index_find(h, &(h->index), key, hashv);
+    if (pos >= 0)
+    {
+        index = h->index.slots[pos].index;
+        _index_remove(&(h->index), pos);
+    }
+
+    pos = _index_find(h, &(h->old_index), key, hashv);
+    if (pos >= 0)
+    {
+        index = h->old_index.slots[pos].index;
+        _index_remove(&(h->old_index), pos);
+    }
+
+    CHECK_IF(index < 0, return HASH_FAIL, "key = %s not exist in table", key);
 
-    list_remove(&(h->keys), newkey);
-    free(newkey);
+    struct hash_entry* entry = &(h->entries[index]);
+    *pvalue = entry->value;
+    free(entry->key);
+    entry->key   = NULL;
+    entry->value = NULL;
+    h->num--;
 
-    *pvalue = _hfind(&(h->hdata), key);
-    CHECK_IF(*pvalue == NULL, return HASH_FAIL, "key = %s not exist in table", key);
-    return _hdelete(&(h->hdata), key);
+    if ((index == h->entry_num - 1) && ((_is_rehashing(h) == 0) || (index >= h->rehash_end)))
+    {
+        h->entry_num--;
+    }
+
+    _rehash_step(h, HASH_REHASH_STEP);
+    return HASH_OK;
 }
 
 void* hash_find(struct hash *h, char* key)
@@ -191,7 +366,8 @@ void* hash_find(struct hash *h, char* key)
 
     if (key == NULL) return NULL;
 
-    return _hfind(&(h->hdata), key);
+    int index = _find_entry(h, key, _hashfn(key));
+    return (index >= 0) ? h->entries[index].value : NULL;
 }
 
 int   hash_contains(struct hash *h, char* key)
@@ -199,14 +375,35 @@ int   hash_contains(struct hash *h, char* key)
     CHECK_IF(h == NULL, return 0, "h is null");
     CHECK_IF(key == NULL, return 0, "key is null");
     CHECK_IF(h->is_init != 1, return 0, "h is not init yet");
-    return (NULL != _hfind(&(h->hdata), key)) ? 1 : 0;
+    return (_find_entry(h, key, _hashfn(key)) >= 0) ? 1 : 0;
+}
+
+int hash_num(struct hash* h)
+{
+    CHECK_IF(h == NULL, return 0, "h is null");
+    CHECK_IF(h->is_init != 1, return 0, "h is not init yet");
+    return h->num;
+}
+
+int hash_iter_next(struct hash* h, int pos)
+{
+    CHECK_IF(h == NULL, return -1, "h is null");
+    CHECK_IF(h->is_init != 1, return -1, "h is not init yet");
+
+    for (pos = pos + 1; pos < h->entry_num; pos++)
+    {
+        if (h->entries[pos].key) return pos;
+    }
+    return -1;
 }
 
 char* hash_first_key(struct hash* h)
 {
     CHECK_IF(h == NULL, return 0, "h is null");
     CHECK_IF(h->is_init != 1, return 0, "h is not init yet");
-    return list_head(&(h->keys));
+
+    int pos = hash_iter_next(h, -1);
+    return (pos >= 0) ? h->entries[pos].key : NULL;
 }
 
 char* hash_next_key(struct hash* h, char* newkey)
@@ -214,5 +411,10 @@ char* hash_next_key(struct hash* h, char* newkey)
     CHECK_IF(h == NULL, return 0, "h is null");
     CHECK_IF(newkey == NULL, return 0, "newkey is null");
     CHECK_IF(h->is_init != 1, return 0, "h is not init yet");
-    return list_next(&(h->keys), newkey);
+
+    int index = _find_entry(h, newkey, _hashfn(newkey));
+    CHECK_IF(index < 0, return 0, "key = %s not exist in table", newkey);
+
+    int pos = hash_iter_next(h, index);
+    return (pos >= 0) ? h->entries[pos].key : NULL;
 }
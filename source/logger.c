@@ -2,12 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include "logger.h"
-#include "queue.h"
 
 #define derror(a, b...) fprintf(stderr, "[ERROR] %s(): "a"\n", __func__, ##b)
 #define CHECK_IF(assertion, error_action, ...)\
@@ -19,22 +29,821 @@
     }\
 }
 
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_REC_ARGS  (LOG_REC_SIZE - 2 * sizeof(uint64_t) - 2 * sizeof(short))
+
+#define LOG_ARG_NONE    (0) // %% or an unknown conversion
+#define LOG_ARG_SKIP    (1) // %n and %ls, the pointer is dropped
+#define LOG_ARG_INT     (2)
+#define LOG_ARG_LONG    (3)
+#define LOG_ARG_LLONG   (4)
+#define LOG_ARG_SIZE    (5)
+#define LOG_ARG_INTMAX  (6)
+#define LOG_ARG_PTRDIFF (7)
+#define LOG_ARG_DOUBLE  (8)
+#define LOG_ARG_LDOUBLE (9)
+#define LOG_ARG_STR     (10)
+#define LOG_ARG_PTR     (11)
+
+// arguments are packed in the order of fmt, strings as length + bytes + '\0'
+struct log_rec
+{
+    uint64_t ts; // CLOCK_MONOTONIC ns
+    const char* fmt; // NULL : args holds a logger_enq string, written as is and freed
+    short level;
+    short len;   // bytes used in args
+    unsigned char args[LOG_REC_ARGS];
+};
+
+// a record that found the ring full, spilled records come after everything in the ring
+struct log_spill
+{
+    struct log_spill* next;
+    struct log_rec rec;
+};
+
+// single producer ring of one thread, freed by whoever drops the last ref
+struct log_ring
+{
+    unsigned long tail __attribute__((aligned(64))); // owner thread
+    unsigned long dropped;
+    struct log_spill* spill_tail;
+    unsigned long head __attribute__((aligned(64))); // logger_run
+    unsigned long reported;
+    struct log_spill* spill_head; // the last one taken, or the first stub
+    int refs;    // owner thread and logger
+    int is_dead; // owner thread is gone
+    struct log_ring* next;
+    struct log_rec recs[LOG_RING_SIZE];
+};
+
 struct logger
 {
-    struct queue mq;
+    struct logger_levels levels; // first, log_print reads it inline
+    bool own_level[LOG_MODULES_MAX]; // module level set by logger_set_module_level
     int flag;
     bool running;
-    int level;
 
     struct udp udp;
     struct udp_addr remote;
 
+    union sock_addr remote_addr;
+    struct udp_msg* udp_msgs; // staged datagrams, sent with one sendmmsg
+    char* udp_buf;            // their lines, each with the '\0' receivers always got
+    int udp_num;
+    int udp_len;
+
     int fd;
+    char* path;
+    long file_size;
+    uint64_t opened_ns;
+    long rotate_size;   // 0 : off
+    uint64_t rotate_ns; // 0 : off
+    int rotate_keep;
+
+    int bin_fd;
+    char* bin_map;   // the segment being appended to
+    long bin_seg;
+    long bin_base;   // file offset of bin_map
+    long bin_pos;
+    const char** sites; // format pointers by hash, the call site id is kept next to it
+    uint32_t* site_ids;
+    int site_mask;
+    int site_num;
+
+    unsigned int gen; // tells a new logger from a released one at the same address
+    pthread_mutex_t ring_lock;
+    struct log_ring* rings; // new ones are pushed in front, only logger_run unlinks
+    int sleeping;
+    int64_t wall_offset; // CLOCK_REALTIME - CLOCK_MONOTONIC, ns
+
+    char* batch;
+    int batch_len;
+    uint64_t batch_ns; // when the oldest unflushed line was formatted
 };
 
-static void _clean_msg(void* input)
+// rings of the calling thread, one per logger it writes to
+struct log_tls
+{
+    struct logger* lg;
+    unsigned int gen;
+    struct log_ring* ring;
+    struct log_tls* next;
+};
+
+static __thread struct log_tls* _tls = NULL;
+static pthread_key_t  _tls_key;
+static pthread_once_t _tls_once = PTHREAD_ONCE_INIT;
+static unsigned int   _gen = 0;
+
+// module names are only ever added, an index stays valid for the process
+static pthread_mutex_t _mod_lock = PTHREAD_MUTEX_INITIALIZER;
+static char* _mod_names[LOG_MODULES_MAX];
+static int   _mod_num = 0;
+
+static uint64_t _now_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _futex_wait(void* addr, int val, int timeout_ms)
+{
+    struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+static void _futex_wake(void* addr, int num)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+static void _rec_clean(struct log_rec* rec)
+{
+    char* str;
+    if (rec->fmt) return;
+    memcpy(&str, rec->args, sizeof(str));
+    free(str);
+}
+
+static void _ring_free(struct log_ring* r)
+{
+    unsigned long i;
+    for (i=r->head; i!=r->tail; i++)
+    {
+        _rec_clean(&r->recs[i & LOG_RING_MASK]);
+    }
+
+    struct log_spill* sp = r->spill_head;
+    struct log_spill* next;
+    for (; sp; sp = next)
+    {
+        next = sp->next;
+        if (sp != r->spill_head) _rec_clean(&sp->rec);
+        free(sp);
+    }
+    free(r);
+}
+
+static void _ring_put(struct log_ring* r)
+{
+    if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) _ring_free(r);
+}
+
+static void _tls_exit(void* arg)
+{
+    struct log_tls* t = _tls;
+    struct log_tls* next;
+    for (; t; t = next)
+    {
+        next = t->next;
+        if (t->ring)
+        {
+            __atomic_store_n(&t->ring->is_dead, 1, __ATOMIC_RELEASE);
+            _ring_put(t->ring);
+        }
+        free(t);
+    }
+    _tls = NULL;
+}
+
+static void _tls_key_init(void)
+{
+    pthread_key_create(&_tls_key, _tls_exit);
+}
+
+static struct log_ring* _get_ring(struct logger* lg)
+{
+    struct log_tls* t;
+    for (t = _tls; t; t = t->next)
+    {
+        if (t->lg != lg) continue;
+        if (t->gen == lg->gen) return t->ring;
+
+        // the logger it was made for is gone
+        if (t->ring) _ring_put(t->ring);
+        t->ring = NULL;
+        break;
+    }
+
+    if (t == NULL)
+    {
+        t = calloc(sizeof(struct log_tls), 1);
+        CHECK_IF(t == NULL, return NULL, "calloc failed");
+        t->next = _tls;
+        _tls = t;
+
+        pthread_once(&_tls_once, _tls_key_init);
+        pthread_setspecific(_tls_key, _tls);
+    }
+
+    struct log_ring* r = NULL;
+    CHECK_IF(posix_memalign((void**)&r, 64, sizeof(struct log_ring)) != 0, return NULL, "posix_memalign failed");
+    memset(r, 0, offsetof(struct log_ring, recs));
+    r->spill_head = calloc(sizeof(struct log_spill), 1);
+    CHECK_IF(r->spill_head == NULL, free(r); return NULL, "calloc failed");
+    r->spill_tail = r->spill_head;
+    r->refs = 2;
+
+    t->lg   = lg;
+    t->gen  = lg->gen;
+    t->ring = r;
+
+    pthread_mutex_lock(&lg->ring_lock);
+    r->next = lg->rings;
+    __atomic_store_n(&lg->rings, r, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&lg->ring_lock);
+    return r;
+}
+
+// p points at '%', return what follows the conversion
+static const char* _parse_spec(const char* p, int* stars, int* cls)
+{
+    const char* s = p + 1;
+    *stars = 0;
+    while (*s && strchr("-+ #0'", *s)) s++;
+    if (*s == '*')
+    {
+        (*stars)++;
+        s++;
+    }
+    while ((*s >= '0') && (*s <= '9')) s++;
+    if (*s == '.')
+    {
+        s++;
+        if (*s == '*')
+        {
+            (*stars)++;
+            s++;
+        }
+        while ((*s >= '0') && (*s <= '9')) s++;
+    }
+
+    char lng = 0;
+    switch (*s)
+    {
+        case 'h':
+            s++;
+            if (*s == 'h') s++;
+            break;
+        case 'l':
+            s++;
+            lng = 'l';
+            if (*s == 'l')
+            {
+                s++;
+                lng = 'q';
+            }
+            break;
+        case 'q': case 'L': case 'z': case 'j': case 't':
+            lng = *s;
+            s++;
+            break;
+    }
+
+    switch (*s)
+    {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            *cls = (lng == 'l') ? LOG_ARG_LONG :
+                   ((lng == 'q') || (lng == 'L')) ? LOG_ARG_LLONG :
+                   (lng == 'z') ? LOG_ARG_SIZE :
+                   (lng == 'j') ? LOG_ARG_INTMAX :
+                   (lng == 't') ? LOG_ARG_PTRDIFF : LOG_ARG_INT;
+            break;
+        case 'c':
+            *cls = LOG_ARG_INT;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            *cls = (lng == 'L') ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            *cls = (lng == 'l') ? LOG_ARG_SKIP : LOG_ARG_STR;
+            break;
+        case 'p':
+            *cls = LOG_ARG_PTR;
+            break;
+        case 'n':
+            *cls = LOG_ARG_SKIP;
+            break;
+        default:
+            *cls = LOG_ARG_NONE;
+            break;
+    }
+    return (*s) ? s + 1 : s;
+}
+
+#define PACK(type, ap) \
+{ \
+    type _v = va_arg(ap, type); \
+    if (pos + (int)sizeof(_v) > size) return pos; \
+    memcpy(buf + pos, &_v, sizeof(_v)); \
+    pos += sizeof(_v); \
+}
+
+// pack what fits, the arguments after the first that did not are dropped
+static int _pack(unsigned char* buf, int size, const char* fmt, va_list ap)
+{
+    int pos = 0;
+    int stars, cls, i;
+    const char* p = fmt;
+    while ((p = strchr(p, '%')) != NULL)
+    {
+        p = _parse_spec(p, &stars, &cls);
+        for (i=0; i<stars; i++) PACK(int, ap);
+
+        switch (cls)
+        {
+            case LOG_ARG_SKIP:    (void)va_arg(ap, void*); break;
+            case LOG_ARG_INT:     PACK(int, ap); break;
+            case LOG_ARG_LONG:    PACK(long, ap); break;
+            case LOG_ARG_LLONG:   PACK(long long, ap); break;
+            case LOG_ARG_SIZE:    PACK(size_t, ap); break;
+            case LOG_ARG_INTMAX:  PACK(intmax_t, ap); break;
+            case LOG_ARG_PTRDIFF: PACK(ptrdiff_t, ap); break;
+            case LOG_ARG_DOUBLE:  PACK(double, ap); break;
+            case LOG_ARG_LDOUBLE: PACK(long double, ap); break;
+            case LOG_ARG_PTR:     PACK(void*, ap); break;
+            case LOG_ARG_STR:
+            {
+                const char* str = va_arg(ap, const char*);
+                int room = size - pos - (int)sizeof(unsigned short) - 1;
+                if (room < 0) return pos;
+                if (str == NULL) str = "(null)";
+
+                unsigned short n = strnlen(str, room);
+                memcpy(buf + pos, &n, sizeof(n));
+                memcpy(buf + pos + sizeof(n), str, n);
+                buf[pos + sizeof(n) + n] = '\0';
+                pos += sizeof(n) + n + 1;
+                break;
+            }
+        }
+    }
+    return pos;
+}
+
+// an argument that was cut off prints as nothing, the text around it is kept
+#define UNPACK(type, v) \
+    type v; \
+    if (pos + (int)sizeof(v) > args_len) continue; \
+    memcpy(&v, args + pos, sizeof(v)); \
+    pos += sizeof(v);
+
+#define EMIT(v) \
+{ \
+    int _n = (stars == 0) ? snprintf(out + len, size - len, spec, v) : \
+             (stars == 1) ? snprintf(out + len, size - len, spec, star[0], v) : \
+                            snprintf(out + len, size - len, spec, star[0], star[1], v); \
+    len = (_n < size - len) ? len + _n : size - 1; \
+}
+
+// printf fmt with the packed arguments, one conversion at a time
+static int _format(char* out, int size, const char* fmt, const unsigned char* args, int args_len)
+{
+    int len = 0;
+    int pos = 0;
+    int stars, cls, i, n;
+    int star[2];
+    char spec[64];
+    const char* p = fmt;
+    const char* pct;
+    while (*p && (len < size - 1))
+    {
+        pct = strchr(p, '%');
+        n = pct ? (int)(pct - p) : (int)strlen(p);
+        if (n > size - 1 - len) n = size - 1 - len;
+        memcpy(out + len, p, n);
+        len += n;
+        if ((pct == NULL) || (len >= size - 1)) break;
+
+        p = _parse_spec(pct, &stars, &cls);
+        n = p - pct;
+        if (n > (int)sizeof(spec) - 1) n = sizeof(spec) - 1;
+        memcpy(spec, pct, n);
+        spec[n] = '\0';
+
+        for (i=0; i<stars; i++)
+        {
+            if (pos + (int)sizeof(int) > args_len) break;
+            memcpy(&star[i], args + pos, sizeof(int));
+            pos += sizeof(int);
+        }
+        if (i < stars) continue;
+
+        switch (cls)
+        {
+            case LOG_ARG_NONE:
+                if (spec[n-1] == '%') out[len++] = '%';
+                break;
+            case LOG_ARG_SKIP: break;
+            case LOG_ARG_INT:     { UNPACK(int, v);         EMIT(v); break; }
+            case LOG_ARG_LONG:    { UNPACK(long, v);        EMIT(v); break; }
+            case LOG_ARG_LLONG:   { UNPACK(long long, v);   EMIT(v); break; }
+            case LOG_ARG_SIZE:    { UNPACK(size_t, v);      EMIT(v); break; }
+            case LOG_ARG_INTMAX:  { UNPACK(intmax_t, v);    EMIT(v); break; }
+            case LOG_ARG_PTRDIFF: { UNPACK(ptrdiff_t, v);   EMIT(v); break; }
+            case LOG_ARG_DOUBLE:  { UNPACK(double, v);      EMIT(v); break; }
+            case LOG_ARG_LDOUBLE: { UNPACK(long double, v); EMIT(v); break; }
+            case LOG_ARG_PTR:     { UNPACK(void*, v);       EMIT(v); break; }
+            case LOG_ARG_STR:
+            {
+                UNPACK(unsigned short, slen);
+                if (pos + slen + 1 > args_len) continue;
+                const char* str = (const char*)args + pos;
+                pos += slen + 1;
+                EMIT(str);
+                break;
+            }
+        }
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+// path -> path.1 -> ... -> path.keep, the oldest one is overwritten
+static void _rotate(struct logger* lg, uint64_t now)
+{
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+    int i;
+    for (i=lg->rotate_keep-1; i>0; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", lg->path, i);
+        snprintf(to, sizeof(to), "%s.%d", lg->path, i+1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", lg->path);
+    rename(lg->path, to);
+
+    int fd = open(lg->path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    CHECK_IF(fd < 0, return, "open %s failed, errno = %d", lg->path, errno);
+
+    close(lg->fd);
+    lg->fd = fd;
+    lg->file_size = 0;
+    lg->opened_ns = now;
+}
+
+static void _flush_file(struct logger* lg, uint64_t now)
+{
+    if ((lg->file_size > 0) &&
+        (((lg->rotate_size > 0) && (lg->file_size + lg->batch_len > lg->rotate_size)) ||
+         ((lg->rotate_ns > 0) && (now - lg->opened_ns >= lg->rotate_ns))))
+    {
+        _rotate(lg, now);
+    }
+
+    int done = 0;
+    int ret;
+    while (done < lg->batch_len)
+    {
+        ret = write(lg->fd, lg->batch + done, lg->batch_len - done);
+        if ((ret < 0) && (errno == EINTR)) continue;
+        CHECK_IF(ret <= 0, break, "write failed, errno = %d", errno);
+        done += ret;
+    }
+    lg->file_size += done;
+}
+
+static void _flush_udp(struct logger* lg)
+{
+    if (lg->udp_num == 0) return;
+
+    if (lg->flag & LOG_FLAG_UDP) udp_send_batch(&lg->udp, lg->udp_msgs, lg->udp_num);
+    lg->udp_num = 0;
+    lg->udp_len = 0;
+}
+
+static void _flush(struct logger* lg)
+{
+    _flush_udp(lg);
+    if (lg->batch_len == 0) return;
+
+    if (lg->flag & LOG_FLAG_STDOUT)
+    {
+        fwrite(lg->batch, 1, lg->batch_len, stdout);
+        fflush(stdout);
+    }
+
+    if (lg->flag & LOG_FLAG_FILE) _flush_file(lg, _now_ns(CLOCK_MONOTONIC));
+    lg->batch_len = 0;
+}
+
+// one datagram per line, with the '\0' receivers always got
+static void _stage_udp(struct logger* lg, const char* line, int len)
+{
+    if ((lg->udp_num == UDP_BATCH_MAX) || (LOG_BATCH_SIZE - lg->udp_len < len + 1)) _flush_udp(lg);
+    if (len + 1 > LOG_BATCH_SIZE)
+    {
+        udp_send(&lg->udp, lg->remote, (char*)line, len + 1);
+        return;
+    }
+
+    struct udp_msg* msg = &lg->udp_msgs[lg->udp_num++];
+    msg->data   = lg->udp_buf + lg->udp_len;
+    msg->len    = len + 1;
+    msg->remote = lg->remote_addr;
+    memcpy(msg->data, line, len);
+    ((char*)msg->data)[len] = '\0';
+    lg->udp_len += len + 1;
+}
+
+static void _emit(struct logger* lg, uint64_t ts, const char* fmt, const unsigned char* args, int args_len)
+{
+    if (LOG_BATCH_SIZE - lg->batch_len < LOG_LINE_MAX) _flush(lg);
+    if (lg->batch_len == 0) lg->batch_ns = _now_ns(CLOCK_MONOTONIC);
+
+    char* line = lg->batch + lg->batch_len;
+    uint64_t wall = ts + lg->wall_offset;
+    int len = snprintf(line, LOG_LINE_MAX, "(%03lds,%03ldms): ", (long)(wall / 1000000000 % 1000), (long)(wall / 1000000 % 1000));
+    len += _format(line + len, LOG_LINE_MAX - len, fmt, args, args_len);
+    lg->batch_len += len;
+
+    if (lg->flag & LOG_FLAG_UDP) _stage_udp(lg, line, len);
+}
+
+// a logger_enq string goes out as it is, however long
+static void _emit_str(struct logger* lg, const char* str, int len)
+{
+    int done = 0;
+    int n;
+    while (done < len)
+    {
+        if (lg->batch_len == LOG_BATCH_SIZE) _flush(lg);
+        if (lg->batch_len == 0) lg->batch_ns = _now_ns(CLOCK_MONOTONIC);
+
+        n = LOG_BATCH_SIZE - lg->batch_len;
+        if (n > len - done) n = len - done;
+        memcpy(lg->batch + lg->batch_len, str + done, n);
+        lg->batch_len += n;
+        done += n;
+    }
+
+    if (lg->flag & LOG_FLAG_UDP) _stage_udp(lg, str, len);
+}
+
+static uint32_t _site_hash(const char* fmt)
+{
+    uint64_t h = (uint64_t)(uintptr_t)fmt * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(h >> 32);
+}
+
+static void _sites_clear(struct logger* lg)
+{
+    free(lg->sites);
+    free(lg->site_ids);
+    lg->sites = NULL;
+    lg->site_ids = NULL;
+    lg->site_mask = 0;
+    lg->site_num = 0;
+}
+
+static int _sites_grow(struct logger* lg)
+{
+    int size = (lg->site_mask + 1) * 2;
+    if (size < 64) size = 64;
+
+    const char** sites = calloc(sizeof(char*), size);
+    uint32_t* ids = calloc(sizeof(uint32_t), size);
+    CHECK_IF((sites == NULL) || (ids == NULL), goto _ERROR, "calloc failed");
+
+    int i, j;
+    for (i=0; lg->sites && (i<=lg->site_mask); i++)
+    {
+        if (lg->sites[i] == NULL) continue;
+        for (j=_site_hash(lg->sites[i]) & (size-1); sites[j]; j=(j+1) & (size-1)) {}
+        sites[j] = lg->sites[i];
+        ids[j] = lg->site_ids[i];
+    }
+
+    free(lg->sites);
+    free(lg->site_ids);
+    lg->sites = sites;
+    lg->site_ids = ids;
+    lg->site_mask = size - 1;
+    return LOG_OK;
+
+_ERROR:
+    free(sites);
+    free(ids);
+    return LOG_FAIL;
+}
+
+// the unused end of a segment stays zero, which is what the decoder skips on
+static int _bin_next(struct logger* lg)
 {
-    if (input) free(input);
+    long base = lg->bin_base + lg->bin_seg;
+    int ret = posix_fallocate(lg->bin_fd, base, lg->bin_seg);
+    CHECK_IF(ret != 0, return LOG_FAIL, "posix_fallocate failed, ret = %d", ret);
+
+    char* map = mmap(NULL, lg->bin_seg, PROT_READ | PROT_WRITE, MAP_SHARED, lg->bin_fd, base);
+    CHECK_IF(map == MAP_FAILED, return LOG_FAIL, "mmap failed, errno = %d", errno);
+
+    munmap(lg->bin_map, lg->bin_seg);
+    lg->bin_map  = map;
+    lg->bin_base = base;
+    lg->bin_pos  = 0;
+    return LOG_OK;
+}
+
+static void* _bin_entry(struct logger* lg, int kind, int level, uint32_t id, int len)
+{
+    if (lg->bin_pos + (long)sizeof(struct log_bin_entry) + len > lg->bin_seg)
+    {
+        if (_bin_next(lg) != LOG_OK)
+        {
+            logger_unset_binary(lg);
+            return NULL;
+        }
+    }
+
+    struct log_bin_entry e = {kind, level, len, id};
+    char* p = lg->bin_map + lg->bin_pos;
+    memcpy(p, &e, sizeof(e));
+    lg->bin_pos += sizeof(e) + len;
+    return p + sizeof(e);
+}
+
+static void _bin_put(struct logger* lg, uint64_t ts, int level, const char* fmt, const unsigned char* args, int args_len)
+{
+    if ((lg->site_num + 1) * 2 > lg->site_mask + 1)
+    {
+        CHECK_IF(_sites_grow(lg) != LOG_OK, return, "_sites_grow failed");
+    }
+
+    int i;
+    for (i=_site_hash(fmt) & lg->site_mask; lg->sites[i] && (lg->sites[i] != fmt); i=(i+1) & lg->site_mask) {}
+
+    char* p;
+    if (lg->sites[i] == NULL)
+    {
+        int len = strnlen(fmt, LOG_LINE_MAX - 1);
+        p = _bin_entry(lg, LOG_BIN_FMT, 0, lg->site_num, len + 1);
+        if (p == NULL) return;
+        memcpy(p, fmt, len);
+        p[len] = '\0';
+
+        lg->sites[i] = fmt;
+        lg->site_ids[i] = lg->site_num++;
+    }
+
+    p = _bin_entry(lg, LOG_BIN_REC, level, lg->site_ids[i], sizeof(ts) + args_len);
+    if (p == NULL) return;
+    memcpy(p, &ts, sizeof(ts));
+    memcpy(p + sizeof(ts), args, args_len);
+}
+
+// cut in entries that fit a segment, the decoder prints them back to back
+static void _bin_str(struct logger* lg, uint64_t ts, int level, const char* str, int len)
+{
+    int max = lg->bin_seg - sizeof(struct log_bin_entry) - sizeof(ts);
+    if (max > UINT16_MAX - (int)sizeof(ts)) max = UINT16_MAX - sizeof(ts);
+
+    char* p;
+    int n;
+    do
+    {
+        n = (len > max) ? max : len;
+        p = _bin_entry(lg, LOG_BIN_STR, level, 0, sizeof(ts) + n);
+        if (p == NULL) return;
+        memcpy(p, &ts, sizeof(ts));
+        memcpy(p + sizeof(ts), str, n);
+        str += n;
+        len -= n;
+    } while (len > 0);
+}
+
+static void _put(struct logger* lg, uint64_t ts, int level, const char* fmt, const unsigned char* args, int args_len)
+{
+    if (fmt == NULL)
+    {
+        char* str;
+        memcpy(&str, args, sizeof(str));
+        int len = strlen(str);
+        if (lg->flag & LOG_FLAG_BINARY) _bin_str(lg, ts, level, str, len);
+        if (lg->flag & (LOG_FLAG_STDOUT | LOG_FLAG_UDP | LOG_FLAG_FILE)) _emit_str(lg, str, len);
+        free(str);
+        return;
+    }
+
+    if (lg->flag & LOG_FLAG_BINARY) _bin_put(lg, ts, level, fmt, args, args_len);
+
+    if (lg->flag & (LOG_FLAG_STDOUT | LOG_FLAG_UDP | LOG_FLAG_FILE)) _emit(lg, ts, fmt, args, args_len);
+}
+
+static void _emit_dropped(struct logger* lg, unsigned long num)
+{
+    _put(lg, _now_ns(CLOCK_MONOTONIC), LOG_LV_WARN, "%lu records dropped\n", (unsigned char*)&num, sizeof(num));
+}
+
+// the oldest record of a ring, *sp is set when it was spilled.
+// the spill is looked at first, the ring records its writer made before are visible then
+static struct log_rec* _peek(struct log_ring* r, struct log_spill** sp)
+{
+    *sp = __atomic_load_n(&r->spill_head->next, __ATOMIC_ACQUIRE);
+    if (r->head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+    {
+        *sp = NULL;
+        return &r->recs[r->head & LOG_RING_MASK];
+    }
+    return (*sp) ? &(*sp)->rec : NULL;
+}
+
+static void _take(struct log_ring* r, struct log_spill* sp)
+{
+    if (sp == NULL)
+    {
+        __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // the record taken is the new stub
+    free(r->spill_head);
+    __atomic_store_n(&r->spill_head, sp, __ATOMIC_RELEASE);
+}
+
+// write the records of all rings in time order, return how many
+static int _drain(struct logger* lg)
+{
+    int num = 0;
+    struct log_ring* r;
+    struct log_ring* best;
+    struct log_rec* rec;
+    struct log_rec* best_rec;
+    struct log_spill* sp;
+    struct log_spill* best_sp;
+    while (num < LOG_RING_SIZE * 4)
+    {
+        best = NULL;
+        best_rec = NULL;
+        best_sp = NULL;
+        for (r = __atomic_load_n(&lg->rings, __ATOMIC_ACQUIRE); r; r = r->next)
+        {
+            rec = _peek(r, &sp);
+            if (rec == NULL) continue;
+
+            if ((best_rec == NULL) || (rec->ts < best_rec->ts))
+            {
+                best = r;
+                best_rec = rec;
+                best_sp = sp;
+            }
+        }
+        if (best == NULL) break;
+
+        _put(lg, best_rec->ts, best_rec->level, best_rec->fmt, best_rec->args, best_rec->len);
+        _take(best, best_sp);
+        num++;
+    }
+
+    // report drops and let go of rings whose thread is gone
+    struct log_ring** pr = &lg->rings;
+    unsigned long dropped;
+    pthread_mutex_lock(&lg->ring_lock);
+    while ((r = *pr) != NULL)
+    {
+        dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if (dropped != r->reported)
+        {
+            _emit_dropped(lg, dropped - r->reported);
+            r->reported = dropped;
+        }
+
+        if (__atomic_load_n(&r->is_dead, __ATOMIC_ACQUIRE) && (_peek(r, &sp) == NULL))
+        {
+            *pr = r->next;
+            _ring_put(r);
+            continue;
+        }
+        pr = &r->next;
+    }
+    pthread_mutex_unlock(&lg->ring_lock);
+
+    // about to sleep, or the oldest line waited long enough
+    if ((num == 0) || (_now_ns(CLOCK_MONOTONIC) - lg->batch_ns >= LOG_FLUSH_MS * 1000000ULL)) _flush(lg);
+    return num;
+}
+
+static bool _is_empty(struct logger* lg)
+{
+    struct log_ring* r;
+    struct log_spill* sp;
+    for (r = __atomic_load_n(&lg->rings, __ATOMIC_ACQUIRE); r; r = r->next)
+    {
+        if (_peek(r, &sp) != NULL) return false;
+    }
+    return true;
+}
+
+static void _wakeup(struct logger* lg)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&lg->sleeping, __ATOMIC_RELAXED) && __atomic_exchange_n(&lg->sleeping, 0, __ATOMIC_SEQ_CST))
+    {
+        _futex_wake(&lg->sleeping, 1);
+    }
 }
 
 int logger_unset_udp(struct logger* logger)
@@ -56,9 +865,18 @@ int logger_set_udp(struct logger* logger, char* dstip, int dstport)
         logger_unset_udp(logger);
     }
 
-    udp_init(&logger->udp, NULL, UDP_PORT_ANY);
+    if (logger->udp_msgs == NULL)
+    {
+        logger->udp_msgs = calloc(sizeof(struct udp_msg), UDP_BATCH_MAX);
+        logger->udp_buf  = malloc(LOG_BATCH_SIZE);
+        CHECK_IF((logger->udp_msgs == NULL) || (logger->udp_buf == NULL), return LOG_FAIL, "alloc failed");
+    }
+
     snprintf(logger->remote.ip, INET_ADDRSTRLEN, "%s", dstip);
     logger->remote.port = dstport;
+    CHECK_IF(udp_to_sockaddr(logger->remote, &logger->remote_addr) != UDP_OK, return LOG_FAIL, "bad dstip %s", dstip);
+
+    udp_init(&logger->udp, NULL, UDP_PORT_ANY);
     logger->flag |= LOG_FLAG_UDP;
     return LOG_OK;
 }
@@ -87,10 +905,110 @@ int logger_set_file(struct logger* logger, char* filepath)
     logger->fd = open(filepath, O_RDWR | O_CREAT, 0755);
     CHECK_IF(logger->fd <= 0, return LOG_FAIL, "open failed");
 
+    free(logger->path);
+    logger->path = strdup(filepath);
+    logger->file_size = 0;
+    logger->opened_ns = _now_ns(CLOCK_MONOTONIC);
     logger->flag |= LOG_FLAG_FILE;
     return LOG_OK;
 }
 
+int logger_set_rotate(struct logger* logger, long max_size, int max_secs, int keep)
+{
+    CHECK_IF(logger == NULL, return LOG_FAIL, "logger is null");
+    CHECK_IF((max_size < 0) || (max_secs < 0), return LOG_FAIL, "max_size = %ld, max_secs = %d invalid", max_size, max_secs);
+    CHECK_IF(keep <= 0, return LOG_FAIL, "keep = %d invalid", keep);
+
+    logger->rotate_size = max_size;
+    logger->rotate_ns   = (uint64_t)max_secs * 1000000000;
+    logger->rotate_keep = keep;
+    return LOG_OK;
+}
+
+int logger_unset_binary(struct logger* logger)
+{
+    CHECK_IF(logger == NULL, return LOG_FAIL, "logger is null");
+    logger->flag &= ~LOG_FLAG_BINARY;
+    if (logger->bin_fd <= 0) return LOG_OK;
+
+    // drop the preallocated tail so the file ends at the last entry
+    if (logger->bin_map) munmap(logger->bin_map, logger->bin_seg);
+    CHECK_IF(ftruncate(logger->bin_fd, logger->bin_base + logger->bin_pos) != 0, , "ftruncate failed, errno = %d", errno);
+    close(logger->bin_fd);
+
+    logger->bin_fd  = -1;
+    logger->bin_map = NULL;
+    _sites_clear(logger);
+    return LOG_OK;
+}
+
+int logger_set_binary(struct logger* logger, char* filepath, long seg_size)
+{
+    CHECK_IF(logger == NULL, return LOG_FAIL, "logger is null");
+    CHECK_IF(filepath == NULL, return LOG_FAIL, "filepath is null");
+    CHECK_IF(seg_size < 0, return LOG_FAIL, "seg_size = %ld invalid", seg_size);
+
+    if (logger->bin_fd > 0)
+    {
+        logger_unset_binary(logger);
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    if (seg_size == 0) seg_size = LOG_BIN_SEG;
+    seg_size = (seg_size + page - 1) / page * page;
+    CHECK_IF(seg_size > UINT32_MAX, return LOG_FAIL, "seg_size = %ld too large", seg_size);
+
+    unlink(filepath);
+
+    int fd = open(filepath, O_RDWR | O_CREAT, 0755);
+    CHECK_IF(fd <= 0, return LOG_FAIL, "open failed");
+
+    int ret = posix_fallocate(fd, 0, seg_size);
+    CHECK_IF(ret != 0, goto _ERROR, "posix_fallocate failed, ret = %d", ret);
+
+    char* map = mmap(NULL, seg_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    CHECK_IF(map == MAP_FAILED, goto _ERROR, "mmap failed, errno = %d", errno);
+
+    struct log_bin_head head = {LOG_BIN_MAGIC, LOG_BIN_VERSION, seg_size, logger->wall_offset};
+    memcpy(map, &head, sizeof(head));
+
+    logger->bin_fd   = fd;
+    logger->bin_map  = map;
+    logger->bin_seg  = seg_size;
+    logger->bin_base = 0;
+    logger->bin_pos  = sizeof(head);
+    logger->flag |= LOG_FLAG_BINARY;
+    return LOG_OK;
+
+_ERROR:
+    close(fd);
+    return LOG_FAIL;
+}
+
+int logger_format(char* out, int size, const char* fmt, const void* args, int args_len)
+{
+    CHECK_IF(out == NULL, return LOG_FAIL, "out is null");
+    CHECK_IF(size <= 0, return LOG_FAIL, "size = %d invalid", size);
+    CHECK_IF(fmt == NULL, return LOG_FAIL, "fmt is null");
+    CHECK_IF((args == NULL) && (args_len > 0), return LOG_FAIL, "args is null");
+
+    return _format(out, size, fmt, args, args_len);
+}
+
+int logger_set_drop(struct logger* logger)
+{
+    CHECK_IF(logger == NULL, return LOG_FAIL, "logger is null");
+    logger->flag |= LOG_FLAG_DROP;
+    return LOG_OK;
+}
+
+int logger_unset_drop(struct logger* logger)
+{
+    CHECK_IF(logger == NULL, return LOG_FAIL, "logger is null");
+    logger->flag &= ~LOG_FLAG_DROP;
+    return LOG_OK;
+}
+
 int logger_unset_stdout(struct logger* logger)
 {
     CHECK_IF(logger == NULL, return LOG_FAIL, "logger is null");
@@ -109,56 +1027,71 @@ int logger_set_stdout(struct logger* logger)
 struct logger* logger_create(void)
 {
     struct logger* lg = calloc(sizeof(struct logger), 1);
-    lg->level = LOG_LV_DEFAULT;
-    queue_init(&lg->mq, -1, _clean_msg, QUEUE_FLAG_POP_BLOCK);
+    CHECK_IF(lg == NULL, return NULL, "calloc failed");
+
+    lg->batch = malloc(LOG_BATCH_SIZE);
+    CHECK_IF(lg->batch == NULL, goto _ERROR, "malloc failed");
+
+    lg->levels.level = LOG_LV_DEFAULT;
+    memset(lg->levels.modules, LOG_LV_DEFAULT, sizeof(lg->levels.modules));
+    lg->fd    = -1;
+    lg->bin_fd = -1;
+    lg->gen   = __atomic_add_fetch(&_gen, 1, __ATOMIC_RELAXED);
+    lg->wall_offset = (int64_t)(_now_ns(CLOCK_REALTIME) - _now_ns(CLOCK_MONOTONIC));
+    pthread_mutex_init(&lg->ring_lock, NULL);
     return lg;
+
+_ERROR:
+    free(lg);
+    return NULL;
 }
 
 void logger_release(struct logger* lg)
 {
     CHECK_IF(lg == NULL, return, "lg is null");
 
-    queue_clean(&lg->mq);
-
     if (lg->running) logger_break(lg);
 
     if (lg->flag & LOG_FLAG_UDP) logger_unset_udp(lg);
 
     if (lg->flag & LOG_FLAG_FILE) logger_unset_file(lg);
 
-    free(lg);
-}
-
-static void _handlemsg(struct logger* lg, char* msg)
-{
-    if (lg->flag & LOG_FLAG_STDOUT) fprintf(stdout, "%s", msg);
-
-    if (lg->flag & LOG_FLAG_UDP) udp_send(&lg->udp, lg->remote, msg, strlen(msg)+1);
+    logger_unset_binary(lg);
 
-    if (lg->flag & LOG_FLAG_FILE) write(lg->fd, msg, strlen(msg)+1);
+    struct log_ring* r;
+    struct log_ring* next;
+    for (r = lg->rings; r; r = next)
+    {
+        next = r->next;
+        _ring_put(r);
+    }
+    pthread_mutex_destroy(&lg->ring_lock);
+    free(lg->udp_msgs);
+    free(lg->udp_buf);
+    free(lg->path);
+    free(lg->batch);
+    free(lg);
 }
 
-// void logger_handlemsg(struct logger* lg, char* msg)
-// {
-//     CHECK_IF(lg == NULL, return, "lg is null");
-//     CHECK_IF(msg == NULL, return, "msg is null");
-//     _handlemsg(lg, msg);
-// }
-
 void logger_run(struct logger* lg)
 {
     CHECK_IF(lg == NULL, return, "lg is null");
 
-    lg->running = true;
-    while (lg->running)
+    __atomic_store_n(&lg->running, true, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&lg->running, __ATOMIC_ACQUIRE))
     {
-        char* msg = queue_pop(&lg->mq);
-        CHECK_IF(msg == NULL, break, "msg is null");
+        if (_drain(lg) > 0) continue;
 
-        _handlemsg(lg, msg);
-        free(msg);
+        // announce the sleep before looking again, a writer then either sees it or we see its record
+        __atomic_store_n(&lg->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (_is_empty(lg) && __atomic_load_n(&lg->running, __ATOMIC_ACQUIRE))
+        {
+            _futex_wait(&lg->sleeping, 1, LOG_IDLE_MS);
+        }
+        __atomic_store_n(&lg->sleeping, 0, __ATOMIC_SEQ_CST);
     }
-    lg->running = false;
+
+    while (_drain(lg) > 0) {}
     return;
 }
 
@@ -166,25 +1099,174 @@ void logger_break(struct logger* lg)
 {
     CHECK_IF(lg == NULL, return, "lg is null");
 
-    lg->running = false;
-    log_print(lg, LOG_LV_INVALID, "stop\n");
+    __atomic_store_n(&lg->running, false, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&lg->sleeping, 0, __ATOMIC_SEQ_CST);
+    _futex_wake(&lg->sleeping, 1);
     return;
 }
 
 void logger_set_level(struct logger* lg, int level)
 {
     CHECK_IF(lg == NULL, return, "lg is null");
-    lg->level = level;
+    __atomic_store_n(&lg->levels.level, level, __ATOMIC_RELAXED);
+
+    int i;
+    for (i=0; i<LOG_MODULES_MAX; i++)
+    {
+        if (!lg->own_level[i]) __atomic_store_n(&lg->levels.modules[i], level, __ATOMIC_RELAXED);
+    }
 }
 
 int logger_get_level(struct logger* lg)
 {
     CHECK_IF(lg == NULL, return LOG_LV_INVALID, "lg is null");
-    return lg->level;
+    return __atomic_load_n(&lg->levels.level, __ATOMIC_RELAXED);
+}
+
+int logger_module(const char* name)
+{
+    CHECK_IF(name == NULL, return LOG_FAIL, "name is null");
+
+    int i;
+    int mod = LOG_FAIL;
+    pthread_mutex_lock(&_mod_lock);
+    for (i=0; i<_mod_num; i++)
+    {
+        if (strcmp(_mod_names[i], name) == 0)
+        {
+            mod = i;
+            break;
+        }
+    }
+
+    if ((mod == LOG_FAIL) && (_mod_num < LOG_MODULES_MAX))
+    {
+        _mod_names[_mod_num] = strdup(name);
+        if (_mod_names[_mod_num]) mod = _mod_num++;
+    }
+    pthread_mutex_unlock(&_mod_lock);
+    return mod;
+}
+
+int logger_set_module_level(struct logger* lg, const char* module, int level)
+{
+    CHECK_IF(lg == NULL, return LOG_FAIL, "lg is null");
+    CHECK_IF((level < LOG_LV_INVALID) || (level >= LOG_LEVELS), return LOG_FAIL, "level = %d invalid", level);
+
+    int mod = logger_module(module);
+    CHECK_IF(mod < 0, return LOG_FAIL, "no room for module %s", module);
+
+    lg->own_level[mod] = (level != LOG_LV_INVALID);
+    if (level == LOG_LV_INVALID) level = __atomic_load_n(&lg->levels.level, __ATOMIC_RELAXED);
+    __atomic_store_n(&lg->levels.modules[mod], level, __ATOMIC_RELAXED);
+    return LOG_OK;
+}
+
+int logger_get_module_level(struct logger* lg, const char* module)
+{
+    CHECK_IF(lg == NULL, return LOG_LV_INVALID, "lg is null");
+    return logger_level_of(lg, logger_module(module));
+}
+
+int logger_rate_pass(struct log_rate* rate, int per_sec)
+{
+    CHECK_IF(rate == NULL, return LOG_FAIL, "rate is null");
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t sec = ts.tv_sec;
+
+    // the first caller of a new second restarts the count
+    uint64_t old = __atomic_load_n(&rate->sec, __ATOMIC_RELAXED);
+    if ((old != sec) && __atomic_compare_exchange_n(&rate->sec, &old, sec, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&rate->count, 0, __ATOMIC_RELAXED);
+    }
+    return (__atomic_add_fetch(&rate->count, 1, __ATOMIC_RELAXED) <= per_sec) ? LOG_OK : LOG_FAIL;
+}
+
+// a record slot of the calling thread, or NULL when it is dropped.
+// once the ring is full records go to the spill list until logger_run has taken all of them
+static struct log_rec* _reserve(struct logger* lg, struct log_ring* r, struct log_spill** sp)
+{
+    *sp = NULL;
+    if ((__atomic_load_n(&r->spill_head, __ATOMIC_ACQUIRE) == r->spill_tail) &&
+        (r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) < LOG_RING_SIZE))
+    {
+        return &r->recs[r->tail & LOG_RING_MASK];
+    }
+
+    if (!(lg->flag & LOG_FLAG_DROP)) *sp = malloc(sizeof(struct log_spill));
+    if (*sp == NULL)
+    {
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    (*sp)->next = NULL;
+    return &(*sp)->rec;
+}
+
+static void _commit(struct logger* lg, struct log_ring* r, struct log_spill* sp)
+{
+    if (sp)
+    {
+        __atomic_store_n(&r->spill_tail->next, sp, __ATOMIC_RELEASE);
+        r->spill_tail = sp;
+    }
+    else
+    {
+        __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+    }
+    _wakeup(lg);
+}
+
+static void _write(struct logger* lg, int level, const char* fmt, va_list ap)
+{
+    struct log_ring* r = _get_ring(lg);
+    CHECK_IF(r == NULL, return, "_get_ring failed");
+
+    struct log_spill* sp;
+    struct log_rec* rec = _reserve(lg, r, &sp);
+    if (rec == NULL) return;
+
+    rec->ts    = _now_ns(CLOCK_MONOTONIC);
+    rec->fmt   = fmt;
+    rec->level = level;
+    rec->len   = _pack(rec->args, LOG_REC_ARGS, fmt, ap);
+    _commit(lg, r, sp);
+}
+
+void logger_write(struct logger* lg, int level, const char* fmt, ...)
+{
+    CHECK_IF(lg == NULL, return, "lg is null");
+    CHECK_IF(fmt == NULL, return, "fmt is null");
+
+    va_list ap;
+    va_start(ap, fmt);
+    _write(lg, level, fmt, ap);
+    va_end(ap);
 }
 
 void logger_enq(struct logger* lg, char* str)
 {
     CHECK_IF(lg == NULL, return, "lg is null");
-    queue_push(&lg->mq, str);
+    CHECK_IF(str == NULL, return, "str is null");
+
+    struct log_ring* r = _get_ring(lg);
+    CHECK_IF(r == NULL, free(str); return, "_get_ring failed");
+
+    struct log_spill* sp;
+    struct log_rec* rec = _reserve(lg, r, &sp);
+    if (rec == NULL)
+    {
+        free(str);
+        return;
+    }
+
+    rec->ts    = _now_ns(CLOCK_MONOTONIC);
+    rec->fmt   = NULL;
+    rec->level = LOG_LV_INFO;
+    rec->len   = sizeof(str);
+    memcpy(rec->args, &str, sizeof(str));
+    _commit(lg, r, sp);
 }
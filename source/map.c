@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 
 #include "map.h"
 
@@ -21,6 +22,228 @@
 #define INC_REF(ref) __sync_add_and_fetch(&ref, 1)
 #define DEC_REF(ref) __sync_sub_and_fetch(&ref, 1)
 
+#define LF_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define LF_STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
+static __thread int _lf_reader_idx = -1;
+static int _lf_reader_next = 0;
+
+static struct map_lftable* _lf_table_create(int max_num)
+{
+    return calloc(1, sizeof(struct map_lftable) + sizeof(struct map_lfslot*) * max_num);
+}
+
+// readers are spread over MAP_LF_READERS counters, so they do not share one cache line
+static struct map_lfreader* _lf_enter(struct map* map, int* pidx)
+{
+    if (_lf_reader_idx < 0) _lf_reader_idx = __sync_fetch_and_add(&_lf_reader_next, 1) % MAP_LF_READERS;
+
+    struct map_lfreader* reader = &map->readers[_lf_reader_idx];
+    int idx;
+    while (1)
+    {
+        idx = __atomic_load_n(&map->epoch, __ATOMIC_SEQ_CST) & 1;
+        __atomic_add_fetch(&reader->cnt[idx], 1, __ATOMIC_SEQ_CST);
+
+        // a writer flipped in between and may not wait for us, enter again
+        if ((__atomic_load_n(&map->epoch, __ATOMIC_SEQ_CST) & 1) == idx) break;
+        __atomic_sub_fetch(&reader->cnt[idx], 1, __ATOMIC_RELEASE);
+    }
+    *pidx = idx;
+    return reader;
+}
+
+static void _lf_exit(struct map_lfreader* reader, int idx)
+{
+    __atomic_sub_fetch(&reader->cnt[idx], 1, __ATOMIC_RELEASE);
+}
+
+// under the write lock : after return no reader can still see what was unpublished before
+static void _lf_synchronize(struct map* map)
+{
+    int old = __atomic_fetch_add(&map->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+    int i;
+    for (i=0; i<MAP_LF_READERS; i++)
+    {
+        while (__atomic_load_n(&map->readers[i].cnt[old], __ATOMIC_ACQUIRE) != 0)
+        {
+            sched_yield();
+        }
+    }
+}
+
+// copy the slot pointers into a twice larger table, readers keep using the old one meanwhile
+static int _lf_expand(struct map* map)
+{
+    struct map_lftable* old = map->table;
+    struct map_lftable* table = _lf_table_create(old->max_num * 2);
+    CHECK_IF(table == NULL, return MAP_FAIL, "calloc failed");
+
+    table->max_num = old->max_num * 2;
+    int i;
+    struct map_lfslot* slot;
+    for (i=0; i<old->max_num; i++)
+    {
+        slot = old->slots[i];
+        if (slot) table->slots[slot->id & (table->max_num - 1)] = slot;
+    }
+
+    LF_STORE(&map->table, table);
+    map->max_num = table->max_num;
+
+    _lf_synchronize(map);
+    free(old);
+    return MAP_OK;
+}
+
+static mapid _lf_new(struct map* map, void* data)
+{
+    struct map_lfslot* slot = aligned_alloc(64, sizeof(struct map_lfslot));
+    CHECK_IF(slot == NULL, return MAPID_INVALID, "aligned_alloc failed");
+
+    rwlock_wlock(&map->lock);
+
+    if (map->num >= (map->max_num * 3 / 4))
+    {
+        int chk = _lf_expand(map);
+        CHECK_IF(chk != MAP_OK, goto _ERROR, "_lf_expand failed");
+    }
+
+    struct map_lftable* table = map->table;
+    int i, pos;
+    for (i=0; i<table->max_num; i++)
+    {
+        map->lastid++;
+        if (map->lastid == MAPID_INVALID) map->lastid++;
+
+        pos = map->lastid & (table->max_num - 1);
+        if (table->slots[pos] == NULL)
+        {
+            slot->id   = map->lastid;
+            slot->ref  = 1;
+            slot->data = data;
+            LF_STORE(&table->slots[pos], slot);
+            map->num++;
+            rwlock_wunlock(&map->lock);
+            return slot->id;
+        }
+    }
+
+    derror("no slot is empty, but it is impossible");
+
+_ERROR:
+    rwlock_wunlock(&map->lock);
+    free(slot);
+    return MAPID_INVALID;
+}
+
+static struct map_lfslot* _lf_find(struct map* map, mapid id)
+{
+    struct map_lftable* table = LF_LOAD(&map->table);
+    struct map_lfslot* slot = LF_LOAD(&table->slots[id & (table->max_num - 1)]);
+    return (slot && (slot->id == id)) ? slot : NULL;
+}
+
+static void* _lf_grab(struct map* map, mapid id)
+{
+    int idx;
+    struct map_lfreader* reader = _lf_enter(map, &idx);
+
+    void* ret = NULL;
+    struct map_lfslot* slot = _lf_find(map, id);
+    if (slot)
+    {
+        // ref 0 is being deleted, never bring it back
+        int ref = LF_LOAD(&slot->ref);
+        while (ref > 0)
+        {
+            if (__atomic_compare_exchange_n(&slot->ref, &ref, ref + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                ret = slot->data;
+                break;
+            }
+        }
+    }
+
+    _lf_exit(reader, idx);
+    return ret;
+}
+
+static void* _lf_release(struct map* map, mapid id)
+{
+    int idx;
+    struct map_lfreader* reader = _lf_enter(map, &idx);
+
+    struct map_lfslot* slot = _lf_find(map, id);
+    int ref = (slot) ? __atomic_sub_fetch(&slot->ref, 1, __ATOMIC_ACQ_REL) : 1;
+
+    _lf_exit(reader, idx);
+    if (ref > 0) return NULL;
+    CHECK_IF(ref < 0, return NULL, "id = %u released more often than grabbed", id);
+
+    // only the one who dropped the last ref gets here, the slot cannot go away before
+    rwlock_wlock(&map->lock);
+
+    struct map_lftable* table = map->table;
+    int pos = id & (table->max_num - 1);
+    if (table->slots[pos] == slot)
+    {
+        LF_STORE(&table->slots[pos], NULL);
+        map->num--;
+    }
+    _lf_synchronize(map);
+
+    rwlock_wunlock(&map->lock);
+
+    void* data = slot->data;
+    free(slot);
+    return data;
+}
+
+static int _lf_list(struct map* map, mapid* idbuf, int bufsize)
+{
+    int idx;
+    struct map_lfreader* reader = _lf_enter(map, &idx);
+
+    struct map_lftable* table = LF_LOAD(&map->table);
+    struct map_lfslot* slot;
+    int i;
+    int ret = 0;
+    for (i=0; (i<table->max_num) && (ret<bufsize); i++)
+    {
+        slot = LF_LOAD(&table->slots[i]);
+        if (slot) idbuf[ret++] = slot->id;
+    }
+
+    _lf_exit(reader, idx);
+    return ret;
+}
+
+static void _lf_uninit(struct map* map)
+{
+    rwlock_wlock(&map->lock);
+
+    struct map_lftable* table = map->table;
+    int i;
+    for (i=0; i<table->max_num; i++)
+    {
+        if (table->slots[i] == NULL) continue;
+
+        if (map->cleanfn) map->cleanfn(table->slots[i]->data);
+        free(table->slots[i]);
+    }
+    free(table);
+    free(map->readers);
+    map->table   = NULL;
+    map->readers = NULL;
+    map->max_num = 0;
+    map->num     = 0;
+    map->cleanfn = NULL;
+    map->lastid  = 0;
+
+    rwlock_wunlock(&map->lock);
+}
+
 static int _expand_map(struct map* map)
 {
     CHECK_IF(map == NULL, return MAP_FAIL, "map is null");
@@ -46,6 +269,11 @@ static int _expand_map(struct map* map)
 }
 
 int map_init(struct map* map, void (*cleanfn)(void*))
+{
+    return map_init_ex(map, cleanfn, 0);
+}
+
+int map_init_ex(struct map* map, void (*cleanfn)(void*), int flag)
 {
     CHECK_IF(map == NULL, return MAP_FAIL, "map is null");
 
@@ -55,8 +283,23 @@ int map_init(struct map* map, void (*cleanfn)(void*))
     map->max_num = MAP_INIT_MAX_SLOTS;
     map->num     = 0;
     map->cleanfn = cleanfn;
-    map->slots   = calloc(sizeof(struct map_slot), map->max_num);
-    CHECK_IF(map->slots == NULL, return MAP_FAIL, "calloc failed");
+    map->flag    = flag;
+
+    if (flag & MAP_FLAG_LOCKFREE)
+    {
+        map->readers = aligned_alloc(64, sizeof(struct map_lfreader) * MAP_LF_READERS);
+        CHECK_IF(map->readers == NULL, return MAP_FAIL, "aligned_alloc failed");
+        memset(map->readers, 0, sizeof(struct map_lfreader) * MAP_LF_READERS);
+
+        map->table = _lf_table_create(map->max_num);
+        CHECK_IF(map->table == NULL, free(map->readers); return MAP_FAIL, "calloc failed");
+        map->table->max_num = map->max_num;
+    }
+    else
+    {
+        map->slots = calloc(sizeof(struct map_slot), map->max_num);
+        CHECK_IF(map->slots == NULL, return MAP_FAIL, "calloc failed");
+    }
 
     map->is_init = 1;
     return MAP_OK;
@@ -67,6 +310,8 @@ int map_list(struct map* map, mapid* idbuf, int bufsize)
     CHECK_IF(idbuf == NULL, return -1, "map is null");
     CHECK_IF(bufsize <= 0, return -1, "bufsize = %d invalid", bufsize);
 
+    if (map->flag & MAP_FLAG_LOCKFREE) return _lf_list(map, idbuf, bufsize);
+
     rwlock_rlock(&map->lock);
     int i;
     int ret = 0;
@@ -91,6 +336,12 @@ int map_uninit(struct map* map)
 
     map->is_init = 0;
 
+    if (map->flag & MAP_FLAG_LOCKFREE)
+    {
+        _lf_uninit(map);
+        return MAP_OK;
+    }
+
     rwlock_wlock(&map->lock);
     if (map->cleanfn)
     {
@@ -121,6 +372,8 @@ mapid map_new(struct map* map, void* data)
     CHECK_IF(data == NULL, return MAPID_INVALID, "data is null");
     CHECK_IF(map->is_init != 1, return MAPID_INVALID, "map is not init yet");
 
+    if (map->flag & MAP_FLAG_LOCKFREE) return _lf_new(map, data);
+
     rwlock_wlock(&map->lock);
 
     if (map->num >= (map->max_num * 3 / 4))
@@ -197,6 +450,8 @@ void* map_grab(struct map* map, mapid id)
     CHECK_IF(map->is_init != 1, return NULL, "map is not init yet");
     CHECK_IF(id == MAPID_INVALID, return NULL, "id = %d invalid", id);
 
+    if (map->flag & MAP_FLAG_LOCKFREE) return _lf_grab(map, id);
+
     void* ret = NULL;
 
     rwlock_rlock(&map->lock);
@@ -250,6 +505,8 @@ void* map_release(struct map* map, mapid id)
     CHECK_IF(map->is_init != 1, return NULL, "map is not init yet");
     CHECK_IF(id == MAPID_INVALID, return NULL, "id = %d invalid", id);
 
+    if (map->flag & MAP_FLAG_LOCKFREE) return _lf_release(map, id);
+
     if (NULL == _releaseRef(map, id))
     {
         return NULL;
@@ -1,5 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "queue.h"
 
 #define derror(a, b...) fprintf(stderr, "[ERROR] %s(): "a"\n", __func__, ##b)
@@ -18,6 +24,318 @@
 #define LOCK(q) atom_spinlock(&q->lock)
 #define UNLOCK(q) atom_spinunlock(&q->lock)
 
+#define LF_IDX(w)        ((uint32_t)(w))
+#define LF_TAG(w)        ((uint32_t)((w) >> 32))
+#define LF_WORD(idx, tag) (((uint64_t)(tag) << 32) | (idx))
+
+// index 0 is the null node
+struct lf_node
+{
+    uint64_t next;
+    void* data;
+};
+
+static struct lf_node* _chunks[QUEUE_NODE_CHUNKS];
+static int _chunk_num = 0;
+
+// nodes no thread cache holds, linked through next
+static pthread_mutex_t _node_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t _depot_head = 0;
+static long _depot_num = 0;
+
+static __thread uint32_t _cache_head = 0;
+static __thread int _cache_num = 0;
+static __thread bool _cache_used = false;
+static pthread_key_t  _cache_key;
+static pthread_once_t _cache_once = PTHREAD_ONCE_INIT;
+
+static struct lf_node* _node(uint32_t idx)
+{
+    struct lf_node* chunk = __atomic_load_n(&_chunks[idx / QUEUE_NODE_CHUNK], __ATOMIC_ACQUIRE);
+    return &chunk[idx % QUEUE_NODE_CHUNK];
+}
+
+// a stale reader may load next at any time, every write bumps the tag so its CAS fails
+static void _set_next(struct lf_node* n, uint32_t idx)
+{
+    uint64_t old = __atomic_load_n(&n->next, __ATOMIC_RELAXED);
+    __atomic_store_n(&n->next, LF_WORD(idx, LF_TAG(old) + 1), __ATOMIC_RELAXED);
+}
+
+// move num nodes from the head of the thread cache to the depot
+static void _cache_spill(int num)
+{
+    uint32_t head = _cache_head;
+    uint32_t last = head;
+    int i;
+    for (i=1; i<num; i++)
+    {
+        last = LF_IDX(__atomic_load_n(&_node(last)->next, __ATOMIC_RELAXED));
+    }
+    _cache_head = LF_IDX(__atomic_load_n(&_node(last)->next, __ATOMIC_RELAXED));
+    _cache_num -= num;
+
+    pthread_mutex_lock(&_node_lock);
+    _set_next(_node(last), _depot_head);
+    _depot_head = head;
+    _depot_num += num;
+    pthread_mutex_unlock(&_node_lock);
+}
+
+static void _cache_exit(void* arg)
+{
+    if (_cache_num > 0) _cache_spill(_cache_num);
+}
+
+static void _cache_key_init(void)
+{
+    pthread_key_create(&_cache_key, _cache_exit);
+}
+
+// the key destructor only runs for threads that set it
+static void _cache_use(void)
+{
+    if (_cache_used) return;
+    _cache_used = true;
+    pthread_once(&_cache_once, _cache_key_init);
+    pthread_setspecific(_cache_key, &_cache_head);
+}
+
+// a batch from the depot, or a new chunk
+static void _cache_fill(void)
+{
+    _cache_use();
+
+    pthread_mutex_lock(&_node_lock);
+    if (_depot_num > 0)
+    {
+        uint32_t last = _depot_head;
+        int num = 1;
+        while ((num < QUEUE_NODE_BATCH) && (num < _depot_num))
+        {
+            last = LF_IDX(__atomic_load_n(&_node(last)->next, __ATOMIC_RELAXED));
+            num++;
+        }
+        _cache_head = _depot_head;
+        _cache_num  = num;
+        _depot_head = LF_IDX(__atomic_load_n(&_node(last)->next, __ATOMIC_RELAXED));
+        _depot_num -= num;
+        _set_next(_node(last), 0);
+    }
+    else if (_chunk_num < QUEUE_NODE_CHUNKS)
+    {
+        struct lf_node* chunk = calloc(sizeof(struct lf_node), QUEUE_NODE_CHUNK);
+        if (chunk)
+        {
+            uint32_t base = _chunk_num * QUEUE_NODE_CHUNK;
+            int first = (base == 0) ? 1 : 0;
+            int i;
+            for (i=first; i<QUEUE_NODE_CHUNK-1; i++)
+            {
+                chunk[i].next = base + i + 1;
+            }
+            __atomic_store_n(&_chunks[_chunk_num++], chunk, __ATOMIC_RELEASE);
+            _cache_head = base + first;
+            _cache_num  = QUEUE_NODE_CHUNK - first;
+        }
+    }
+    pthread_mutex_unlock(&_node_lock);
+}
+
+static uint32_t _node_get(void)
+{
+    if (_cache_head == 0) _cache_fill();
+    CHECK_IF(_cache_head == 0, return 0, "out of queue nodes");
+
+    uint32_t idx = _cache_head;
+    _cache_head = LF_IDX(__atomic_load_n(&_node(idx)->next, __ATOMIC_RELAXED));
+    _cache_num--;
+    return idx;
+}
+
+static void _node_put(uint32_t idx)
+{
+    _cache_use();
+    _set_next(_node(idx), _cache_head);
+    _cache_head = idx;
+    _cache_num++;
+
+    // nodes usually go back on another thread than they were taken, keep the caches level
+    if (_cache_num >= 2 * QUEUE_NODE_BATCH) _cache_spill(QUEUE_NODE_BATCH);
+}
+
+static void _futex_wait(int* addr, int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void _futex_wake(int* addr, int num)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+static void _lf_notify(int* seq, int* waiters)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0)
+    {
+        __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+        _futex_wake(seq, 1);
+    }
+}
+
+static bool _lf_link(struct queue* q, uint32_t idx)
+{
+    uint64_t tail, next;
+    while (1)
+    {
+        tail = __atomic_load_n(&q->lf_tail, __ATOMIC_ACQUIRE);
+        struct lf_node* t = _node(LF_IDX(tail));
+        next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+        if (tail != __atomic_load_n(&q->lf_tail, __ATOMIC_ACQUIRE)) continue;
+
+        if (LF_IDX(next) != 0)
+        {
+            // tail lags behind, help it along
+            __atomic_compare_exchange_n(&q->lf_tail, &tail, LF_WORD(LF_IDX(next), LF_TAG(tail) + 1), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&t->next, &next, LF_WORD(idx, LF_TAG(next) + 1), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) break;
+    }
+    __atomic_compare_exchange_n(&q->lf_tail, &tail, LF_WORD(idx, LF_TAG(tail) + 1), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void* _lf_unlink(struct queue* q)
+{
+    uint64_t head, tail, next;
+    void* data;
+    while (1)
+    {
+        head = __atomic_load_n(&q->lf_head, __ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&q->lf_tail, __ATOMIC_ACQUIRE);
+        next = __atomic_load_n(&_node(LF_IDX(head))->next, __ATOMIC_ACQUIRE);
+        if (head != __atomic_load_n(&q->lf_head, __ATOMIC_ACQUIRE)) continue;
+
+        if (LF_IDX(next) == 0) return NULL;
+
+        if (LF_IDX(head) == LF_IDX(tail))
+        {
+            __atomic_compare_exchange_n(&q->lf_tail, &tail, LF_WORD(LF_IDX(next), LF_TAG(tail) + 1), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // read before the CAS, the next node becomes the dummy and may be reused right after
+        data = __atomic_load_n(&_node(LF_IDX(next))->data, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&q->lf_head, &head, LF_WORD(LF_IDX(next), LF_TAG(head) + 1), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) break;
+    }
+    _node_put(LF_IDX(head));
+    return data;
+}
+
+static int _lf_init(struct queue* q)
+{
+    uint32_t dummy = _node_get();
+    CHECK_IF(dummy == 0, return QUEUE_FAIL, "_node_get failed");
+    _set_next(_node(dummy), 0);
+
+    q->lf_head = LF_WORD(dummy, 0);
+    q->lf_tail = LF_WORD(dummy, 0);
+    q->pop_seq = 0;
+    q->pop_waiters = 0;
+    q->push_seq = 0;
+    q->push_waiters = 0;
+    return QUEUE_OK;
+}
+
+static void _lf_clean(struct queue* q)
+{
+    CHECK_IF(LF_IDX(q->lf_head) == 0, return, "q is not initialized");
+
+    void* data;
+    while ((data = _lf_unlink(q)) != NULL)
+    {
+        if (q->cleanfn) q->cleanfn(data);
+    }
+    _node_put(LF_IDX(q->lf_head));
+    q->lf_head = 0;
+    q->lf_tail = 0;
+    q->num = 0;
+}
+
+// a slot of depth, waits for one with QUEUE_FLAG_PUSH_BLOCK
+static int _lf_reserve(struct queue* q)
+{
+    if (q->depth < 0)
+    {
+        __atomic_add_fetch(&q->num, 1, __ATOMIC_RELAXED);
+        return QUEUE_OK;
+    }
+
+    int num, seq;
+    while (1)
+    {
+        num = __atomic_load_n(&q->num, __ATOMIC_RELAXED);
+        if (num < q->depth)
+        {
+            if (__atomic_compare_exchange_n(&q->num, &num, num + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return QUEUE_OK;
+            continue;
+        }
+        if (!(q->flag & QUEUE_FLAG_PUSH_BLOCK)) return QUEUE_FAIL;
+
+        seq = __atomic_load_n(&q->push_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&q->num, __ATOMIC_RELAXED) >= q->depth) _futex_wait(&q->push_seq, seq);
+        __atomic_sub_fetch(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static int _lf_push(struct queue* q, void* data)
+{
+    CHECK_IF(LF_IDX(__atomic_load_n(&q->lf_head, __ATOMIC_RELAXED)) == 0, return QUEUE_FAIL, "q is not initialized");
+
+    if (_lf_reserve(q) != QUEUE_OK) return QUEUE_FAIL;
+
+    uint32_t idx = _node_get();
+    if (idx == 0)
+    {
+        __atomic_sub_fetch(&q->num, 1, __ATOMIC_RELAXED);
+        return QUEUE_FAIL;
+    }
+    struct lf_node* n = _node(idx);
+    __atomic_store_n(&n->data, data, __ATOMIC_RELAXED);
+    _set_next(n, 0);
+    _lf_link(q, idx);
+
+    if (q->flag & QUEUE_FLAG_POP_BLOCK) _lf_notify(&q->pop_seq, &q->pop_waiters);
+    return QUEUE_OK;
+}
+
+static void* _lf_pop(struct queue* q)
+{
+    CHECK_IF(LF_IDX(__atomic_load_n(&q->lf_head, __ATOMIC_RELAXED)) == 0, return NULL, "q is not initialized");
+
+    void* data = _lf_unlink(q);
+    int seq;
+    while ((data == NULL) && (q->flag & QUEUE_FLAG_POP_BLOCK))
+    {
+        seq = __atomic_load_n(&q->pop_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        data = _lf_unlink(q);
+        if (data == NULL) _futex_wait(&q->pop_seq, seq);
+        __atomic_sub_fetch(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+        if (data == NULL) data = _lf_unlink(q);
+    }
+    if (data == NULL) return NULL;
+
+    __atomic_sub_fetch(&q->num, 1, __ATOMIC_RELAXED);
+    if ((q->depth > 0) && (q->flag & QUEUE_FLAG_PUSH_BLOCK)) _lf_notify(&q->push_seq, &q->push_waiters);
+    return data;
+}
+
 int queue_init(struct queue* q, int depth, void (*cleanfn)(void*), int flag)
 {
     CHECK_IF(q == NULL, return QUEUE_FAIL, "q is null");
@@ -31,6 +349,12 @@ int queue_init(struct queue* q, int depth, void (*cleanfn)(void*), int flag)
     q->cleanfn = cleanfn;
     q->lock = 0;
     q->flag = flag;
+    if (flag & QUEUE_FLAG_LOCKFREE)
+    {
+        if (depth < 0) q->flag &= ~QUEUE_FLAG_PUSH_BLOCK;
+        return _lf_init(q);
+    }
+
     if (depth > 0)
     {
         sem_init(&(q->empty_sem), 0, depth);
@@ -47,6 +371,12 @@ void queue_clean(struct queue* q)
 {
     CHECK_IF(q == NULL, return, "q is null");
 
+    if (q->flag & QUEUE_FLAG_LOCKFREE)
+    {
+        _lf_clean(q);
+        return;
+    }
+
     LOCK(q);
     struct queue_node* node = q->head;
     struct queue_node* next;
@@ -81,6 +411,8 @@ int queue_push(struct queue* q, void* data)
     CHECK_IF(q == NULL, return QUEUE_FAIL, "q is null");
     CHECK_IF(data == NULL, return QUEUE_FAIL, "data is null");
 
+    if (q->flag & QUEUE_FLAG_LOCKFREE) return _lf_push(q, data);
+
     if (q->flag & QUEUE_FLAG_PUSH_BLOCK)
     {
         sem_wait(&(q->empty_sem));
@@ -122,6 +454,8 @@ void* queue_pop(struct queue* q)
 {
     CHECK_IF(q == NULL, return NULL, "q is null");
 
+    if (q->flag & QUEUE_FLAG_LOCKFREE) return _lf_pop(q);
+
     if (q->flag & QUEUE_FLAG_POP_BLOCK)
     {
         sem_wait(&(q->num_sem));
@@ -163,5 +497,5 @@ void* queue_pop(struct queue* q)
 int queue_num(struct queue* q)
 {
     CHECK_IF(q == NULL, return -1, "q is null");
-    return q->num;
+    return __atomic_load_n(&q->num, __ATOMIC_RELAXED);
 }
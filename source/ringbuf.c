@@ -14,6 +14,9 @@
     }\
 }
 
+#define _load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define _store_release(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
 static void _increase_rb(struct ringbuf* rb, int* pos, int* msb)
 {
     *pos = *pos + 1;
@@ -24,10 +27,78 @@ static void _increase_rb(struct ringbuf* rb, int* pos, int* msb)
     }
 }
 
+static inline unsigned int _spsc_free(struct ringbuf* rb)
+{
+    unsigned int free_num = rb->size - (rb->tail - rb->cached_head);
+    if (free_num == 0)
+    {
+        rb->cached_head = _load_acquire(&rb->head);
+        free_num = rb->size - (rb->tail - rb->cached_head);
+    }
+    return free_num;
+}
+
+static inline unsigned int _spsc_used(struct ringbuf* rb)
+{
+    unsigned int used_num = rb->cached_tail - rb->head;
+    if (used_num == 0)
+    {
+        rb->cached_tail = _load_acquire(&rb->tail);
+        used_num = rb->cached_tail - rb->head;
+    }
+    return used_num;
+}
+
+static int _spsc_write_n(struct ringbuf* rb, void* input, unsigned int num)
+{
+    unsigned int free_num = rb->size - (rb->tail - rb->cached_head);
+    if (free_num < num)
+    {
+        rb->cached_head = _load_acquire(&rb->head);
+        free_num = rb->size - (rb->tail - rb->cached_head);
+    }
+    if (num > free_num) num = free_num;
+    if (num == 0) return 0;
+
+    unsigned int idx   = rb->tail & rb->mask;
+    unsigned int first = rb->size - idx;
+    if (first > num) first = num;
+
+    memcpy(rb->elements + rb->elem_size * idx, input, rb->elem_size * first);
+    memcpy(rb->elements, input + rb->elem_size * first, rb->elem_size * (num - first));
+
+    _store_release(&rb->tail, rb->tail + num);
+    return num;
+}
+
+static int _spsc_read_n(struct ringbuf* rb, void* output, unsigned int num)
+{
+    unsigned int used_num = rb->cached_tail - rb->head;
+    if (used_num < num)
+    {
+        rb->cached_tail = _load_acquire(&rb->tail);
+        used_num = rb->cached_tail - rb->head;
+    }
+    if (num > used_num) num = used_num;
+    if (num == 0) return 0;
+
+    unsigned int idx   = rb->head & rb->mask;
+    unsigned int first = rb->size - idx;
+    if (first > num) first = num;
+
+    memcpy(output, rb->elements + rb->elem_size * idx, rb->elem_size * first);
+    memcpy(output + rb->elem_size * first, rb->elements, rb->elem_size * (num - first));
+
+    _store_release(&rb->head, rb->head + num);
+    return num;
+}
+
 int ringbuf_full(struct ringbuf* rb)
 {
     CHECK_IF(rb == NULL, return 1, "rb is null");
     CHECK_IF(rb->size <= 0, return 1, "rb_size = %d invalid", rb->size);
+
+    if (rb->is_spsc) return (_load_acquire(&rb->tail) - _load_acquire(&rb->head)) == (unsigned int)rb->size;
     return (rb->end == rb->start) && (rb->e_msb != rb->s_msb);
 }
 
@@ -35,6 +106,8 @@ int ringbuf_empty(struct ringbuf* rb)
 {
     CHECK_IF(rb == NULL, return 1, "rb is null");
     CHECK_IF(rb->size <= 0, return 1, "rb_size = %d invalid", rb->size);
+
+    if (rb->is_spsc) return _load_acquire(&rb->tail) == _load_acquire(&rb->head);
     return (rb->end == rb->start) && (rb->e_msb == rb->s_msb);
 }
 
@@ -49,6 +122,10 @@ int ringbuf_init(struct ringbuf* rb, int rb_size, int elem_size, void* elements)
     rb->end   = 0;
     rb->s_msb = 0;
     rb->e_msb = 0;
+    rb->is_spsc = 0;
+    rb->mask    = 0;
+    rb->head = rb->cached_tail = 0;
+    rb->tail = rb->cached_head = 0;
     if (elements)
     {
         rb->elements = elements;
@@ -64,6 +141,26 @@ int ringbuf_init(struct ringbuf* rb, int rb_size, int elem_size, void* elements)
     return RB_OK;
 }
 
+int ringbuf_init_spsc(struct ringbuf* rb, int rb_size, int elem_size, void* elements)
+{
+    CHECK_IF(rb == NULL, return RB_FAIL, "rb is null");
+    CHECK_IF(rb_size <= 0, return RB_FAIL, "rb_size = %d invalid", rb_size);
+
+    int size = 1;
+    while (size < rb_size)
+    {
+        size *= 2;
+    }
+    CHECK_IF(elements && (size != rb_size), return RB_FAIL, "rb_size = %d is not power of 2", rb_size);
+
+    int chk = ringbuf_init(rb, size, elem_size, elements);
+    CHECK_IF(chk != RB_OK, return RB_FAIL, "ringbuf_init failed");
+
+    rb->is_spsc = 1;
+    rb->mask    = size - 1;
+    return RB_OK;
+}
+
 int ringbuf_uninit(struct ringbuf* rb)
 {
     CHECK_IF(rb == NULL, return RB_FAIL, "rb is null");
@@ -81,6 +178,12 @@ void* ringbuf_pre_write(struct ringbuf* rb)
     CHECK_IF(rb == NULL, return NULL, "rb is null");
     CHECK_IF(rb->size <= 0, return NULL, "rb->size = %d invalid", rb->size);
     CHECK_IF(rb->elements == NULL, return NULL, "rb->elements is null");
+
+    if (rb->is_spsc)
+    {
+        if (_spsc_free(rb) == 0) return NULL;
+        return rb->elements + rb->elem_size * (rb->tail & rb->mask);
+    }
     return rb->elements + rb->elem_size * rb->end;
 }
 
@@ -90,6 +193,13 @@ int ringbuf_post_write(struct ringbuf* rb)
     CHECK_IF(rb->size <= 0, return RB_FAIL, "rb->size = %d invalid", rb->size);
     CHECK_IF(rb->elements == NULL, return RB_FAIL, "rb->elements is null");
 
+    if (rb->is_spsc)
+    {
+        if (_spsc_free(rb) == 0) return RB_FAIL;
+        _store_release(&rb->tail, rb->tail + 1);
+        return RB_OK;
+    }
+
     if (ringbuf_full(rb)) _increase_rb(rb, &rb->start, &rb->s_msb);
 
     _increase_rb(rb, &rb->end, &rb->e_msb);
@@ -101,6 +211,8 @@ int ringbuf_write(struct ringbuf* rb, void* input)
     CHECK_IF(input == NULL, return RB_FAIL, "input is null");
     // ringbuf_pre_write will do the rest input checks
 
+    if (rb && rb->is_spsc) return (_spsc_write_n(rb, input, 1) == 1) ? RB_OK : RB_FAIL;
+
     void* elem = ringbuf_pre_write(rb);
     if (elem == NULL) return RB_FAIL;
 
@@ -114,6 +226,12 @@ void* ringbuf_pre_read(struct ringbuf* rb)
     CHECK_IF(rb->size <= 0, return NULL, "rb->size = %d invalid", rb->size);
     CHECK_IF(rb->elements == NULL, return NULL, "rb->elements is null");
 
+    if (rb->is_spsc)
+    {
+        if (_spsc_used(rb) == 0) return NULL;
+        return rb->elements + rb->elem_size * (rb->head & rb->mask);
+    }
+
     if (ringbuf_empty(rb)) return NULL;
 
     return rb->elements + rb->elem_size * rb->start;
@@ -125,6 +243,13 @@ int ringbuf_post_read(struct ringbuf* rb)
     CHECK_IF(rb->size <= 0, return RB_FAIL, "rb->size = %d invalid", rb->size);
     CHECK_IF(rb->elements == NULL, return RB_FAIL, "rb->elements is null");
 
+    if (rb->is_spsc)
+    {
+        if (_spsc_used(rb) == 0) return RB_FAIL;
+        _store_release(&rb->head, rb->head + 1);
+        return RB_OK;
+    }
+
     if (ringbuf_empty(rb)) return RB_FAIL;
 
     _increase_rb(rb, &rb->start, &rb->s_msb);
@@ -136,6 +261,8 @@ int ringbuf_read(struct ringbuf* rb, void* output)
     CHECK_IF(output == NULL, return RB_FAIL, "output is null");
     // ringbuf_pre_read will do the rest input checks
 
+    if (rb && rb->is_spsc) return (_spsc_read_n(rb, output, 1) == 1) ? RB_OK : RB_FAIL;
+
     void* elem = ringbuf_pre_read(rb);
     if (elem == NULL) return RB_FAIL;
 
@@ -143,11 +270,45 @@ int ringbuf_read(struct ringbuf* rb, void* output)
     return ringbuf_post_read(rb);
 }
 
+int ringbuf_write_n(struct ringbuf* rb, void* input, int num)
+{
+    CHECK_IF(rb == NULL, return 0, "rb is null");
+    CHECK_IF(input == NULL, return 0, "input is null");
+    CHECK_IF(num < 0, return 0, "num = %d invalid", num);
+
+    if (rb->is_spsc) return _spsc_write_n(rb, input, num);
+
+    int i;
+    for (i=0; i<num; i++)
+    {
+        if (ringbuf_write(rb, input + rb->elem_size * i) != RB_OK) break;
+    }
+    return i;
+}
+
+int ringbuf_read_n(struct ringbuf* rb, void* output, int num)
+{
+    CHECK_IF(rb == NULL, return 0, "rb is null");
+    CHECK_IF(output == NULL, return 0, "output is null");
+    CHECK_IF(num < 0, return 0, "num = %d invalid", num);
+
+    if (rb->is_spsc) return _spsc_read_n(rb, output, num);
+
+    int i;
+    for (i=0; i<num; i++)
+    {
+        if (ringbuf_empty(rb)) break;
+        ringbuf_read(rb, output + rb->elem_size * i);
+    }
+    return i;
+}
+
 void* ringbuf_tail(struct ringbuf* rb)
 {
     CHECK_IF(rb == NULL, return NULL, "rb is null");
     CHECK_IF(rb->size <= 0, return NULL, "rb->size = %d invalid", rb->size);
     CHECK_IF(rb->elements == NULL, return NULL, "rb->elements is null");
+    CHECK_IF(rb->is_spsc, return NULL, "not supported in spsc mode");
 
     if (rb->end == 0) rb->elements + rb->elem_size * (rb->size - 1);
 
@@ -160,6 +321,7 @@ void* ringbuf_prev(struct ringbuf* rb, void* elem)
     CHECK_IF(elem == NULL, return NULL, "elem is null");
     CHECK_IF(rb->size <= 0, return NULL, "rb->size = %d invalid", rb->size);
     CHECK_IF(rb->elements == NULL, return NULL, "rb->elements is null");
+    CHECK_IF(rb->is_spsc, return NULL, "not supported in spsc mode");
 
     if (rb->elements == elem) return rb->elements + rb->elem_size * (rb->size - 1);
 
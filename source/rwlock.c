@@ -0,0 +1,173 @@
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "rwlock.h"
+
+#define RW_RINC  (0x100)
+#define RW_WBITS (0x3)
+#define RW_PRES  (0x2)
+#define RW_PHID  (0x1)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() atom_sync()
+#endif
+
+#define LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+
+static void _futex_wait(unsigned int* addr, unsigned int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+// the changed word is published before sleepers is read, so a waiter either sees it or is woken
+static void _wake(unsigned int* addr, int* sleepers)
+{
+    if (LOAD(sleepers) > 0) syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// equal = 1 : wait until (*addr & mask) == val, equal = 0 : wait while it is
+static void _wait(unsigned int* addr, unsigned int mask, unsigned int val, int equal, int* sleepers)
+{
+    unsigned int cur;
+    int i;
+    for (i=0; ; i++)
+    {
+        cur = __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+        if (((cur & mask) == val) == equal) return;
+
+        if (i < RWLOCK_SPIN)
+        {
+            cpu_relax();
+            continue;
+        }
+        if (i < RWLOCK_SPIN + RWLOCK_YIELD)
+        {
+            sched_yield();
+            continue;
+        }
+
+        __atomic_add_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+        cur = LOAD(addr);
+        if (((cur & mask) == val) != equal) _futex_wait(addr, cur);
+        __atomic_sub_fetch(sleepers, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void rwlock_init(struct rwlock* lock)
+{
+    memset(lock, 0, sizeof(struct rwlock));
+}
+
+void rwlock_rlock(struct rwlock* lock)
+{
+    // a present writer holds the phase, wait for the phase bits to change
+    unsigned int w = __atomic_fetch_add(&lock->rin, RW_RINC, __ATOMIC_SEQ_CST) & RW_WBITS;
+    if (w != 0) _wait(&lock->rin, RW_WBITS, w, 0, &lock->rsleep);
+}
+
+void rwlock_runlock(struct rwlock* lock)
+{
+    // only the last reader the writer waits for needs to wake it
+    unsigned int rout = __atomic_add_fetch(&lock->rout, RW_RINC, __ATOMIC_SEQ_CST);
+    if (rout == LOAD(&lock->drain_rout)) _wake(&lock->rout, &lock->dsleep);
+}
+
+void rwlock_wlock(struct rwlock* lock)
+{
+    unsigned int ticket = __atomic_fetch_add(&lock->win, 1, __ATOMIC_SEQ_CST);
+    _wait(&lock->wout, UINT_MAX, ticket, 1, &lock->wsleep);
+
+    // block new readers, then wait for the ones already in
+    unsigned int w = RW_PRES | (ticket & RW_PHID);
+    unsigned int rticket = __atomic_fetch_add(&lock->rin, w, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&lock->drain_rout, rticket, __ATOMIC_SEQ_CST);
+    _wait(&lock->rout, UINT_MAX, rticket, 1, &lock->dsleep);
+}
+
+void rwlock_wunlock(struct rwlock* lock)
+{
+    __atomic_fetch_and(&lock->rin, ~RW_WBITS, __ATOMIC_SEQ_CST);
+    _wake(&lock->rin, &lock->rsleep);
+
+    __atomic_add_fetch(&lock->wout, 1, __ATOMIC_SEQ_CST);
+    _wake(&lock->wout, &lock->wsleep);
+}
+
+void brlock_init(struct brlock* lock)
+{
+    memset(lock, 0, sizeof(struct brlock));
+    rwlock_init(&lock->wlock);
+}
+
+static void _br_leave(struct brlock* lock, int slot)
+{
+    __atomic_sub_fetch(&lock->slots[slot].cnt, 1, __ATOMIC_SEQ_CST);
+    if (LOAD(&lock->writer))
+    {
+        __atomic_add_fetch(&lock->drain, 1, __ATOMIC_SEQ_CST);
+        _wake(&lock->drain, &lock->wsleep);
+    }
+}
+
+int brlock_rlock(struct brlock* lock)
+{
+    int cpu  = sched_getcpu();
+    int slot = (cpu > 0) ? (cpu % BRLOCK_SLOTS) : 0;
+    while (1)
+    {
+        __atomic_add_fetch(&lock->slots[slot].cnt, 1, __ATOMIC_SEQ_CST);
+        if (LOAD(&lock->writer) == 0) return slot;
+
+        // a writer is draining the slots, step back until it is done
+        _br_leave(lock, slot);
+        _wait(&lock->writer, UINT_MAX, 0, 1, &lock->rsleep);
+    }
+}
+
+void brlock_runlock(struct brlock* lock, int slot)
+{
+    _br_leave(lock, slot);
+}
+
+void brlock_wlock(struct brlock* lock)
+{
+    rwlock_wlock(&lock->wlock);
+    __atomic_store_n(&lock->writer, 1, __ATOMIC_SEQ_CST);
+
+    int i, j;
+    unsigned int drain;
+    for (i=0; i<BRLOCK_SLOTS; i++)
+    {
+        for (j=0; LOAD(&lock->slots[i].cnt) != 0; j++)
+        {
+            if (j < RWLOCK_SPIN)
+            {
+                cpu_relax();
+                continue;
+            }
+            if (j < RWLOCK_SPIN + RWLOCK_YIELD)
+            {
+                sched_yield();
+                continue;
+            }
+
+            __atomic_add_fetch(&lock->wsleep, 1, __ATOMIC_SEQ_CST);
+            drain = LOAD(&lock->drain);
+            if (LOAD(&lock->slots[i].cnt) != 0) _futex_wait(&lock->drain, drain);
+            __atomic_sub_fetch(&lock->wsleep, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void brlock_wunlock(struct brlock* lock)
+{
+    __atomic_store_n(&lock->writer, 0, __ATOMIC_SEQ_CST);
+    _wake(&lock->writer, &lock->rsleep);
+    rwlock_wunlock(&lock->wlock);
+}
@@ -2,8 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <malloc.h>
 
 #include "service.h"
 #include "thread.h"
@@ -23,6 +29,225 @@
 static struct map _services;
 static bool _running = false;
 
+// M:N mode : watched fds of all services share one epoll, runnable services go to a work stealing pool
+static bool _is_mn = false;
+static int  _worker_num = 0;
+static struct thread_pool _pool;
+static int  _epfd   = -1;
+static int  _stopfd = -1;
+static bool _mn_running = false;
+
+#define MN_STOP_KEY (0) // epoll key of _stopfd, service ids are never 0
+#define MN_KEY(sid, wid) (((uint64_t)(sid) << 32) | (wid))
+
+//////////////////////////////////////// message pool
+
+// the payload starts the malloced block and the header sits at its end,
+// so a payload kept with RET_DONTFREE is still released with free()
+struct msg_cache
+{
+    void* head[SERV_MSG_CLASSES]; // blocks linked through their first word
+    int num[SERV_MSG_CLASSES];
+};
+
+struct msg_depot
+{
+    pthread_mutex_t lock;
+    void* batches[SERV_MSG_DEPOT]; // each a list of SERV_MSG_BATCH blocks
+    int num;
+};
+
+static const int _msg_sizes[SERV_MSG_CLASSES] = {128, 512, 2048, 8192};
+static struct msg_depot _depots[SERV_MSG_CLASSES] =
+{
+    {.lock = PTHREAD_MUTEX_INITIALIZER}, {.lock = PTHREAD_MUTEX_INITIALIZER},
+    {.lock = PTHREAD_MUTEX_INITIALIZER}, {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+static __thread struct msg_cache _cache;
+static __thread bool _cache_used = false;
+static pthread_key_t  _cache_key;
+static pthread_once_t _cache_once = PTHREAD_ONCE_INIT;
+
+static struct service_msg* _msg_head(void* block)
+{
+    uintptr_t end = (uintptr_t)block + malloc_usable_size(block) - sizeof(struct service_msg);
+    return (struct service_msg*)(end & ~(uintptr_t)(sizeof(void*) - 1));
+}
+
+static void _free_list(void* b)
+{
+    void* next;
+    while (b)
+    {
+        next = *(void**)b;
+        free(b);
+        b = next;
+    }
+}
+
+// move num blocks from the head of the thread cache to the depot
+static void _cache_spill(int cls, int num)
+{
+    void* head = _cache.head[cls];
+    void* last = head;
+    int i;
+    for (i=1; i<num; i++)
+    {
+        last = *(void**)last;
+    }
+    _cache.head[cls] = *(void**)last;
+    _cache.num[cls] -= num;
+    *(void**)last = NULL;
+
+    struct msg_depot* d = &_depots[cls];
+    pthread_mutex_lock(&d->lock);
+    if (d->num < SERV_MSG_DEPOT)
+    {
+        d->batches[d->num++] = head;
+        head = NULL;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    _free_list(head);
+}
+
+// a finished thread hands its cache over to the depot
+static void _cache_exit(void* arg)
+{
+    int cls;
+    for (cls=0; cls<SERV_MSG_CLASSES; cls++)
+    {
+        while (_cache.num[cls] >= SERV_MSG_BATCH)
+        {
+            _cache_spill(cls, SERV_MSG_BATCH);
+        }
+        _free_list(_cache.head[cls]);
+        _cache.head[cls] = NULL;
+        _cache.num[cls]  = 0;
+    }
+}
+
+static void _cache_key_init(void)
+{
+    pthread_key_create(&_cache_key, _cache_exit);
+}
+
+// the key destructor only runs for threads that set it
+static void _cache_use(void)
+{
+    if (_cache_used) return;
+    _cache_used = true;
+    pthread_once(&_cache_once, _cache_key_init);
+    pthread_setspecific(_cache_key, &_cache);
+}
+
+// a message with room for size bytes of payload
+static struct service_msg* _msg_get(int size)
+{
+    int need = size + sizeof(struct service_msg) + sizeof(void*); // and the alignment of the header
+    int cls = 0;
+    while ((cls < SERV_MSG_CLASSES) && (_msg_sizes[cls] < need))
+    {
+        cls++;
+    }
+
+    void* b = NULL;
+    if (cls == SERV_MSG_CLASSES)
+    {
+        b = malloc(need);
+        CHECK_IF(b == NULL, return NULL, "malloc failed");
+        cls = -1;
+    }
+    else
+    {
+        if (_cache.head[cls] == NULL)
+        {
+            _cache_use();
+
+            struct msg_depot* d = &_depots[cls];
+            pthread_mutex_lock(&d->lock);
+            if (d->num > 0)
+            {
+                _cache.head[cls] = d->batches[--d->num];
+                _cache.num[cls]  = SERV_MSG_BATCH;
+            }
+            pthread_mutex_unlock(&d->lock);
+        }
+
+        b = _cache.head[cls];
+        if (b)
+        {
+            _cache.head[cls] = *(void**)b;
+            _cache.num[cls]--;
+        }
+        else
+        {
+            b = malloc(_msg_sizes[cls]);
+            CHECK_IF(b == NULL, return NULL, "malloc failed");
+        }
+    }
+
+    struct service_msg* m = _msg_head(b);
+    m->block  = b;
+    m->msg    = b;
+    m->cls    = cls;
+    m->is_ref = false;
+    m->is_reply = false;
+    return m;
+}
+
+static void _msg_put(struct service_msg* m)
+{
+    int cls = m->cls;
+    void* b = m->block;
+    if (cls < 0)
+    {
+        free(b);
+        return;
+    }
+
+    _cache_use();
+    *(void**)b = _cache.head[cls];
+    _cache.head[cls] = b;
+    _cache.num[cls]++;
+
+    // messages usually die on another thread than they were born, keep the caches level
+    if (_cache.num[cls] >= 2 * SERV_MSG_BATCH)
+    {
+        _cache_spill(cls, SERV_MSG_BATCH);
+    }
+}
+
+static void _depot_clear(void)
+{
+    int cls;
+    for (cls=0; cls<SERV_MSG_CLASSES; cls++)
+    {
+        struct msg_depot* d = &_depots[cls];
+        pthread_mutex_lock(&d->lock);
+        while (d->num > 0)
+        {
+            _free_list(d->batches[--d->num]);
+        }
+        pthread_mutex_unlock(&d->lock);
+    }
+}
+
+void* service_msg_alloc(int size)
+{
+    CHECK_IF(size < 0, return NULL, "size = %d invalid", size);
+
+    struct service_msg* m = _msg_get(size);
+    CHECK_IF(m == NULL, return NULL, "_msg_get failed");
+    return m->msg;
+}
+
+void service_msg_free(void* msg)
+{
+    if (msg == NULL) return;
+    _msg_put(_msg_head(msg));
+}
+
 static void _clean_watcher(void* input)
 {
     if (input)
@@ -33,109 +258,902 @@ static void _clean_watcher(void* input)
     }
 }
 
-static void _clean_service(void* input)
+// name index : open addressing, insert only, readers never lock.
+// a grown table is published with one store, old ones are kept until uninit
+struct name_table
+{
+    unsigned int mask;
+    struct name_table* retired;
+    struct service_name* slots[];
+};
+
+static struct name_table* _names = NULL;
+static pthread_mutex_t _names_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _names_num = 0;
+
+static unsigned int _hashfn(char* key)
+{
+    unsigned int hv = 2166136261u;
+    unsigned char* p;
+    for (p = (unsigned char*)key; *p; p++)
+    {
+        hv ^= *p;
+        hv *= 16777619u;
+    }
+    hv ^= hv >> 16;
+    hv *= 0x85ebca6bu;
+    hv ^= hv >> 13;
+    hv *= 0xc2b2ae35u;
+    hv ^= hv >> 16;
+    return hv;
+}
+
+static struct service_name* _name_find(struct name_table* t, char* name, unsigned int hashv)
+{
+    if (t == NULL) return NULL;
+
+    unsigned int pos = hashv & t->mask;
+    struct service_name* n;
+    while ((n = __atomic_load_n(&t->slots[pos], __ATOMIC_ACQUIRE)) != NULL)
+    {
+        if ((n->hashv == hashv) && (strcmp(n->name, name) == 0)) return n;
+        pos = (pos + 1) & t->mask;
+    }
+    return NULL;
+}
+
+static void _name_put(struct name_table* t, struct service_name* n)
+{
+    unsigned int pos = n->hashv & t->mask;
+    while (t->slots[pos])
+    {
+        pos = (pos + 1) & t->mask;
+    }
+    __atomic_store_n(&t->slots[pos], n, __ATOMIC_RELEASE);
+}
+
+static struct name_table* _name_table(unsigned int size)
+{
+    struct name_table* t = calloc(sizeof(struct name_table) + sizeof(struct service_name*) * size, 1);
+    CHECK_IF(t == NULL, return NULL, "calloc failed");
+    t->mask = size - 1;
+    return t;
+}
+
+// find or add, names are cut to SERVICE_NAME_SIZE like service_create does
+static struct service_name* _name_intern(char* name)
+{
+    char key[SERVICE_NAME_SIZE+1];
+    snprintf(key, sizeof(key), "%s", name);
+    unsigned int hashv = _hashfn(key);
+
+    struct service_name* n = _name_find(__atomic_load_n(&_names, __ATOMIC_ACQUIRE), key, hashv);
+    if (n) return n;
+
+    pthread_mutex_lock(&_names_lock);
+    struct name_table* t = _names;
+    n = _name_find(t, key, hashv);
+    if (n) goto _END;
+
+    if ((t == NULL) || ((unsigned int)(_names_num + 1) * 2 > t->mask + 1))
+    {
+        struct name_table* newt = _name_table(t ? (t->mask + 1) * 2 : SERV_NAME_INIT);
+        CHECK_IF(newt == NULL, goto _END, "_name_table failed");
+
+        unsigned int i;
+        for (i=0; t && (i<=t->mask); i++)
+        {
+            if (t->slots[i]) _name_put(newt, t->slots[i]);
+        }
+        newt->retired = t;
+        __atomic_store_n(&_names, newt, __ATOMIC_RELEASE);
+        t = newt;
+    }
+
+    n = calloc(sizeof(struct service_name), 1);
+    CHECK_IF(n == NULL, goto _END, "calloc failed");
+    n->hashv = hashv;
+    n->id    = INVALID_ID;
+    memcpy(n->name, key, sizeof(key));
+    _name_put(t, n);
+    _names_num++;
+
+_END:
+    pthread_mutex_unlock(&_names_lock);
+    return n;
+}
+
+static void _names_clear(void)
+{
+    pthread_mutex_lock(&_names_lock);
+    struct name_table* t = _names;
+    struct name_table* next;
+    unsigned int i;
+    for (i=0; t && (i<=t->mask); i++)
+    {
+        free(t->slots[i]);
+    }
+    for (; t; t = next)
+    {
+        next = t->retired;
+        free(t);
+    }
+    _names     = NULL;
+    _names_num = 0;
+    pthread_mutex_unlock(&_names_lock);
+}
+
+static void _free_wheel(struct service_wheel* wh);
+
+static void _clean_service(void* input)
+{
+    if (input)
+    {
+        struct service* s = (struct service*)input;
+        fqueue_release(s->mq);
+        if (s->evq) fqueue_release(s->evq);
+        map_uninit(&s->watchers);
+        free(s->calls.slots);
+        _free_wheel(s->wheel);
+        free(s);
+    }
+}
+
+int service_system_init(void)
+{
+    _is_mn = false;
+    return map_init_ex(&_services, _clean_service, MAP_FLAG_LOCKFREE);
+}
+
+int service_system_init_ex(int worker_num)
+{
+    int chk = map_init_ex(&_services, _clean_service, MAP_FLAG_LOCKFREE);
+    CHECK_IF(chk != MAP_OK, return SERV_FAIL, "map_init_ex failed");
+
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    CHECK_IF(_epfd < 0, goto _ERROR, "epoll_create1 failed");
+
+    _stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_IF(_stopfd < 0, goto _ERROR, "eventfd failed");
+
+    struct epoll_event tmp = {.events = EPOLLIN, .data.u64 = MN_STOP_KEY};
+    chk = epoll_ctl(_epfd, EPOLL_CTL_ADD, _stopfd, &tmp);
+    CHECK_IF(chk < 0, goto _ERROR, "epoll_ctl stopfd failed");
+
+    _is_mn      = true;
+    _worker_num = worker_num;
+    return SERV_OK;
+
+_ERROR:
+    if (_epfd >= 0) close(_epfd);
+    if (_stopfd >= 0) close(_stopfd);
+    _epfd = _stopfd = -1;
+    map_uninit(&_services);
+    return SERV_FAIL;
+}
+
+void service_system_uninit(void)
+{
+    if (_running) service_system_break();
+    map_uninit(&_services);
+
+    if (_is_mn)
+    {
+        close(_epfd);
+        close(_stopfd);
+        _epfd = _stopfd = -1;
+        _is_mn = false;
+    }
+
+    _cache_exit(NULL);
+    _depot_clear();
+    _names_clear();
+}
+
+// ids of all services, free() it after use
+static int _list_services(serviceid** pids)
+{
+    int max = _services.max_num;
+    serviceid* ids = malloc(sizeof(serviceid) * max);
+    CHECK_IF(ids == NULL, return 0, "malloc failed");
+
+    *pids = ids;
+    return map_list(&_services, ids, max);
+}
+
+static void _service_run(void* arg);
+static int _commit(serviceid dst, struct service_msg* qmsg);
+
+// wake a service up, it is queued once however often this is called before it runs
+static void _schedule(struct service* s)
+{
+    if (!__atomic_load_n(&_mn_running, __ATOMIC_ACQUIRE)) return;
+
+    int st = __atomic_load_n(&s->sched, __ATOMIC_ACQUIRE);
+    int next;
+    while ((st == SERV_ST_IDLE) || (st == SERV_ST_RUNNING))
+    {
+        next = (st == SERV_ST_IDLE) ? SERV_ST_QUEUED : SERV_ST_NOTIFIED;
+        if (__atomic_compare_exchange_n(&s->sched, &st, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+        {
+            if (next == SERV_ST_QUEUED) thread_pool_submit(&_pool, _service_run, s, NULL);
+            return;
+        }
+    }
+}
+
+static int _watch_fd(struct service* s, int fd, watchid wid)
+{
+    if (_is_mn)
+    {
+        // oneshot, the service re-arms it after the callback, so a fd never runs on two workers
+        struct epoll_event tmp = {.events = EPOLLIN | EPOLLONESHOT, .data.u64 = MN_KEY(s->id, wid)};
+        return epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &tmp);
+    }
+
+    struct epoll_event tmp = {.events = EPOLLIN, .data.u64 = wid};
+    return epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &tmp);
+}
+
+static void _unwatch_fd(struct service* s, int fd)
+{
+    struct epoll_event tmp = {};
+    epoll_ctl(_is_mn ? _epfd : s->epfd, EPOLL_CTL_DEL, fd, &tmp);
+}
+
+static void _stop_watching(serviceid sid, void* db, int fd, void* arg)
+{
+    struct service* s = (struct service*)arg;
+    if (fd == s->stopfd)
+    {
+        eventfd_t val;
+        eventfd_read(fd, &val);
+        s->watching = false;
+    }
+    return;
+}
+
+static long _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+#define STAT_ADD(field, val) __atomic_store_n(&(field), (field) + (val), __ATOMIC_RELAXED)
+#define STAT_MAX(field, val) if ((val) > (field)) __atomic_store_n(&(field), (val), __ATOMIC_RELAXED)
+
+//////////////////////////////////////// calls
+
+static void _dl_remove(struct service_calls* calls, int idx)
+{
+    struct service_call* c = &calls->slots[idx];
+    if (c->prev >= 0) calls->slots[c->prev].next = c->next;
+    else              calls->dl_head = c->next;
+    if (c->next >= 0) calls->slots[c->next].prev = c->prev;
+    else              calls->dl_tail = c->prev;
+}
+
+// deadlines mostly grow, so search from the tail
+static void _dl_insert(struct service_calls* calls, int idx)
+{
+    struct service_call* c = &calls->slots[idx];
+    int pos = calls->dl_tail;
+    while ((pos >= 0) && (calls->slots[pos].deadline > c->deadline))
+    {
+        pos = calls->slots[pos].prev;
+    }
+
+    c->prev = pos;
+    c->next = (pos >= 0) ? calls->slots[pos].next : calls->dl_head;
+    if (c->prev >= 0) calls->slots[c->prev].next = idx;
+    else              calls->dl_head = idx;
+    if (c->next >= 0) calls->slots[c->next].prev = idx;
+    else              calls->dl_tail = idx;
+}
+
+static int _call_new(struct service_calls* calls)
+{
+    if (calls->free_head < 0)
+    {
+        int size = calls->size ? calls->size * 2 : 64;
+        CHECK_IF(size > (1 << SERV_CALL_SLOT_BITS), return -1, "too many calls in flight");
+
+        struct service_call* slots = realloc(calls->slots, sizeof(struct service_call) * size);
+        CHECK_IF(slots == NULL, return -1, "realloc failed");
+
+        int i;
+        for (i=calls->size; i<size; i++)
+        {
+            slots[i].seq  = 0;
+            slots[i].cb   = NULL;
+            slots[i].next = (i + 1 < size) ? i + 1 : -1;
+        }
+        calls->free_head = calls->size;
+        calls->slots     = slots;
+        calls->size      = size;
+    }
+
+    int idx = calls->free_head;
+    struct service_call* c = &calls->slots[idx];
+    calls->free_head = c->next;
+    calls->num++;
+
+    // 1 ~ 2047, so sessions stay positive
+    c->seq = (c->seq % 2047) + 1;
+    return idx;
+}
+
+static void _call_free(struct service_calls* calls, int idx)
+{
+    struct service_call* c = &calls->slots[idx];
+    if (c->deadline) _dl_remove(calls, idx);
+    c->cb   = NULL;
+    c->next = calls->free_head;
+    calls->free_head = idx;
+    calls->num--;
+}
+
+static void _call_tick(serviceid sid, void* db, void* arg)
+{
+    struct service* s = (struct service*)arg;
+    struct service_calls* calls = &s->calls;
+    long now = _now_ns();
+
+    int idx;
+    struct service_call* c;
+    service_reply_cb cb;
+    void* cbarg;
+    while ((calls->dl_head >= 0) && (calls->slots[calls->dl_head].deadline <= now))
+    {
+        idx   = calls->dl_head;
+        c     = &calls->slots[idx];
+        cb    = c->cb;
+        cbarg = c->arg;
+        _call_free(calls, idx);
+
+        cb(s->id, s->db, SERV_CALL_TIMEOUT, NULL, 0, cbarg);
+    }
+
+    if ((calls->dl_head < 0) && (calls->timer != INVALID_ID))
+    {
+        service_stop_timer(s->id, calls->timer);
+        calls->timer = INVALID_ID;
+    }
+}
+
+// a late reply finds its slot reused with another seq and is dropped
+static ret_t _call_reply(struct service* s, struct service_msg* qmsg)
+{
+    struct service_calls* calls = &s->calls;
+    int session = qmsg->session;
+    int idx = session & ((1 << SERV_CALL_SLOT_BITS) - 1);
+    int seq = session >> SERV_CALL_SLOT_BITS;
+    if ((idx >= calls->size) || (calls->slots[idx].cb == NULL) || (calls->slots[idx].seq != seq)) return RET_OK;
+
+    struct service_call* c = &calls->slots[idx];
+    service_reply_cb cb = c->cb;
+    void* arg = c->arg;
+    _call_free(calls, idx);
+
+    return cb(s->id, s->db, SERV_CALL_OK, qmsg->msg, qmsg->msglen, arg);
+}
+
+int service_call(serviceid src, serviceid dst, void* msg, int msglen, int timeout_ms, service_reply_cb cb, void* arg)
+{
+    CHECK_IF(cb == NULL, return SERV_FAIL, "cb is null");
+
+    struct service* s = map_grab(&_services, src);
+    CHECK_IF(s == NULL, return SERV_FAIL, "map_grab service with id = %d failed", src);
+
+    struct service_calls* calls = &s->calls;
+    int idx = _call_new(calls);
+    CHECK_IF(idx < 0, goto _ERROR, "_call_new failed");
+
+    struct service_call* c = &calls->slots[idx];
+    c->cb       = cb;
+    c->arg      = arg;
+    c->deadline = 0;
+    if (timeout_ms > 0)
+    {
+        c->deadline = _now_ns() + timeout_ms * 1000000L;
+        _dl_insert(calls, idx);
+
+        if (calls->timer == INVALID_ID)
+        {
+            calls->timer = service_start_timer(src, SERV_CALL_TICK_MS, SERV_CALL_TICK_MS, _call_tick, s);
+        }
+    }
+
+    int session = (c->seq << SERV_CALL_SLOT_BITS) | idx;
+    if (service_send(src, dst, TAG_COPY, session, msg, msglen) < 0)
+    {
+        _call_free(calls, idx);
+        goto _ERROR;
+    }
+
+    map_release(&_services, src);
+    return session;
+
+_ERROR:
+    map_release(&_services, src);
+    return SERV_FAIL;
+}
+
+int service_reply(serviceid self, serviceid dst, int session, void* msg, int msglen)
+{
+    CHECK_IF(session <= 0, return SERV_FAIL, "session = %d is not a call", session);
+    CHECK_IF(self == INVALID_ID, return SERV_FAIL, "self is INVALID_ID");
+    CHECK_IF(dst == INVALID_ID, return SERV_FAIL, "dst is INVALID_ID");
+    CHECK_IF(msg == NULL, return SERV_FAIL, "msg is null");
+    CHECK_IF(msglen < 0, return SERV_FAIL, "msglen = %d invalid", msglen);
+
+    struct service_msg* qmsg = _msg_get(msglen);
+    CHECK_IF(qmsg == NULL, return SERV_FAIL, "_msg_get failed");
+    memcpy(qmsg->msg, msg, msglen);
+    qmsg->session  = session;
+    qmsg->src      = self;
+    qmsg->msglen   = msglen;
+    qmsg->is_reply = true;
+
+    return _commit(dst, qmsg);
+}
+
+// one turn of the mailbox, return true when the budget ran out before the messages did
+static bool _handle_msgs(struct service* s)
+{
+    int max_msgs = __atomic_load_n(&s->budget_msgs, __ATOMIC_RELAXED);
+    long max_ns  = __atomic_load_n(&s->budget_us, __ATOMIC_RELAXED) * 1000L;
+    long start   = (max_ns > 0) ? _now_ns() : 0;
+
+    struct service_stats* st = &s->stats;
+    struct service_msg *qmsg;
+    ret_t ret;
+    int num = 0;
+    bool is_cut = false;
+    bool is_sample;
+    bool is_ref;
+    long t0 = 0;
+    long now = start;
+    while ((qmsg = fqueue_pop(s->mq)) != NULL)
+    {
+        // a time budget reads the clock after every message, the latency stats sample one of SERV_LAT_SAMPLE
+        is_sample = (num % SERV_LAT_SAMPLE == 0);
+        if (is_sample) t0 = (max_ns > 0) ? now : _now_ns();
+
+        // a kept pooled payload takes its header along, it may be gone once the handler returns
+        is_ref = qmsg->is_ref;
+        if (qmsg->is_reply) ret = _call_reply(s, qmsg);
+        else                ret = s->handlemsg(s->id, s->db, qmsg->session, qmsg->src, qmsg->msg, qmsg->msglen);
+        if (ret != RET_DONTFREE)
+        {
+            if (is_ref) free(qmsg->msg);
+            _msg_put(qmsg);
+        }
+        else if (is_ref)
+        {
+            _msg_put(qmsg); // the handler keeps only the payload
+        }
+        num++;
+
+        if (is_sample || (max_ns > 0)) now = _now_ns();
+        if (is_sample)
+        {
+            STAT_ADD(st->lat_samples, 1);
+            STAT_ADD(st->lat_total_ns, now - t0);
+            STAT_MAX(st->lat_max_ns, now - t0);
+        }
+        if ((max_ns > 0) && (now - start >= max_ns))
+        {
+            is_cut = true;
+            break;
+        }
+        if ((max_msgs > 0) && (num >= max_msgs))
+        {
+            is_cut = true;
+            break;
+        }
+    }
+
+    int left = __atomic_sub_fetch(&st->depth, num, __ATOMIC_RELAXED);
+    STAT_ADD(st->msgs, num);
+    STAT_ADD(st->turns, 1);
+    STAT_MAX(st->max_batch, num);
+    is_cut = is_cut && (left > 0);
+    if (is_cut) STAT_ADD(st->budget_hits, 1);
+    return is_cut;
+}
+
+static void _dequeue(serviceid sid, void* db, int fd, void* arg)
+{
+    struct service* s = (struct service*)arg;
+    if (fd == s->qfd)
+    {
+        eventfd_t val;
+        eventfd_read(fd, &val);
+
+        // sends from now on must wake us again
+        __atomic_store_n(&s->qwake, 0, __ATOMIC_SEQ_CST);
+        if (_handle_msgs(s) && (__atomic_exchange_n(&s->qwake, 1, __ATOMIC_SEQ_CST) == 0))
+        {
+            // out of budget, come back after the other fds of this round
+            val = 1;
+            eventfd_write(fd, val);
+        }
+    }
+    return;
+}
+
+static void _clean_qmsg(void* input)
+{
+    struct service_msg* qmsg = (struct service_msg*)input;
+    if (input)
+    {
+        if (qmsg->is_ref && qmsg->msg) free(qmsg->msg);
+        _msg_put(qmsg);
+    }
+}
+
+static int _commit(serviceid dst, struct service_msg* qmsg)
+{
+    int msglen = qmsg->msglen;
+    struct service* s = map_grab(&_services, dst);
+    if (s == NULL)
+    {
+        _clean_qmsg(qmsg);
+        derror("map_grab service with id = %d failed", dst);
+        return -1;
+    }
+
+    int depth = __atomic_add_fetch(&s->stats.depth, 1, __ATOMIC_RELAXED);
+    if (depth > __atomic_load_n(&s->stats.max_depth, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&s->stats.max_depth, depth, __ATOMIC_RELAXED);
+    }
+
+    fqueue_push(s->mq, qmsg);
+    if (_is_mn)
+    {
+        _schedule(s);
+    }
+    else if (__atomic_exchange_n(&s->qwake, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        eventfd_t val = 1;
+        eventfd_write(s->qfd, val);
+    }
+
+    map_release(&_services, dst);
+    return msglen;
+}
+
+int service_set_budget(serviceid sid, int max_msgs, int max_us)
 {
-    if (input)
+    struct service* s = map_grab(&_services, sid);
+    CHECK_IF(s == NULL, return SERV_FAIL, "map_grab service with id = %d failed", sid);
+
+    __atomic_store_n(&s->budget_msgs, (max_msgs > 0) ? max_msgs : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->budget_us, (max_us > 0) ? max_us : 0, __ATOMIC_RELAXED);
+
+    map_release(&_services, sid);
+    return SERV_OK;
+}
+
+int service_get_stats(serviceid sid, struct service_stats* stats)
+{
+    CHECK_IF(stats == NULL, return SERV_FAIL, "stats is null");
+
+    struct service* s = map_grab(&_services, sid);
+    CHECK_IF(s == NULL, return SERV_FAIL, "map_grab service with id = %d failed", sid);
+
+    struct service_stats* st = &s->stats;
+    stats->msgs         = __atomic_load_n(&st->msgs, __ATOMIC_RELAXED);
+    stats->turns        = __atomic_load_n(&st->turns, __ATOMIC_RELAXED);
+    stats->budget_hits  = __atomic_load_n(&st->budget_hits, __ATOMIC_RELAXED);
+    stats->depth        = __atomic_load_n(&st->depth, __ATOMIC_RELAXED);
+    stats->max_depth    = __atomic_load_n(&st->max_depth, __ATOMIC_RELAXED);
+    stats->max_batch    = __atomic_load_n(&st->max_batch, __ATOMIC_RELAXED);
+    stats->lat_samples  = __atomic_load_n(&st->lat_samples, __ATOMIC_RELAXED);
+    stats->lat_total_ns = __atomic_load_n(&st->lat_total_ns, __ATOMIC_RELAXED);
+    stats->lat_max_ns   = __atomic_load_n(&st->lat_max_ns, __ATOMIC_RELAXED);
+
+    map_release(&_services, sid);
+    return SERV_OK;
+}
+
+int service_send(serviceid src, serviceid dst, tag_t tag, int session, void* msg, int msglen)
+{
+    CHECK_IF(src == INVALID_ID, return -1, "src is INVALID_ID");
+    CHECK_IF(dst == INVALID_ID, return -1, "dst is INVALID_ID");
+    CHECK_IF(msg == NULL, return -1, "msg is null");
+
+    struct service_msg* qmsg;
+    if (tag == TAG_DONTCOPY)
     {
-        struct service* s = (struct service*)input;
-        fqueue_release(s->mq);
-        map_uninit(&s->watchers);
-        free(s);
+        qmsg = _msg_get(0);
+        CHECK_IF(qmsg == NULL, return -1, "_msg_get failed");
+        qmsg->msg    = msg;
+        qmsg->is_ref = true;
+    }
+    else
+    {
+        CHECK_IF(msglen < 0, return -1, "msglen = %d invalid", msglen);
+        qmsg = _msg_get(msglen);
+        CHECK_IF(qmsg == NULL, return -1, "_msg_get failed");
+        memcpy(qmsg->msg, msg, msglen);
     }
+    qmsg->session = session;
+    qmsg->src     = src;
+    qmsg->msglen  = msglen;
+
+    return _commit(dst, qmsg);
 }
 
-int service_system_init(void)
+int service_send_msg(serviceid src, serviceid dst, int session, void* msg, int msglen)
 {
-    return map_init(&_services, _clean_service);
+    CHECK_IF(msg == NULL, return -1, "msg is null");
+
+    struct service_msg* qmsg = _msg_head(msg);
+    CHECK_IF(src == INVALID_ID, goto _ERROR, "src is INVALID_ID");
+    CHECK_IF(dst == INVALID_ID, goto _ERROR, "dst is INVALID_ID");
+
+    qmsg->session = session;
+    qmsg->src     = src;
+    qmsg->msglen  = msglen;
+    return _commit(dst, qmsg);
+
+_ERROR:
+    _msg_put(qmsg);
+    return -1;
 }
 
-void service_system_uninit(void)
+//////////////////////////////////////// timers
+
+static uint64_t _now_ms(void)
 {
-    if (_running) service_system_break();
-    map_uninit(&_services);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static void _stop_watching(serviceid sid, void* db, int fd, void* arg)
+static void _tm_link(struct service_wheel* wh, struct service_timer* t)
 {
-    struct service* s = (struct service*)arg;
-    if (fd == s->stopfd)
+    uint64_t expire = (t->expire < wh->current) ? wh->current : t->expire;
+    uint64_t delta  = expire - wh->current;
+
+    int level;
+    for (level=0; level<SERV_TM_LEVELS-1; level++)
     {
-        eventfd_t val;
-        eventfd_read(fd, &val);
-        s->watching = false;
+        if (delta < ((uint64_t)1 << (SERV_TM_BITS * (level+1)))) break;
     }
-    return;
+
+    if (delta >= ((uint64_t)1 << (SERV_TM_BITS * SERV_TM_LEVELS)))
+    {
+        // farther than the wheel can hold, park it in the last slot and re-place it on cascade
+        expire = wh->current + ((uint64_t)1 << (SERV_TM_BITS * SERV_TM_LEVELS)) - 1;
+    }
+
+    struct service_timer** head = &wh->slots[level][(expire >> (SERV_TM_BITS * level)) & SERV_TM_MASK];
+    t->tm_next  = *head;
+    t->tm_pprev = head;
+    if (*head) (*head)->tm_pprev = &t->tm_next;
+    *head = t;
 }
 
-static void _dequeue(serviceid sid, void* db, int fd, void* arg)
+static void _tm_unlink(struct service_timer* t)
 {
-    struct service* s = (struct service*)arg;
-    if (fd == s->qfd)
+    *(t->tm_pprev) = t->tm_next;
+    if (t->tm_next) t->tm_next->tm_pprev = t->tm_pprev;
+    t->tm_next  = NULL;
+    t->tm_pprev = NULL;
+}
+
+static void _tm_cascade(struct service_wheel* wh, int level, int idx)
+{
+    struct service_timer* t = wh->slots[level][idx];
+    struct service_timer* next;
+    wh->slots[level][idx] = NULL;
+    for (; t; t = next)
     {
-        eventfd_t val;
-        eventfd_read(fd, &val);
+        next = t->tm_next;
+        _tm_link(wh, t);
+    }
+}
 
-        struct service_msg *qmsg;
-        ret_t ret;
-        FQUEUE_FOREACH(s->mq, qmsg)
+// the earliest tick worth waking up for, a slot of a higher level wakes us to cascade it
+static uint64_t _tm_next(struct service_wheel* wh)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t base;
+    int level, i, shift;
+    for (level=0; level<SERV_TM_LEVELS; level++)
+    {
+        shift = SERV_TM_BITS * level;
+        base  = wh->current >> shift;
+        for (i=0; i<=SERV_TM_SIZE; i++)
         {
-            if (s->handlemsg)
+            if (((base + i) << shift) < wh->current) continue; // already cascaded
+
+            if (wh->slots[level][(base + i) & SERV_TM_MASK])
             {
-                ret = s->handlemsg(s->id, s->db, qmsg->session, qmsg->src, qmsg->msg, qmsg->msglen);
-                if (ret != RET_DONTFREE)
-                {
-                    free(qmsg->msg);
-                }
-                free(qmsg);
+                if (((base + i) << shift) < next) next = (base + i) << shift;
+                break;
             }
         }
     }
-    return;
+    return next;
 }
 
-int service_send(serviceid src, serviceid dst, tag_t tag, int session, void* msg, int msglen)
+static void _tm_arm(struct service_wheel* wh, uint64_t expire)
 {
-    CHECK_IF(src == INVALID_ID, return -1, "src is INVALID_ID");
-    CHECK_IF(dst == INVALID_ID, return -1, "dst is INVALID_ID");
-    CHECK_IF(msg == NULL, return -1, "msg is null");
+    struct itimerspec timeval = {
+        .it_value.tv_sec  = expire / 1000,
+        .it_value.tv_nsec = (expire % 1000) * 1000 * 1000,
+    };
+    timerfd_settime(wh->fd, TFD_TIMER_ABSTIME, &timeval, NULL);
+    wh->armed = expire;
+}
 
-    struct service* s = map_grab(&_services, dst);
-    CHECK_IF(s == NULL, return -1, "map_grab service with id = %d failed", dst);
+static struct service_timer* _tm_new(struct service_wheel* wh)
+{
+    if (wh->free_list == NULL)
+    {
+        CHECK_IF((wh->chunk_num + 1) * SERV_TM_CHUNK > (1 << SERV_TM_SLOT_BITS), return NULL, "too many timers");
 
-    struct service_msg* qmsg = calloc(sizeof(struct service_msg), 1);
-    qmsg->session = session;
-    qmsg->src     = src;
-    qmsg->msglen  = msglen;
+        struct service_timer** chunks = realloc(wh->chunks, sizeof(struct service_timer*) * (wh->chunk_num + 1));
+        CHECK_IF(chunks == NULL, return NULL, "realloc failed");
+        wh->chunks = chunks;
 
-    if (tag == TAG_DONTCOPY)
+        struct service_timer* chunk = calloc(sizeof(struct service_timer), SERV_TM_CHUNK);
+        CHECK_IF(chunk == NULL, return NULL, "calloc failed");
+
+        int i;
+        for (i=SERV_TM_CHUNK-1; i>=0; i--)
+        {
+            chunk[i].idx     = wh->chunk_num * SERV_TM_CHUNK + i;
+            chunk[i].tm_next = wh->free_list;
+            wh->free_list    = &chunk[i];
+        }
+        wh->chunks[wh->chunk_num++] = chunk;
+    }
+
+    struct service_timer* t = wh->free_list;
+    wh->free_list = t->tm_next;
+    t->tm_next = NULL;
+    t->seq = (t->seq % 2047) + 1; // 1 ~ 2047, so ids are never INVALID_ID
+    return t;
+}
+
+static void _tm_free(struct service_wheel* wh, struct service_timer* t)
+{
+    t->callback   = NULL;
+    t->tm_next    = wh->free_list;
+    wh->free_list = t;
+}
+
+static struct service_timer* _tm_find(struct service_wheel* wh, watchid wid)
+{
+    int idx = wid & ((1 << SERV_TM_SLOT_BITS) - 1);
+    int seq = wid >> SERV_TM_SLOT_BITS;
+    if (idx >= wh->chunk_num * SERV_TM_CHUNK) return NULL;
+
+    struct service_timer* t = &wh->chunks[idx / SERV_TM_CHUNK][idx % SERV_TM_CHUNK];
+    if ((t->callback == NULL) || (t->seq != seq)) return NULL;
+    return t;
+}
+
+static void _tm_expire(serviceid sid, void* db, int fd, void* arg)
+{
+    uint64_t val;
+    read(fd, &val, sizeof(val));
+
+    struct service_wheel* wh = (struct service_wheel*)arg;
+    pthread_mutex_lock(&wh->lock);
+
+    uint64_t now = _now_ms();
+    uint64_t tick;
+    int level, idx;
+    struct service_timer* pending;
+    struct service_timer* t;
+    void (*callback)(serviceid sid, void* db, void* arg);
+    void* cbarg;
+    while ((wh->current <= now) && (wh->num > 0))
+    {
+        tick = wh->current;
+        for (level=1; level<SERV_TM_LEVELS; level++)
+        {
+            if ((tick >> (SERV_TM_BITS * (level-1))) & SERV_TM_MASK) break;
+
+            _tm_cascade(wh, level, (tick >> (SERV_TM_BITS * level)) & SERV_TM_MASK);
+        }
+
+        // callbacks may stop any timer, so run them from a list they can unlink from
+        idx     = tick & SERV_TM_MASK;
+        pending = wh->slots[0][idx];
+        wh->slots[0][idx] = NULL;
+        if (pending) pending->tm_pprev = &pending;
+
+        wh->current = tick + 1;
+
+        while (pending)
+        {
+            t = pending;
+            _tm_unlink(t);
+            wh->num--;
+
+            callback = t->callback;
+            cbarg    = t->arg;
+            if (t->interval_ms > 0)
+            {
+                t->expire = tick + t->interval_ms;
+                if (t->expire <= now) t->expire = now + t->interval_ms;
+                _tm_link(wh, t);
+                wh->num++;
+            }
+            else
+            {
+                _tm_free(wh, t);
+            }
+
+            pthread_mutex_unlock(&wh->lock);
+            callback(sid, db, cbarg);
+            pthread_mutex_lock(&wh->lock);
+        }
+    }
+
+    if (wh->num == 0)
     {
-        qmsg->msg = msg;
+        wh->current = now;
+        wh->armed   = 0; // a later start arms it again
     }
     else
     {
-        qmsg->msg = malloc(msglen);
-        memcpy(qmsg->msg, msg, msglen);
+        _tm_arm(wh, _tm_next(wh));
     }
-    fqueue_push(s->mq, qmsg);
-    eventfd_t val = 1;
-    eventfd_write(s->qfd, val);
+    pthread_mutex_unlock(&wh->lock);
+}
 
-    map_release(&_services, dst);
-    return msglen;
+static struct service_wheel* _get_wheel(struct service* s)
+{
+    struct service_wheel* wh = __atomic_load_n(&s->wheel, __ATOMIC_ACQUIRE);
+    if (wh) return wh;
+
+    wh = calloc(sizeof(struct service_wheel), 1);
+    CHECK_IF(wh == NULL, return NULL, "calloc failed");
+
+    pthread_mutex_init(&wh->lock, NULL);
+    wh->current = _now_ms();
+    wh->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    CHECK_IF(wh->fd < 0, goto _ERROR, "timerfd_create failed");
+
+    struct service_wheel* old = NULL;
+    if (!__atomic_compare_exchange_n(&s->wheel, &old, wh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        close(wh->fd);
+        free(wh);
+        return old;
+    }
+
+    // the watcher owns the fd
+    service_watch(s->id, wh->fd, _tm_expire, wh);
+    return wh;
+
+_ERROR:
+    free(wh);
+    return NULL;
 }
 
-static void _timeout_callback(serviceid sid, void* db, int fd, void* arg)
+static void _free_wheel(struct service_wheel* wh)
 {
-    uint64_t val;
-    ssize_t  sz = sizeof(val);
-    read(fd, &val, sz);
+    if (wh == NULL) return;
 
-    struct watcher* w = (struct watcher*)arg;
-    w->tmcallback(sid, db, w->arg);
-    if (w->interval_ms <= 0)
+    int i;
+    for (i=0; i<wh->chunk_num; i++)
     {
-        service_stop_timer(w->sid, w->id);
+        free(wh->chunks[i]);
     }
+    free(wh->chunks);
+    pthread_mutex_destroy(&wh->lock);
+    free(wh);
 }
 
 watchid service_start_timer(serviceid sid, int time_ms, int interval_ms, void (*callback)(serviceid sid, void* db, void* arg), void* arg)
@@ -149,38 +1167,61 @@ watchid service_start_timer(serviceid sid, int time_ms, int interval_ms, void (*
     struct service* s = map_grab(&_services, sid);
     CHECK_IF(s == NULL, return INVALID_ID, "map_grab service by id = %d failed", sid);
 
-    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    watchid wid = INVALID_ID;
+    struct service_wheel* wh = _get_wheel(s);
+    CHECK_IF(wh == NULL, goto _END, "_get_wheel failed");
 
-    struct watcher* w = calloc(sizeof(struct watcher), 1);
-    w->fd          = fd;
-    w->callback    = _timeout_callback;
-    w->arg         = w;
-    w->id          = map_new(&s->watchers, w);
-
-    w->tmcallback  = callback;
-    w->time_ms     = time_ms;
-    w->interval_ms = interval_ms;
-    w->sid         = sid;
+    pthread_mutex_lock(&wh->lock);
+    struct service_timer* t = _tm_new(wh);
+    if (t)
+    {
+        uint64_t now = _now_ms();
+        if (wh->num == 0) wh->current = now;
 
-    struct epoll_event tmp = {.events = EPOLLIN, .data.u64 = w->id};
-    epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &tmp);
+        t->callback    = callback;
+        t->arg         = arg;
+        t->interval_ms = interval_ms;
+        t->expire      = now + ((time_ms > 0) ? time_ms : interval_ms);
+        _tm_link(wh, t);
+        wh->num++;
 
-    struct itimerspec timeval = {
-        .it_value.tv_sec     = time_ms / 1000,
-        .it_value.tv_nsec    = (time_ms % 1000) * 1000 * 1000,
-        .it_interval.tv_sec  = interval_ms / 1000,
-        .it_interval.tv_nsec = (interval_ms % 1000) * 1000 * 1000
-    };
-    timerfd_settime(fd, 0, &timeval, NULL);
-    dtrace();
+        if ((wh->armed == 0) || (t->expire < wh->armed)) _tm_arm(wh, t->expire);
+        wid = (t->seq << SERV_TM_SLOT_BITS) | t->idx;
+    }
+    pthread_mutex_unlock(&wh->lock);
 
+_END:
     map_release(&_services, sid);
-    return w->id;
+    return wid;
 }
 
+// the timerfd stays armed, an early wakeup finds nothing to do
 void service_stop_timer(serviceid sid, watchid wid)
 {
-    service_unwatch(sid, wid);
+    CHECK_IF(sid == INVALID_ID, return, "sid is INVALID_ID");
+    CHECK_IF(wid == INVALID_ID, return, "wid is INVALID_ID");
+
+    struct service* s = map_grab(&_services, sid);
+    CHECK_IF(s == NULL, return, "map_grab service by id = %d failed", sid);
+
+    struct service_wheel* wh = __atomic_load_n(&s->wheel, __ATOMIC_ACQUIRE);
+    if (wh)
+    {
+        pthread_mutex_lock(&wh->lock);
+        struct service_timer* t = _tm_find(wh, wid);
+        if (t)
+        {
+            if (t->tm_pprev)
+            {
+                _tm_unlink(t);
+                wh->num--;
+            }
+            _tm_free(wh, t);
+        }
+        pthread_mutex_unlock(&wh->lock);
+    }
+
+    map_release(&_services, sid);
 }
 
 watchid service_watch(serviceid sid, int fd, void (*callback)(serviceid sid, void* db, int fd, void* arg), void* arg)
@@ -198,8 +1239,7 @@ watchid service_watch(serviceid sid, int fd, void (*callback)(serviceid sid, voi
     w->arg      = arg;
     w->id       = map_new(&s->watchers, w);
 
-    struct epoll_event tmp = {.events = EPOLLIN, .data.u64 = w->id};
-    epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &tmp);
+    _watch_fd(s, fd, w->id);
 
     map_release(&_services, sid);
     return w->id;
@@ -216,8 +1256,7 @@ void service_unwatch(serviceid sid, watchid wid)
     struct watcher* w = map_grab(&s->watchers, wid);
     if (w)
     {
-        struct epoll_event tmp = {};
-        epoll_ctl(s->epfd, EPOLL_CTL_DEL, w->fd, &tmp);
+        _unwatch_fd(s, w->fd);
         map_release(&s->watchers, wid);
     }
     map_release(&s->watchers, wid); // free map_slot
@@ -226,14 +1265,14 @@ void service_unwatch(serviceid sid, watchid wid)
     return;
 }
 
-static void _clean_qmsg(void* input)
+// the first service of a name keeps it
+static void _name_register(struct service* s)
 {
-    struct service_msg* qmsg = (struct service_msg*)input;
-    if (input)
-    {
-        if (qmsg->msg) free(qmsg->msg);
-        free(input);
-    }
+    struct service_name* n = _name_intern(s->name);
+    CHECK_IF(n == NULL, return, "_name_intern failed");
+
+    serviceid none = INVALID_ID;
+    __atomic_compare_exchange_n(&n->id, &none, s->id, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
 }
 
 serviceid service_create(char* name, void* db, service_cb handlemsg, void (*init)(serviceid sid, void* db), void (*uninit)(serviceid sid, void* db))
@@ -247,6 +1286,27 @@ serviceid service_create(char* name, void* db, service_cb handlemsg, void (*init
     s->handlemsg = handlemsg;
     s->init      = init;
     s->uninit    = uninit;
+    s->budget_msgs = SERV_BUDGET_MSGS;
+    s->budget_us   = SERV_BUDGET_US;
+    s->calls.free_head = -1;
+    s->calls.dl_head   = -1;
+    s->calls.dl_tail   = -1;
+    s->calls.timer     = INVALID_ID;
+
+    if (_is_mn)
+    {
+        map_init(&s->watchers, _clean_watcher);
+        s->sched = SERV_ST_IDLE;
+        s->evq   = fqueue_create(NULL);
+        s->mq    = fqueue_create(_clean_qmsg);
+        s->id    = map_new(&_services, s);
+        _name_register(s);
+
+        // created while running, init runs as its first turn
+        _schedule(s);
+        return s->id;
+    }
+
     s->epfd      = epoll_create(MAX_WATCH_NUM);
     s->qfd       = eventfd(0, 0);
     s->stopfd    = eventfd(0, 0);
@@ -254,6 +1314,7 @@ serviceid service_create(char* name, void* db, service_cb handlemsg, void (*init
     s->watching  = false;
     s->id        = map_new(&_services, s);
     s->mq        = fqueue_create(_clean_qmsg);
+    _name_register(s);
 
     service_watch(s->id, s->qfd, _dequeue, s);
     service_watch(s->id, s->stopfd, _stop_watching, s);
@@ -296,8 +1357,146 @@ void _service_routine(void* arg)
     return;
 }
 
+static void _handle_events(struct service* s)
+{
+    void* data;
+    watchid wid;
+    struct watcher* w;
+    FQUEUE_FOREACH(s->evq, data)
+    {
+        wid = (watchid)(intptr_t)data;
+        w   = map_grab(&s->watchers, wid);
+        if (w == NULL) continue;
+
+        w->callback(s->id, s->db, w->fd, w->arg);
+        if (map_release(&s->watchers, wid))
+        {
+            free(w); // unwatched in the callback
+            continue;
+        }
+
+        struct epoll_event tmp = {.events = EPOLLIN | EPOLLONESHOT, .data.u64 = MN_KEY(s->id, wid)};
+        epoll_ctl(_epfd, EPOLL_CTL_MOD, w->fd, &tmp);
+    }
+}
+
+static void _service_run(void* arg)
+{
+    struct service* s = (struct service*)arg;
+    if (!__atomic_load_n(&_mn_running, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&s->sched, SERV_ST_IDLE, __ATOMIC_RELEASE);
+        return;
+    }
+    __atomic_store_n(&s->sched, SERV_ST_RUNNING, __ATOMIC_SEQ_CST);
+
+    if (!s->is_started)
+    {
+        s->is_started = true;
+        if (s->init) s->init(s->id, s->db);
+    }
+    _handle_events(s);
+
+    // out of budget or woken while running : go to the back of the queue instead of looping here
+    if (_handle_msgs(s))
+    {
+        __atomic_store_n(&s->sched, SERV_ST_QUEUED, __ATOMIC_RELEASE);
+        thread_pool_submit(&_pool, _service_run, s, NULL);
+        return;
+    }
+
+    int st = SERV_ST_RUNNING;
+    if (!__atomic_compare_exchange_n(&s->sched, &st, SERV_ST_IDLE, 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+    {
+        __atomic_store_n(&s->sched, SERV_ST_QUEUED, __ATOMIC_RELEASE);
+        thread_pool_submit(&_pool, _service_run, s, NULL);
+    }
+}
+
+static void _fd_ready(uint64_t key)
+{
+    serviceid sid = (serviceid)(key >> 32);
+    watchid   wid = (watchid)(key & 0xffffffff);
+
+    struct service* s = map_grab(&_services, sid);
+    if (s == NULL) return;
+
+    fqueue_push(s->evq, (void*)(intptr_t)wid);
+    _schedule(s);
+    map_release(&_services, sid);
+}
+
+// the calling thread polls the fds of all services, the workers run them
+static void _run_mn(void)
+{
+    int chk = thread_pool_init(&_pool, _worker_num);
+    CHECK_IF(chk != THREAD_OK, return, "thread_pool_init failed");
+
+    __atomic_store_n(&_mn_running, true, __ATOMIC_SEQ_CST);
+    _running = true;
+
+    serviceid* ids = NULL;
+    int num = _list_services(&ids);
+    int i;
+    struct service* s;
+    for (i=0; i<num; i++)
+    {
+        s = map_grab(&_services, ids[i]);
+        if (s == NULL) continue;
+
+        _schedule(s);
+        map_release(&_services, ids[i]);
+    }
+    free(ids);
+
+    struct epoll_event evbuf[MAX_WATCH_NUM];
+    bool stop = false;
+    while (!stop)
+    {
+        num = epoll_wait(_epfd, evbuf, MAX_WATCH_NUM, -1);
+        if ((num < 0) && (errno == EINTR)) continue;
+        CHECK_IF(num < 0, break, "epoll_wait failed");
+
+        for (i=0; i<num; i++)
+        {
+            if (evbuf[i].data.u64 == MN_STOP_KEY)
+            {
+                stop = true;
+                continue;
+            }
+            _fd_ready(evbuf[i].data.u64);
+        }
+    }
+
+    // queued runs return at once, then every service is idle
+    __atomic_store_n(&_mn_running, false, __ATOMIC_SEQ_CST);
+    thread_pool_uninit(&_pool);
+
+    eventfd_t val;
+    eventfd_read(_stopfd, &val);
+
+    num = _list_services(&ids);
+    for (i=0; i<num; i++)
+    {
+        s = map_grab(&_services, ids[i]);
+        if (s == NULL) continue;
+
+        if (s->is_started && s->uninit) s->uninit(ids[i], s->db);
+        s->is_started = false;
+        map_release(&_services, ids[i]);
+    }
+    free(ids);
+    _running = false;
+}
+
 void service_system_run(void)
 {
+    if (_is_mn)
+    {
+        _run_mn();
+        return;
+    }
+
     serviceid idbuf[MAX_SERVICE_NUM] = {0};
     int num = map_list(&_services, idbuf, MAX_SERVICE_NUM);
 
@@ -332,6 +1531,13 @@ void service_system_run(void)
 
 void service_system_break(void)
 {
+    if (_is_mn)
+    {
+        eventfd_t val = 1;
+        eventfd_write(_stopfd, val);
+        return;
+    }
+
     serviceid idbuf[MAX_SERVICE_NUM] = {0};
     int num = map_list(&_services, idbuf, MAX_SERVICE_NUM);
     int i;
@@ -351,17 +1557,22 @@ void service_system_break(void)
 serviceid service_getid(char* name)
 {
     CHECK_IF(name == NULL, return INVALID_ID, "name is null");
-    serviceid idbuf[MAX_SERVICE_NUM] = {0};
-    int num = map_list(&_services, idbuf, MAX_SERVICE_NUM);
-    int i;
-    int cmp;
-    for (i=0; i<num; i++)
-    {
-        struct service* s = map_grab(&_services, idbuf[i]);
-        cmp = strcmp(s->name, name);
-        map_release(&_services, idbuf[i]);
 
-        if (cmp == 0) return idbuf[i];
-    }
-    return INVALID_ID;
+    char key[SERVICE_NAME_SIZE+1];
+    snprintf(key, sizeof(key), "%s", name);
+
+    struct service_name* n = _name_find(__atomic_load_n(&_names, __ATOMIC_ACQUIRE), key, _hashfn(key));
+    return n ? service_resolve(n) : INVALID_ID;
+}
+
+struct service_name* service_intern(char* name)
+{
+    CHECK_IF(name == NULL, return NULL, "name is null");
+    return _name_intern(name);
+}
+
+serviceid service_resolve(struct service_name* handle)
+{
+    CHECK_IF(handle == NULL, return INVALID_ID, "handle is null");
+    return __atomic_load_n(&handle->id, __ATOMIC_ACQUIRE);
 }
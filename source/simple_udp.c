@@ -2,6 +2,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <netinet/udp.h>
 
 #include "simple_udp.h"
 
@@ -196,3 +197,58 @@ int sudp_receive_timed(int fd, void* buffer, int buffer_size, union ipaddr* src_
     }
     return recvlen;
 }
+
+int sudp_set_gso(int fd, int seg_size)
+{
+    assert(fd > 0);
+    assert(seg_size >= 0);
+
+    int chk = setsockopt(fd, SOL_UDP, UDP_SEGMENT, &seg_size, sizeof(seg_size));
+    CHECK_IF(chk < 0, return SUDP_FAIL, "setsockopt udp_segment failed, err = %s", strerror(errno));
+    return SUDP_OK;
+}
+
+int sudp_set_gro(int fd, int on)
+{
+    assert(fd > 0);
+
+    on = (on != 0);
+    int chk = setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+    CHECK_IF(chk < 0, return SUDP_FAIL, "setsockopt udp_gro failed, err = %s", strerror(errno));
+    return SUDP_OK;
+}
+
+int sudp_receive_gro(int fd, void* buffer, int buffer_size, union ipaddr* src_addr, int* seg_size)
+{
+    assert(fd > 0);
+    assert(buffer != NULL);
+    assert(buffer_size > 0);
+    assert(src_addr != NULL);
+    assert(seg_size != NULL);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {buffer, buffer_size};
+    struct msghdr msg = {};
+    msg.msg_name       = src_addr;
+    msg.msg_namelen    = sizeof(*src_addr);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    int recvlen = recvmsg(fd, &msg, 0);
+    CHECK_IF(recvlen < 0, return recvlen, "recvmsg failed, err = %s", strerror(errno));
+
+    *seg_size = recvlen;
+
+    struct cmsghdr* cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO))
+        {
+            memcpy(seg_size, CMSG_DATA(cmsg), sizeof(int));
+            break;
+        }
+    }
+    return recvlen;
+}
@@ -1,6 +1,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
 
 #include "tcp.h"
 
@@ -111,6 +119,8 @@ int tcp_server_accept(struct tcp_server* server, struct tcp* tcp)
     CHECK_IF(chk != TCP_OK, goto _ERROR, "tcp_to_tcpaddr failed");
 
     tcp->fd = fd;
+    tcp->is_zerocopy = 0;
+    tcp->zc_next = tcp->zc_done = tcp->zc_copied = 0;
     tcp->is_init = 1;
 
     return TCP_OK;
@@ -159,6 +169,8 @@ int tcp_client_init(struct tcp* tcp, char* remote_ip, int remote_port, int local
     chk = tcp_to_tcpaddr(remote, &tcp->remote);
     CHECK_IF(chk != TCP_OK, goto _ERROR, "tcp_to_tcpaddr failed");
 
+    tcp->is_zerocopy = 0;
+    tcp->zc_next = tcp->zc_done = tcp->zc_copied = 0;
     tcp->is_init = 1;
     return TCP_OK;
 
@@ -204,3 +216,158 @@ int tcp_send(struct tcp* tcp, void* data, int data_len)
     CHECK_IF(data_len <= 0, return -1, "data_len = %d invalid", data_len);
     return send(tcp->fd, data, data_len, 0);
 }
+
+int tcp_sendv(struct tcp* tcp, struct iovec* iov, int iov_num)
+{
+    CHECK_IF(tcp == NULL, return -1, "tcp is null");
+    CHECK_IF(tcp->is_init == 0, return -1, "tcp is not init yet");
+    CHECK_IF(tcp->fd <= 0, return -1, "tcp fd <= 0");
+    CHECK_IF(iov == NULL, return -1, "iov is null");
+    CHECK_IF((iov_num <= 0) || (iov_num > IOV_MAX), return -1, "iov_num = %d invalid", iov_num);
+
+    struct msghdr msg = {};
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iov_num;
+    return sendmsg(tcp->fd, &msg, 0);
+}
+
+int tcp_zerocopy_enable(struct tcp* tcp)
+{
+    CHECK_IF(tcp == NULL, return TCP_FAIL, "tcp is null");
+    CHECK_IF(tcp->is_init == 0, return TCP_FAIL, "tcp is not init yet");
+
+    const int on = 1;
+    int chk = setsockopt(tcp->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+    CHECK_IF(chk < 0, return TCP_FAIL, "setsockopt zerocopy failed, errno = %d", errno);
+
+    tcp->is_zerocopy = 1;
+    return TCP_OK;
+}
+
+int tcp_send_zc(struct tcp* tcp, void* data, int data_len)
+{
+    CHECK_IF(tcp == NULL, return -1, "tcp is null");
+    CHECK_IF(tcp->is_init == 0, return -1, "tcp is not init yet");
+    CHECK_IF(tcp->is_zerocopy == 0, return -1, "zerocopy is not enabled");
+    CHECK_IF(data == NULL, return -1, "data is null");
+    CHECK_IF(data_len <= 0, return -1, "data_len = %d invalid", data_len);
+
+    if (data_len < TCP_ZEROCOPY_MIN) return send(tcp->fd, data, data_len, 0);
+
+    int sendlen = send(tcp->fd, data, data_len, MSG_ZEROCOPY);
+    if (sendlen > 0) tcp->zc_next++; // only sends that queued data get a completion
+    return sendlen;
+}
+
+int tcp_zerocopy_reap(struct tcp* tcp)
+{
+    CHECK_IF(tcp == NULL, return -1, "tcp is null");
+    CHECK_IF(tcp->is_init == 0, return -1, "tcp is not init yet");
+    CHECK_IF(tcp->is_zerocopy == 0, return -1, "zerocopy is not enabled");
+
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct sock_extended_err* serr;
+    int reaped = 0;
+    while (tcp->zc_done != tcp->zc_next)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(tcp->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) &&
+                !((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR))) continue;
+
+            serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if ((serr->ee_errno != 0) || (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)) continue;
+
+            // [ee_info, ee_data] completed, tcp reports them in order
+            reaped += serr->ee_data - serr->ee_info + 1;
+            tcp->zc_done = serr->ee_data + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) tcp->zc_copied += serr->ee_data - serr->ee_info + 1;
+        }
+    }
+    return reaped;
+}
+
+static int _splice(int sock_fd, int file_fd, off_t* offset, int count)
+{
+    int pipefd[2];
+    int chk = pipe2(pipefd, O_CLOEXEC);
+    CHECK_IF(chk < 0, return -1, "pipe2 failed");
+
+    int total = 0;
+    ssize_t inlen = 0;
+    ssize_t outlen;
+    bool is_fail = false;
+    while (total < count)
+    {
+        inlen = splice(file_fd, offset, pipefd[1], NULL, count - total, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (inlen < 0 && errno == EINTR) continue;
+        if (inlen < 0) is_fail = true;
+        if (inlen <= 0) break; // 0 : end of file
+
+        while (inlen > 0)
+        {
+            outlen = splice(pipefd[0], NULL, sock_fd, NULL, inlen, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (outlen < 0 && errno == EINTR) continue;
+            if (outlen <= 0) break;
+
+            inlen -= outlen;
+            total += outlen;
+        }
+        if (inlen > 0)
+        {
+            is_fail = true;
+            break;
+        }
+    }
+
+    if (inlen > 0)
+    {
+        // the bytes stuck in the pipe are read again by the next send
+        derror("splice to socket failed, errno = %d", errno);
+        if (offset) *offset -= inlen;
+        else CHECK_IF(lseek(file_fd, -inlen, SEEK_CUR) < 0, , "%zd bytes lost, file_fd cannot seek back", inlen);
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    // like sendfile, 0 at end of file and -1 only when nothing went out because of an error
+    return ((total == 0) && is_fail) ? -1 : total;
+}
+
+int tcp_sendfile(struct tcp* tcp, int file_fd, off_t* offset, int count)
+{
+    CHECK_IF(tcp == NULL, return -1, "tcp is null");
+    CHECK_IF(tcp->is_init == 0, return -1, "tcp is not init yet");
+    CHECK_IF(tcp->fd <= 0, return -1, "tcp fd <= 0");
+    CHECK_IF(file_fd < 0, return -1, "file_fd = %d invalid", file_fd);
+    CHECK_IF(count <= 0, return -1, "count = %d invalid", count);
+
+    int total = 0;
+    ssize_t sendlen;
+    while (total < count)
+    {
+        sendlen = sendfile(tcp->fd, file_fd, offset, count - total);
+        if (sendlen > 0)
+        {
+            total += sendlen;
+            continue;
+        }
+        if (sendlen == 0) break; // end of file
+        if (errno == EINTR) continue;
+
+        if ((total == 0) && ((errno == EINVAL) || (errno == ENOSYS)))
+        {
+            return _splice(tcp->fd, file_fd, offset, count);
+        }
+        CHECK_IF(total == 0, return -1, "sendfile failed, errno = %d", errno);
+        break;
+    }
+    return total;
+}
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+#include "tcp_conn.h"
+
+#define derror(a, b...) fprintf(stderr, "[ERROR] %s(): "a"\n", __func__, ##b)
+#define CHECK_IF(assertion, error_action, ...) \
+{\
+    if (assertion) \
+    { \
+        derror(__VA_ARGS__); \
+        {error_action;} \
+    }\
+}
+
+#define TCP_CONN_ST_CONNECTING (1)
+#define TCP_CONN_ST_CONNECTED  (2)
+#define TCP_CONN_ST_CLOSING    (3)
+#define TCP_CONN_ST_CLOSED     (4)
+#define TCP_CONN_ST_CONNECTING_CLOSING (5) // closed with output queued before it connected
+
+#define TCP_CONN_READ_MIN   (4096)
+#define TCP_ACCEPT_PER_ROUND (64)
+
+static int _buf_reserve(struct tcp_conn_buf* buf, int len)
+{
+    if (buf->size - buf->end >= len) return TCP_CONN_OK;
+
+    if (buf->start > 0)
+    {
+        memmove(buf->data, buf->data + buf->start, buf->end - buf->start);
+        buf->end  -= buf->start;
+        buf->start = 0;
+        if (buf->size - buf->end >= len) return TCP_CONN_OK;
+    }
+
+    int newsize = (buf->size > 0) ? buf->size : TCP_CONN_BUF_MIN;
+    while (newsize - buf->end < len)
+    {
+        newsize *= 2;
+    }
+    CHECK_IF(newsize > TCP_CONN_BUF_MAX, return TCP_CONN_FAIL, "buffer size %d exceeds %d", newsize, TCP_CONN_BUF_MAX);
+
+    char* data = realloc(buf->data, newsize);
+    CHECK_IF(data == NULL, return TCP_CONN_FAIL, "realloc failed");
+
+    buf->data = data;
+    buf->size = newsize;
+    return TCP_CONN_OK;
+}
+
+static void _buf_clean(struct tcp_conn_buf* buf)
+{
+    if (buf->data) free(buf->data);
+    memset(buf, 0, sizeof(struct tcp_conn_buf));
+}
+
+static void _conn_free(struct tcp_conn* conn)
+{
+    _buf_clean(&conn->in);
+    _buf_clean(&conn->out);
+    free(conn);
+}
+
+static void _conn_notify(struct tcp_conn* conn, int event)
+{
+    if (conn->eventfn == NULL) return;
+
+    conn->busy++;
+    conn->eventfn(conn, event);
+    conn->busy--;
+}
+
+static void _conn_destroy(struct tcp_conn* conn, int is_error)
+{
+    if (conn->state == TCP_CONN_ST_CLOSED) return;
+
+    if (is_error) _conn_notify(conn, TCP_CONN_EV_ERROR);
+
+    evio_stop(conn->loop, &conn->ev);
+    close(conn->fd);
+    conn->fd    = -1;
+    conn->state = TCP_CONN_ST_CLOSED;
+
+    _conn_notify(conn, TCP_CONN_EV_CLOSED);
+
+    if (conn->busy == 0) _conn_free(conn);
+}
+
+static int _conn_flush(struct tcp_conn* conn)
+{
+    struct tcp_conn_buf* out = &conn->out;
+    int sendlen;
+    while (out->end > out->start)
+    {
+        sendlen = send(conn->fd, out->data + out->start, out->end - out->start, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sendlen < 0)
+        {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return TCP_CONN_OK; // wait for EPOLLOUT
+            return TCP_CONN_FAIL;
+        }
+        out->start += sendlen;
+    }
+    out->start = out->end = 0;
+
+    if (conn->state == TCP_CONN_ST_CLOSING) _conn_destroy(conn, 0);
+    return TCP_CONN_OK;
+}
+
+static void _conn_deliver(struct tcp_conn* conn)
+{
+    struct tcp_conn_buf* in = &conn->in;
+    char* frame;
+    int len, framelen;
+    while ((conn->state == TCP_CONN_ST_CONNECTED) && (in->end > in->start))
+    {
+        frame = in->data + in->start;
+        len   = in->end - in->start;
+        if (conn->framefn)
+        {
+            framelen = conn->framefn(conn, frame, len);
+            CHECK_IF(framelen < 0, _conn_destroy(conn, 1); return, "framefn = %d, drop connection", framelen);
+            if ((framelen == 0) || (framelen > len)) break;
+        }
+        else
+        {
+            framelen = len;
+        }
+
+        // the frame stays valid until the next recv, so it is consumed before the callback
+        in->start += framelen;
+        if (conn->recvfn) conn->recvfn(conn, frame, framelen);
+    }
+
+    if (in->start == in->end) in->start = in->end = 0;
+}
+
+static void _conn_read(struct tcp_conn* conn)
+{
+    struct tcp_conn_buf* in = &conn->in;
+    int recvlen;
+    while (conn->state == TCP_CONN_ST_CONNECTED)
+    {
+        if (_buf_reserve(in, TCP_CONN_READ_MIN) != TCP_CONN_OK)
+        {
+            _conn_destroy(conn, 1);
+            return;
+        }
+
+        recvlen = recv(conn->fd, in->data + in->end, in->size - in->end, 0);
+        if (recvlen > 0)
+        {
+            in->end += recvlen;
+            _conn_deliver(conn);
+        }
+        else if (recvlen == 0)
+        {
+            _conn_destroy(conn, 0); // closed by peer
+            return;
+        }
+        else
+        {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+
+            _conn_destroy(conn, 1);
+            return;
+        }
+    }
+}
+
+static void _conn_io(struct evloop* loop, struct ev* ev, void* arg)
+{
+    struct tcp_conn* conn = (struct tcp_conn*)arg;
+    int revents = ev->revents;
+
+    conn->busy++;
+
+    if ((conn->state == TCP_CONN_ST_CONNECTING) || (conn->state == TCP_CONN_ST_CONNECTING_CLOSING))
+    {
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+        if (err != 0)
+        {
+            _conn_destroy(conn, 1);
+            goto _END;
+        }
+
+        if (conn->state == TCP_CONN_ST_CONNECTING_CLOSING)
+        {
+            conn->state = TCP_CONN_ST_CLOSING;
+        }
+        else
+        {
+            conn->state = TCP_CONN_ST_CONNECTED;
+            _conn_notify(conn, TCP_CONN_EV_CONNECTED);
+        }
+        revents |= EVIO_WRITE; // flush what was queued while connecting
+    }
+
+    if ((conn->state == TCP_CONN_ST_CONNECTED) && (revents & EVIO_READ))
+    {
+        _conn_read(conn);
+    }
+
+    if (((conn->state == TCP_CONN_ST_CONNECTED) || (conn->state == TCP_CONN_ST_CLOSING)) && (revents & EVIO_WRITE))
+    {
+        if (_conn_flush(conn) != TCP_CONN_OK) _conn_destroy(conn, 1);
+    }
+
+_END:
+    conn->busy--;
+    if ((conn->state == TCP_CONN_ST_CLOSED) && (conn->busy == 0)) _conn_free(conn);
+}
+
+static struct tcp_conn* _conn_create(struct evloop* loop, int fd, int state)
+{
+    struct tcp_conn* conn = calloc(sizeof(struct tcp_conn), 1);
+    CHECK_IF(conn == NULL, return NULL, "calloc failed");
+
+    conn->fd    = fd;
+    conn->state = state;
+    conn->loop  = loop;
+
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    // edge-triggered on both sides, output draining never needs epoll_ctl
+    int chk = evio_init(&conn->ev, fd, EVIO_READ | EVIO_WRITE | EVIO_EDGE, _conn_io, conn);
+    CHECK_IF(chk != EV_OK, free(conn); return NULL, "evio_init failed");
+    return conn;
+}
+
+static void _listener_accept(struct evloop* loop, struct ev* ev, void* arg)
+{
+    struct tcp_listener* listener = (struct tcp_listener*)arg;
+    struct tcp_conn* conn;
+    struct sockaddr_in remote;
+    socklen_t addrlen;
+    int i, fd;
+    for (i=0; i<TCP_ACCEPT_PER_ROUND; i++)
+    {
+        addrlen = sizeof(remote);
+        fd = accept4(listener->fd, (struct sockaddr*)&remote, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR) continue;
+            CHECK_IF((errno != EAGAIN) && (errno != EWOULDBLOCK), return, "accept4 failed, errno = %d", errno);
+            return;
+        }
+
+        conn = _conn_create(loop, fd, TCP_CONN_ST_CONNECTED);
+        CHECK_IF(conn == NULL, close(fd); continue, "_conn_create failed");
+
+        tcp_to_tcpaddr(remote, &conn->remote);
+
+        conn->busy++;
+        if (listener->acceptfn) listener->acceptfn(listener, conn);
+        conn->busy--;
+
+        if (conn->state == TCP_CONN_ST_CLOSED)
+        {
+            _conn_free(conn);
+            continue;
+        }
+        evio_start(loop, &conn->ev);
+    }
+}
+
+int tcp_listener_init(struct tcp_listener* listener, struct evloop* loop, char* local_ip, int local_port, int max_conn_num,
+                      void (*acceptfn)(struct tcp_listener*, struct tcp_conn*), void* arg)
+{
+    CHECK_IF(listener == NULL, return TCP_CONN_FAIL, "listener is null");
+    CHECK_IF(loop == NULL, return TCP_CONN_FAIL, "loop is null");
+    CHECK_IF(max_conn_num <= 0, return TCP_CONN_FAIL, "max_conn_num = %d invalid", max_conn_num);
+    CHECK_IF(acceptfn == NULL, return TCP_CONN_FAIL, "acceptfn is null");
+
+    memset(listener, 0, sizeof(struct tcp_listener));
+
+    int chk;
+    struct sockaddr_in me = {};
+    me.sin_family = AF_INET;
+    if (local_ip)
+    {
+        chk = inet_pton(AF_INET, local_ip, &me.sin_addr);
+        CHECK_IF(chk != 1, return TCP_CONN_FAIL, "inet_pton failed");
+    }
+    else
+    {
+        me.sin_addr.s_addr = htonl(INADDR_ANY);
+    }
+    me.sin_port = htons(local_port);
+
+    listener->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    CHECK_IF(listener->fd < 0, return TCP_CONN_FAIL, "socket failed");
+
+    int on = 1;
+    chk = setsockopt(listener->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    CHECK_IF(chk < 0, goto _ERROR, "setsockopt reuseaddr failed");
+
+    chk = setsockopt(listener->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    CHECK_IF(chk < 0, goto _ERROR, "setsockopt reuseport failed");
+
+    chk = bind(listener->fd, (struct sockaddr*)&me, sizeof(me));
+    CHECK_IF(chk < 0, goto _ERROR, "bind failed");
+
+    chk = listen(listener->fd, max_conn_num);
+    CHECK_IF(chk < 0, goto _ERROR, "listen failed");
+
+    listener->local_port = local_port;
+    listener->loop       = loop;
+    listener->acceptfn   = acceptfn;
+    listener->arg        = arg;
+
+    chk = evio_init(&listener->ev, listener->fd, EVIO_READ, _listener_accept, listener);
+    CHECK_IF(chk != EV_OK, goto _ERROR, "evio_init failed");
+
+    chk = evio_start(loop, &listener->ev);
+    CHECK_IF(chk != EV_OK, goto _ERROR, "evio_start failed");
+
+    listener->is_init = 1;
+    return TCP_CONN_OK;
+
+_ERROR:
+    close(listener->fd);
+    listener->fd = -1;
+    return TCP_CONN_FAIL;
+}
+
+int tcp_listener_uninit(struct tcp_listener* listener)
+{
+    CHECK_IF(listener == NULL, return TCP_CONN_FAIL, "listener is null");
+    CHECK_IF(listener->is_init == 0, return TCP_CONN_FAIL, "listener is not init yet");
+
+    evio_stop(listener->loop, &listener->ev);
+    close(listener->fd);
+    listener->fd      = -1;
+    listener->is_init = 0;
+    return TCP_CONN_OK;
+}
+
+struct tcp_conn* tcp_conn_connect(struct evloop* loop, char* remote_ip, int remote_port,
+                                  void (*eventfn)(struct tcp_conn*, int),
+                                  void (*recvfn)(struct tcp_conn*, void*, int),
+                                  int  (*framefn)(struct tcp_conn*, void*, int),
+                                  void* arg)
+{
+    CHECK_IF(loop == NULL, return NULL, "loop is null");
+    CHECK_IF(remote_ip == NULL, return NULL, "remote_ip is null");
+
+    struct sockaddr_in remote = {};
+    remote.sin_family = AF_INET;
+    remote.sin_port   = htons(remote_port);
+
+    int chk = inet_pton(AF_INET, remote_ip, &remote.sin_addr);
+    CHECK_IF(chk != 1, return NULL, "inet_pton failed");
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    CHECK_IF(fd < 0, return NULL, "socket failed");
+
+    chk = connect(fd, (struct sockaddr*)&remote, sizeof(remote));
+    CHECK_IF((chk < 0) && (errno != EINPROGRESS), close(fd); return NULL, "connect failed, errno = %d", errno);
+
+    // completion, even an immediate one, is reported by the first EPOLLOUT
+    struct tcp_conn* conn = _conn_create(loop, fd, TCP_CONN_ST_CONNECTING);
+    CHECK_IF(conn == NULL, close(fd); return NULL, "_conn_create failed");
+
+    tcp_to_tcpaddr(remote, &conn->remote);
+    conn->eventfn = eventfn;
+    conn->recvfn  = recvfn;
+    conn->framefn = framefn;
+    conn->arg     = arg;
+
+    chk = evio_start(loop, &conn->ev);
+    CHECK_IF(chk != EV_OK, close(fd); _conn_free(conn); return NULL, "evio_start failed");
+    return conn;
+}
+
+int tcp_conn_send(struct tcp_conn* conn, void* data, int data_len)
+{
+    CHECK_IF(conn == NULL, return TCP_CONN_FAIL, "conn is null");
+    CHECK_IF(data == NULL, return TCP_CONN_FAIL, "data is null");
+    CHECK_IF(data_len <= 0, return TCP_CONN_FAIL, "data_len = %d invalid", data_len);
+    CHECK_IF((conn->state != TCP_CONN_ST_CONNECTED) && (conn->state != TCP_CONN_ST_CONNECTING),
+             return TCP_CONN_FAIL, "conn is closing");
+
+    int sendlen = 0;
+    if ((conn->state == TCP_CONN_ST_CONNECTED) && (conn->out.end == conn->out.start))
+    {
+        sendlen = send(conn->fd, data, data_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sendlen < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                _conn_destroy(conn, 1);
+                return TCP_CONN_FAIL;
+            }
+            sendlen = 0;
+        }
+        if (sendlen == data_len) return TCP_CONN_OK;
+    }
+
+    int chk = _buf_reserve(&conn->out, data_len - sendlen);
+    CHECK_IF(chk != TCP_CONN_OK, return (sendlen > 0) ? sendlen : TCP_CONN_FAIL, "output of fd %d is full", conn->fd);
+
+    memcpy(conn->out.data + conn->out.end, (char*)data + sendlen, data_len - sendlen);
+    conn->out.end += data_len - sendlen;
+    return TCP_CONN_OK;
+}
+
+int tcp_conn_pending(struct tcp_conn* conn)
+{
+    CHECK_IF(conn == NULL, return 0, "conn is null");
+    return conn->out.end - conn->out.start;
+}
+
+void tcp_conn_close(struct tcp_conn* conn)
+{
+    CHECK_IF(conn == NULL, return, "conn is null");
+
+    if ((conn->state == TCP_CONN_ST_CLOSED) || (conn->state == TCP_CONN_ST_CLOSING) ||
+        (conn->state == TCP_CONN_ST_CONNECTING_CLOSING)) return;
+
+    if (conn->out.end > conn->out.start)
+    {
+        // flushed on EPOLLOUT, a connecting one once it is connected
+        conn->state = (conn->state == TCP_CONN_ST_CONNECTING) ? TCP_CONN_ST_CONNECTING_CLOSING : TCP_CONN_ST_CLOSING;
+        return;
+    }
+    _conn_destroy(conn, 0);
+}
@@ -1,4 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
 #include "thread.h"
 
 #define derror(a, b...) fprintf(stderr, "[ERROR] %s(): "a"\n", __func__, ##b)
@@ -79,3 +88,442 @@ void thread_ev_wait(struct thread_event* ev)
     ev->flag = 0;
     pthread_mutex_unlock(&ev->mutex);
 }
+
+static void _futex_wait(void* addr, int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void _futex_wait_ms(void* addr, int val, int ms)
+{
+    struct timespec timeout = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &timeout, NULL, 0);
+}
+
+static void _futex_wake(void* addr, int num)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+void thread_wg_init(struct thread_wg* wg)
+{
+    CHECK_IF(wg == NULL, return, "wg is null");
+    wg->count = 0;
+}
+
+void thread_wg_add(struct thread_wg* wg, int num)
+{
+    CHECK_IF(wg == NULL, return, "wg is null");
+    __atomic_add_fetch(&wg->count, num, __ATOMIC_SEQ_CST);
+}
+
+void thread_wg_done(struct thread_wg* wg)
+{
+    CHECK_IF(wg == NULL, return, "wg is null");
+    if (__atomic_sub_fetch(&wg->count, 1, __ATOMIC_SEQ_CST) == 0) _futex_wake(&wg->count, INT_MAX);
+}
+
+void thread_wg_wait(struct thread_wg* wg)
+{
+    CHECK_IF(wg == NULL, return, "wg is null");
+
+    int count;
+    while ((count = __atomic_load_n(&wg->count, __ATOMIC_ACQUIRE)) != 0)
+    {
+        _futex_wait(&wg->count, count);
+    }
+}
+
+//////////////////////////////////////// work stealing pool
+
+static __thread struct thread_worker* _self = NULL;
+
+// a thief may read a slot the owner is rewriting, the CAS on top throws such a copy away
+static inline void _slot_load(struct thread_task* slot, struct thread_task* task)
+{
+    task->func = __atomic_load_n(&slot->func, __ATOMIC_RELAXED);
+    task->arg  = __atomic_load_n(&slot->arg, __ATOMIC_RELAXED);
+    task->wg   = __atomic_load_n(&slot->wg, __ATOMIC_RELAXED);
+}
+
+static inline void _slot_store(struct thread_task* slot, struct thread_task* task)
+{
+    __atomic_store_n(&slot->func, task->func, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->arg, task->arg, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->wg, task->wg, __ATOMIC_RELAXED);
+}
+
+static int _deque_push(struct thread_worker* w, struct thread_task* task)
+{
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    if (b - t >= THREAD_DEQUE_SIZE) return THREAD_FAIL;
+
+    _slot_store(&w->tasks[b & (THREAD_DEQUE_SIZE - 1)], task);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    return THREAD_OK;
+}
+
+static int _deque_pop(struct thread_worker* w, struct thread_task* task)
+{
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+
+    if (t > b)
+    {
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return THREAD_FAIL;
+    }
+
+    _slot_load(&w->tasks[b & (THREAD_DEQUE_SIZE - 1)], task);
+    if (t == b)
+    {
+        // the last one, race the thieves for it
+        int won = __atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return won ? THREAD_OK : THREAD_FAIL;
+    }
+    return THREAD_OK;
+}
+
+static int _deque_steal(struct thread_worker* w, struct thread_task* task)
+{
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return THREAD_FAIL;
+
+    _slot_load(&w->tasks[t & (THREAD_DEQUE_SIZE - 1)], task);
+    if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return THREAD_FAIL;
+    return THREAD_OK;
+}
+
+static int _inject_push(struct thread_pool* pool, struct thread_task* tasks, int num)
+{
+    pthread_mutex_lock(&pool->inj_lock);
+
+    if (pool->inj_num + num > pool->inj_size)
+    {
+        int newsize = pool->inj_size;
+        while (newsize < pool->inj_num + num)
+        {
+            newsize *= 2;
+        }
+
+        struct thread_task* newtasks = malloc(sizeof(struct thread_task) * newsize);
+        CHECK_IF(newtasks == NULL, pthread_mutex_unlock(&pool->inj_lock); return THREAD_FAIL, "malloc failed");
+
+        int i;
+        for (i=0; i<pool->inj_num; i++)
+        {
+            newtasks[i] = pool->inj_tasks[(pool->inj_head + i) % pool->inj_size];
+        }
+        free(pool->inj_tasks);
+        pool->inj_tasks = newtasks;
+        pool->inj_size  = newsize;
+        pool->inj_head  = 0;
+    }
+
+    int i;
+    for (i=0; i<num; i++)
+    {
+        pool->inj_tasks[(pool->inj_head + pool->inj_num + i) % pool->inj_size] = tasks[i];
+    }
+    __atomic_store_n(&pool->inj_num, pool->inj_num + num, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&pool->inj_lock);
+    return THREAD_OK;
+}
+
+static int _inject_pop(struct thread_pool* pool, struct thread_task* task)
+{
+    if (__atomic_load_n(&pool->inj_num, __ATOMIC_ACQUIRE) == 0) return THREAD_FAIL;
+
+    int ret = THREAD_FAIL;
+    pthread_mutex_lock(&pool->inj_lock);
+    if (pool->inj_num > 0)
+    {
+        *task = pool->inj_tasks[pool->inj_head];
+        pool->inj_head = (pool->inj_head + 1) % pool->inj_size;
+        __atomic_store_n(&pool->inj_num, pool->inj_num - 1, __ATOMIC_RELEASE);
+        ret = THREAD_OK;
+    }
+    pthread_mutex_unlock(&pool->inj_lock);
+    return ret;
+}
+
+// own deque first, then the injection queue, then a random victim
+static int _find_task(struct thread_pool* pool, struct thread_worker* self, struct thread_task* task)
+{
+    if (self && (_deque_pop(self, task) == THREAD_OK)) return THREAD_OK;
+    if (_inject_pop(pool, task) == THREAD_OK) return THREAD_OK;
+
+    int start = self ? rand_r(&self->seed) : 0;
+    int i;
+    struct thread_worker* victim;
+    for (i=0; i<pool->worker_num; i++)
+    {
+        victim = &pool->workers[(start + i) % pool->worker_num];
+        if ((victim != self) && (_deque_steal(victim, task) == THREAD_OK)) return THREAD_OK;
+    }
+    return THREAD_FAIL;
+}
+
+static void _wake_waiters(struct thread_pool* pool)
+{
+    __atomic_add_fetch(&pool->wait_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->waiting, __ATOMIC_SEQ_CST) > 0) _futex_wake(&pool->wait_seq, INT_MAX);
+}
+
+static void _notify(struct thread_pool* pool, int num)
+{
+    __atomic_add_fetch(&pool->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleeping, __ATOMIC_SEQ_CST) > 0) _futex_wake(&pool->seq, num);
+    _wake_waiters(pool);
+}
+
+static void _run_task(struct thread_pool* pool, struct thread_task* task)
+{
+    task->func(task->arg);
+    if (task->wg == NULL) return;
+
+    // like thread_wg_done, and a finished group also wakes thread_pool_wait
+    if (__atomic_sub_fetch(&task->wg->count, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        _futex_wake(&task->wg->count, INT_MAX);
+        _wake_waiters(pool);
+    }
+}
+
+static void* _worker_routine(void* input)
+{
+    struct thread_worker* self = (struct thread_worker*)input;
+    struct thread_pool* pool = self->pool;
+    _self = self;
+
+    struct thread_task task;
+    unsigned int seq;
+    int idle = 0;
+    while (1)
+    {
+        seq = __atomic_load_n(&pool->seq, __ATOMIC_SEQ_CST);
+        if (_find_task(pool, self, &task) == THREAD_OK)
+        {
+            _run_task(pool, &task);
+            idle = 0;
+            continue;
+        }
+
+        if (__atomic_load_n(&pool->is_running, __ATOMIC_ACQUIRE) == 0) break;
+
+        if (idle++ < THREAD_SPIN)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // a submit after the seq load either changes seq or sees us sleeping
+        __atomic_add_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pool->seq, __ATOMIC_SEQ_CST) == seq) _futex_wait(&pool->seq, seq);
+        __atomic_sub_fetch(&pool->sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+
+    _self = NULL;
+    return NULL;
+}
+
+int thread_pool_init(struct thread_pool* pool, int worker_num)
+{
+    CHECK_IF(pool == NULL, return THREAD_FAIL, "pool is null");
+
+    if (worker_num <= 0) worker_num = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(pool, 0, sizeof(struct thread_pool));
+    pool->workers = aligned_alloc(64, sizeof(struct thread_worker) * worker_num);
+    CHECK_IF(pool->workers == NULL, return THREAD_FAIL, "aligned_alloc failed");
+    memset(pool->workers, 0, sizeof(struct thread_worker) * worker_num);
+
+    pool->inj_size  = THREAD_DEQUE_SIZE;
+    pool->inj_tasks = malloc(sizeof(struct thread_task) * pool->inj_size);
+    CHECK_IF(pool->inj_tasks == NULL, free(pool->workers); return THREAD_FAIL, "malloc failed");
+    pthread_mutex_init(&pool->inj_lock, NULL);
+
+    pool->is_running = 1;
+    pool->worker_num = worker_num;
+
+    int i, chk;
+    for (i=0; i<worker_num; i++)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].idx  = i;
+        pool->workers[i].seed = i + 1;
+    }
+
+    // workers look at each other's deques, so all of them are set up before the first starts
+    for (i=0; i<worker_num; i++)
+    {
+        chk = pthread_create(&pool->workers[i].tid, NULL, _worker_routine, &pool->workers[i]);
+        CHECK_IF(chk != 0, pool->worker_num = i; thread_pool_uninit(pool); return THREAD_FAIL, "pthread_create worker %d failed", i);
+    }
+
+    pool->is_init = 1;
+    return THREAD_OK;
+}
+
+void thread_pool_uninit(struct thread_pool* pool)
+{
+    CHECK_IF(pool == NULL, return, "pool is null");
+
+    __atomic_store_n(&pool->is_running, 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pool->seq, 1, __ATOMIC_SEQ_CST);
+    _futex_wake(&pool->seq, INT_MAX);
+
+    int i;
+    for (i=0; i<pool->worker_num; i++)
+    {
+        pthread_join(pool->workers[i].tid, NULL);
+    }
+
+    pthread_mutex_destroy(&pool->inj_lock);
+    free(pool->inj_tasks);
+    free(pool->workers);
+    pool->inj_tasks  = NULL;
+    pool->workers    = NULL;
+    pool->worker_num = 0;
+    pool->is_init    = 0;
+}
+
+int thread_pool_submit(struct thread_pool* pool, void (*func)(void*), void* arg, struct thread_wg* wg)
+{
+    CHECK_IF(func == NULL, return THREAD_FAIL, "func is null");
+
+    struct thread_task task = {func, arg, NULL};
+    return thread_pool_submit_batch(pool, &task, 1, wg);
+}
+
+int thread_pool_submit_batch(struct thread_pool* pool, struct thread_task* tasks, int num, struct thread_wg* wg)
+{
+    CHECK_IF(pool == NULL, return THREAD_FAIL, "pool is null");
+    CHECK_IF(pool->is_init != 1, return THREAD_FAIL, "pool is not init yet");
+    CHECK_IF(tasks == NULL, return THREAD_FAIL, "tasks is null");
+    CHECK_IF(num <= 0, return THREAD_FAIL, "num = %d invalid", num);
+
+    int i;
+    if (wg) thread_wg_add(wg, num);
+    for (i=0; i<num; i++)
+    {
+        tasks[i].wg = wg; // whatever the caller left there is not counted
+    }
+
+    // a worker keeps its own work local, what does not fit goes to the injection queue
+    i = 0;
+    if (_self && (_self->pool == pool))
+    {
+        for ( ; i<num; i++)
+        {
+            if (_deque_push(_self, &tasks[i]) != THREAD_OK) break;
+        }
+    }
+
+    int chk = (i < num) ? _inject_push(pool, tasks + i, num - i) : THREAD_OK;
+    if ((chk != THREAD_OK) && wg)
+    {
+        for ( ; i<num; i++)
+        {
+            thread_wg_done(wg);
+        }
+    }
+    _notify(pool, num);
+    return chk;
+}
+
+void thread_pool_wait(struct thread_pool* pool, struct thread_wg* wg)
+{
+    CHECK_IF(pool == NULL, return, "pool is null");
+    CHECK_IF(wg == NULL, return, "wg is null");
+
+    struct thread_worker* self = (_self && (_self->pool == pool)) ? _self : NULL;
+    struct thread_task task;
+    unsigned int seq;
+    int idle = 0;
+    while (__atomic_load_n(&wg->count, __ATOMIC_ACQUIRE) != 0)
+    {
+        seq = __atomic_load_n(&pool->wait_seq, __ATOMIC_SEQ_CST);
+        if (_find_task(pool, self, &task) == THREAD_OK)
+        {
+            _run_task(pool, &task);
+            idle = 0;
+            continue;
+        }
+
+        if (idle++ < THREAD_SPIN)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // the rest runs somewhere, but it may still fan out. a submit or the end of a group after
+        // the seq load either changes seq or sees us waiting, the timeout covers thread_wg_done
+        // called outside the pool
+        __atomic_add_fetch(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+        if ((__atomic_load_n(&pool->wait_seq, __ATOMIC_SEQ_CST) == seq) && (__atomic_load_n(&wg->count, __ATOMIC_SEQ_CST) != 0))
+        {
+            _futex_wait_ms(&pool->wait_seq, seq, THREAD_WAIT_MS);
+        }
+        __atomic_sub_fetch(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+struct thread_for_chunk
+{
+    void (*func)(int begin, int end, void* arg);
+    void* arg;
+    int begin;
+    int end;
+};
+
+static void _for_chunk(void* arg)
+{
+    struct thread_for_chunk* chunk = (struct thread_for_chunk*)arg;
+    chunk->func(chunk->begin, chunk->end, chunk->arg);
+}
+
+int thread_pool_for(struct thread_pool* pool, int begin, int end, int grain,
+                    void (*func)(int begin, int end, void* arg), void* arg)
+{
+    CHECK_IF(pool == NULL, return THREAD_FAIL, "pool is null");
+    CHECK_IF(func == NULL, return THREAD_FAIL, "func is null");
+    CHECK_IF(grain <= 0, return THREAD_FAIL, "grain = %d invalid", grain);
+
+    if (end <= begin) return THREAD_OK;
+
+    int num = (end - begin + grain - 1) / grain;
+    struct thread_for_chunk* chunks = malloc(sizeof(struct thread_for_chunk) * num);
+    struct thread_task* tasks = malloc(sizeof(struct thread_task) * num);
+    CHECK_IF((chunks == NULL) || (tasks == NULL), free(chunks); free(tasks); return THREAD_FAIL, "malloc failed");
+
+    int i;
+    for (i=0; i<num; i++)
+    {
+        chunks[i].func  = func;
+        chunks[i].arg   = arg;
+        chunks[i].begin = begin + i * grain;
+        chunks[i].end   = (chunks[i].begin + grain < end) ? (chunks[i].begin + grain) : end;
+
+        tasks[i].func = _for_chunk;
+        tasks[i].arg  = &chunks[i];
+        tasks[i].wg   = NULL;
+    }
+
+    struct thread_wg wg;
+    thread_wg_init(&wg);
+    int chk = thread_pool_submit_batch(pool, tasks, num, &wg);
+    if (chk == THREAD_OK) thread_pool_wait(pool, &wg);
+
+    free(tasks);
+    free(chunks);
+    return chk;
+}
@@ -2,6 +2,10 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/udp.h>
 
 #include "udp.h"
 
@@ -103,6 +107,8 @@ static int _init_udpv4(struct udp* udp, char* local_ip, int local_port)
 
     udp->type = UDPv4;
     udp->lock = 0;
+    udp->gso_size = 0;
+    udp->is_gro = 0;
     udp->is_init = 1;
     return UDP_OK;
 
@@ -153,6 +159,8 @@ static int _init_udpv6(struct udp* udp, char* local_ip, int local_port)
 
     udp->type = UDPv6;
     udp->lock = 0;
+    udp->gso_size = 0;
+    udp->is_gro = 0;
     udp->is_init = 1;
     return UDP_OK;
 
@@ -184,6 +192,16 @@ int udp_init(struct udp* udp, char* local_ip, int local_port)
     return _init_udpv6(udp, local_ip, local_port);
 }
 
+// payload one send may carry
+static int _gso_max(struct udp* udp)
+{
+    if (udp->gso_size <= 0) return INT_MAX;
+
+    int segs = UDP_GSO_MAX_SIZE / udp->gso_size;
+    if (segs > UDP_GSO_MAX_SEGS) segs = UDP_GSO_MAX_SEGS;
+    return segs * udp->gso_size;
+}
+
 int udp_send(struct udp* udp, struct udp_addr remote, void* data, int data_len)
 {
     assert(udp != NULL);
@@ -198,10 +216,20 @@ int udp_send(struct udp* udp, struct udp_addr remote, void* data, int data_len)
     int chk = udp_to_sockaddr(remote, &remote_addr);
     CHECK_IF(chk != UDP_OK, return -1, "udp_to_sockaddr failed");
 
+    // a GSO send past the kernel limits goes out in several, each a whole number of segments
+    int max = _gso_max(udp);
+    int sendlen = 0;
+    int len = 0;
     LOCK(udp);
-    int sendlen = sendto(udp->fd, data, data_len, 0, (const struct sockaddr*)&remote_addr, addrlen);
+    while (sendlen < data_len)
+    {
+        len = (data_len - sendlen > max) ? max : data_len - sendlen;
+        len = sendto(udp->fd, (char*)data + sendlen, len, 0, (const struct sockaddr*)&remote_addr, addrlen);
+        if (len < 0) break;
+        sendlen += len;
+    }
     UNLOCK(udp);
-    return sendlen;
+    return (sendlen > 0) ? sendlen : len;
 }
 
 int udp_recv(struct udp* udp, void* buffer, int buffer_size, struct udp_addr* remote)
@@ -222,6 +250,146 @@ int udp_recv(struct udp* udp, void* buffer, int buffer_size, struct udp_addr* re
     return recvlen;
 }
 
+static socklen_t _addrlen(union sock_addr* sock_addr)
+{
+    return (sock_addr->ss.ss_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+}
+
+int udp_recv_batch(struct udp* udp, struct udp_msg* msgs, int msg_num)
+{
+    assert(udp != NULL);
+    assert(udp->fd > 0);
+    assert(udp->is_init == 1);
+    assert(msgs != NULL);
+    assert((msg_num > 0) && (msg_num <= UDP_BATCH_MAX));
+
+    struct mmsghdr hdrs[msg_num];
+    struct iovec iovs[msg_num];
+    int i;
+    for (i=0; i<msg_num; i++)
+    {
+        iovs[i].iov_base = msgs[i].data;
+        iovs[i].iov_len  = msgs[i].size;
+
+        memset(&hdrs[i], 0, sizeof(struct mmsghdr));
+        hdrs[i].msg_hdr.msg_name    = &msgs[i].remote;
+        hdrs[i].msg_hdr.msg_namelen = sizeof(union sock_addr);
+        hdrs[i].msg_hdr.msg_iov     = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    int num = recvmmsg(udp->fd, hdrs, msg_num, MSG_WAITFORONE, NULL);
+    for (i=0; i<num; i++)
+    {
+        msgs[i].len = hdrs[i].msg_len;
+    }
+    return num;
+}
+
+int udp_send_batch(struct udp* udp, struct udp_msg* msgs, int msg_num)
+{
+    assert(udp != NULL);
+    assert(udp->fd > 0);
+    assert(udp->is_init == 1);
+    assert(msgs != NULL);
+    assert((msg_num > 0) && (msg_num <= UDP_BATCH_MAX));
+
+    struct mmsghdr hdrs[msg_num];
+    struct iovec iovs[msg_num];
+    int max = _gso_max(udp);
+    int i;
+    for (i=0; i<msg_num; i++)
+    {
+        CHECK_IF(msgs[i].len > max, return -1, "msgs[%d].len = %d is more than %d gso segments", i, msgs[i].len, UDP_GSO_MAX_SEGS);
+        iovs[i].iov_base = msgs[i].data;
+        iovs[i].iov_len  = msgs[i].len;
+
+        memset(&hdrs[i], 0, sizeof(struct mmsghdr));
+        hdrs[i].msg_hdr.msg_name    = &msgs[i].remote;
+        hdrs[i].msg_hdr.msg_namelen = _addrlen(&msgs[i].remote);
+        hdrs[i].msg_hdr.msg_iov     = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    // sendmmsg stops at the first failure, report what went out before it
+    int sent = 0;
+    int num;
+    while (sent < msg_num)
+    {
+        num = sendmmsg(udp->fd, hdrs + sent, msg_num - sent, 0);
+        if (num < 0 && errno == EINTR) continue;
+        if (num <= 0) break;
+        sent += num;
+    }
+    return (sent > 0) ? sent : -1;
+}
+
+int udp_set_gso(struct udp* udp, int seg_size)
+{
+    assert(udp != NULL);
+    assert(udp->fd > 0);
+    assert(udp->is_init == 1);
+    assert((seg_size >= 0) && (seg_size <= UDP_GSO_MAX_SIZE));
+
+    int chk = setsockopt(udp->fd, SOL_UDP, UDP_SEGMENT, &seg_size, sizeof(seg_size));
+    CHECK_IF(chk < 0, return UDP_FAIL, "setsockopt udp_segment failed. %s", strerror(errno));
+
+    udp->gso_size = seg_size;
+    return UDP_OK;
+}
+
+int udp_set_gro(struct udp* udp, int on)
+{
+    assert(udp != NULL);
+    assert(udp->fd > 0);
+    assert(udp->is_init == 1);
+
+    on = (on != 0);
+    int chk = setsockopt(udp->fd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+    CHECK_IF(chk < 0, return UDP_FAIL, "setsockopt udp_gro failed. %s", strerror(errno));
+
+    udp->is_gro = on;
+    return UDP_OK;
+}
+
+int udp_recv_gro(struct udp* udp, void* buffer, int buffer_size, union sock_addr* remote, int* seg_size)
+{
+    assert(udp != NULL);
+    assert(udp->fd > 0);
+    assert(udp->is_init == 1);
+    assert(buffer != NULL);
+    assert(buffer_size > 0);
+    assert(remote != NULL);
+    assert(seg_size != NULL);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {buffer, buffer_size};
+    struct msghdr msg = {};
+    msg.msg_name       = remote;
+    msg.msg_namelen    = sizeof(union sock_addr);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    int recvlen = recvmsg(udp->fd, &msg, 0);
+    if (recvlen <= 0) return recvlen;
+
+    // no cmsg : a single datagram
+    *seg_size = recvlen;
+
+    struct cmsghdr* cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO))
+        {
+            memcpy(seg_size, CMSG_DATA(cmsg), sizeof(int));
+            break;
+        }
+    }
+    return recvlen;
+}
+
 int udp_uninit(struct udp* udp)
 {
     assert(udp != NULL);
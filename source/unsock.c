@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
 
 #include "unsock.h"
 
@@ -142,3 +145,17 @@ int untcp_send(struct untcp* untcp, void* data, int data_len)
     CHECK_IF(data_len <= 0, return UN_FAIL, "data_len (%d) <= 0", data_len);
     return send(untcp->fd, data, data_len, 0);
 }
+
+int untcp_sendv(struct untcp* untcp, struct iovec* iov, int iov_num)
+{
+    CHECK_IF(untcp == NULL, return UN_FAIL, "untcp is null");
+    CHECK_IF(untcp->is_init != 1, return UN_FAIL, "untcp is not init yet");
+    CHECK_IF(untcp->fd <= 0, return UN_FAIL, "untcp fd (%d) <= 0", untcp->fd);
+    CHECK_IF(iov == NULL, return UN_FAIL, "iov is null");
+    CHECK_IF((iov_num <= 0) || (iov_num > IOV_MAX), return UN_FAIL, "iov_num (%d) invalid", iov_num);
+
+    struct msghdr msg = {};
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iov_num;
+    return sendmsg(untcp->fd, &msg, 0);
+}